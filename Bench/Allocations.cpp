@@ -0,0 +1,39 @@
+#include "Bench.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Replaces the allocation functions of the whole Bench program. Kept in a file of its own so the
+// compiler can't pair the malloc and free in here with news and deletes elsewhere.
+
+static std::atomic<uint64> g_numAllocations(0);
+static thread_local bool t_counted = true;
+
+void* operator new(size_t size) {
+	if (t_counted) {
+		g_numAllocations.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void* memory = std::malloc((size > 0) ? size : 1);
+	if (memory == nullptr) {
+		throw std::bad_alloc();
+	}
+	return memory;
+}
+
+void operator delete(void* memory) noexcept {
+	std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+	std::free(memory);
+}
+
+uint64 getNumAllocations() {
+	return g_numAllocations;
+}
+
+void setAllocationsCounted(bool counted) {
+	t_counted = counted;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "Types.h"
+#include "IPV4Address.h"
+
+#include <string>
+#include <unordered_map>
+
+// Options given to a benchmark as --name=value
+class BenchOptions {
+private:
+	std::unordered_map<std::string, std::string> m_values;
+public:
+	BenchOptions(int32 argc, char** argv, int32 first);
+
+	uint32 getUInt(const std::string& name, uint32 defaultValue) const;
+	std::string getString(const std::string& name, const std::string& defaultValue) const;
+};
+
+class Server;
+struct ServerOptions;
+
+// Server on 127.0.0.1 with logging off, started the way the Server project starts it. Unless kept,
+// the files it persists to are removed before it starts and after it is gone.
+class BenchServer {
+private:
+	Server* m_server;
+	bool m_keepFiles;
+	uint64 m_loadTime;	// Constructing the server and loading its files, in 100 nanosecond ticks
+public:
+	BenchServer(const ServerOptions& options, bool keepFiles = false);
+	BenchServer(const BenchServer&) = delete;
+	BenchServer& operator=(const BenchServer&) = delete;
+	~BenchServer();
+
+	Server& get() { return *m_server; }
+	uint64 getLoadTime() const { return m_loadTime; }
+
+	static IPV4Address getAddress();
+	static void removeFiles();
+};
+
+// The server tells clients apart by address alone, so each bench client binds its own loopback
+// address
+IPV4Address getClientAddress(uint32 index);
+
+// Heap allocations made so far through the replaced global operator new
+uint64 getNumAllocations();
+// Turned off on the bench's own threads so only the server's allocations are counted
+void setAllocationsCounted(bool counted);
+
+// Monotonic ticks to the units results are reported in
+inline float64 toNanoseconds(uint64 ticks) { return ticks * 100.0; }
+inline float64 toMilliseconds(uint64 ticks) { return ticks / 10000.0; }
+
+// Each prints its results and returns false if it couldn't run
+bool runLoopbackBench(const BenchOptions& options);
+bool runUDPBurstBench(const BenchOptions& options);
+bool runPacketAllocBench(const BenchOptions& options);
+bool runTimingWheelBench(const BenchOptions& options);
+bool runSchedulerBench(const BenchOptions& options);
+bool runBidBench(const BenchOptions& options);
+bool runRegisterBench(const BenchOptions& options);
+bool runJournalBench(const BenchOptions& options);
+bool runSnapshotBench(const BenchOptions& options);
@@ -0,0 +1,53 @@
+#include "Bench.h"
+
+#include "Clock.h"
+#include "Server.h"
+#include "Log.h"
+#include "Socket.h"
+
+#include <cstdio>
+#include <string>
+
+BenchServer::BenchServer(const ServerOptions& options, bool keepFiles) : m_keepFiles(keepFiles) {
+	if (!m_keepFiles) {
+		removeFiles();
+	}
+	setLogEnabled(false);
+
+	const uint64 start = getMonotonicTime();
+	m_server = new Server(getAddress(), options);
+	m_server->loadConnections();
+	m_loadTime = getMonotonicTime() - start;
+
+	m_server->startPersistenceThread();
+	m_server->startUDPServiceThread();
+	m_server->startTCPServiceThread();
+	m_server->startConnectionServiceThread();
+	m_server->startAuctionShards();
+}
+
+BenchServer::~BenchServer() {
+	m_server->shutdown();
+	delete m_server;
+
+	setLogEnabled(true);
+	if (!m_keepFiles) {
+		removeFiles();
+	}
+}
+
+IPV4Address BenchServer::getAddress() {
+	return IPV4Address("127.0.0.1", DEFAULT_PORT);
+}
+
+void BenchServer::removeFiles() {
+	std::remove("connections.dat");
+	std::remove("connections.journal");
+}
+
+IPV4Address getClientAddress(uint32 index) {
+	// From 127.1.0.1 on, away from the server on 127.0.0.1
+	const uint32 host = index + 1;
+	const std::string address = "127." + std::to_string(1 + (host >> 16)) + "." + std::to_string((host >> 8) & 0xFF) + "." + std::to_string(host & 0xFF);
+	return IPV4Address(address, "0");
+}
@@ -0,0 +1,141 @@
+#include "Bench.h"
+
+#include "Clock.h"
+#include "Item.h"
+#include "SequenceRing.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Producer threads stand in for the I/O threads decoding bids. They either apply each bid under a
+// recursive mutex, as Server::bid did with g_auctionLock, or push it into a SequenceRing drained
+// by a single matching thread, as the auction shards do. Both apply the shard's bid rules.
+
+struct BenchBid {
+	uint32 item;
+	float32 amount;
+	ClientID client;
+};
+
+struct BidRun {
+	std::vector<std::unique_ptr<Item>> items;
+	uint32 bidsPerProducer;
+	uint32 numProducers;
+	std::atomic<uint64> numAccepted;
+};
+
+static BenchBid makeBid(const BidRun& run, uint32 producer, uint32 index) {
+	BenchBid bid;
+	bid.item = (index * 7919u + producer) % static_cast<uint32>(run.items.size());
+	bid.amount = static_cast<float32>(index + 1);
+	bid.client = producer + 1;
+	return bid;
+}
+
+static bool applyBid(BidRun& run, const BenchBid& bid) {
+	Item& item = *run.items[bid.item];
+	if (bid.amount <= item.getCurrentHighest() || bid.client == item.getSeller()) {
+		return false;
+	}
+	item.setCurrentHighest(bid.amount);
+	item.setHighestBidder(bid.client);
+	return true;
+}
+
+static uint64 runMutex(BidRun& run) {
+	std::recursive_mutex lock;
+	std::vector<std::thread> producers;
+
+	const uint64 start = getMonotonicTime();
+	for (uint32 p = 0; p < run.numProducers; p++) {
+		producers.emplace_back([&run, &lock, p]() {
+			uint64 accepted = 0;
+			for (uint32 i = 0; i < run.bidsPerProducer; i++) {
+				const BenchBid bid = makeBid(run, p, i);
+				std::lock_guard<std::recursive_mutex> guard(lock);
+				accepted += applyBid(run, bid) ? 1 : 0;
+			}
+			run.numAccepted += accepted;
+		});
+	}
+	for (std::thread& producer : producers) {
+		producer.join();
+	}
+	return getMonotonicTime() - start;
+}
+
+static uint64 runRing(BidRun& run, uint32 ringSize, uint64& fullWaits) {
+	SequenceRing<BenchBid> ring(ringSize);
+	const uint64 total = static_cast<uint64>(run.bidsPerProducer) * run.numProducers;
+
+	const uint64 start = getMonotonicTime();
+	std::thread matcher([&run, &ring, total]() {
+		uint64 accepted = 0;
+		uint64 consumed = 0;
+		BenchBid bid;
+		while (consumed < total) {
+			if (!ring.pop(bid)) {
+				ring.wait(std::chrono::milliseconds(1));
+				continue;
+			}
+			accepted += applyBid(run, bid) ? 1 : 0;
+			consumed++;
+		}
+		run.numAccepted += accepted;
+	});
+
+	std::vector<std::thread> producers;
+	for (uint32 p = 0; p < run.numProducers; p++) {
+		producers.emplace_back([&run, &ring, p]() {
+			for (uint32 i = 0; i < run.bidsPerProducer; i++) {
+				ring.push(makeBid(run, p, i));
+			}
+		});
+	}
+	for (std::thread& producer : producers) {
+		producer.join();
+	}
+	matcher.join();
+
+	fullWaits = ring.getNumFullWaits();
+	return getMonotonicTime() - start;
+}
+
+static void resetRun(BidRun& run, uint32 numItems) {
+	run.items.clear();
+	for (uint32 i = 0; i < numItems; i++) {
+		// The seller never bids
+		run.items.emplace_back(new Item("Bench item", 0.0f, 0, i));
+	}
+	run.numAccepted = 0;
+}
+
+bool runBidBench(const BenchOptions& options) {
+	const uint32 numItems = std::max(options.getUInt("items", 1000), 1u);
+	const uint32 numBids = options.getUInt("bids", 4000000);
+	const uint32 ringSize = options.getUInt("ring-size", 16384);
+
+	BidRun run;
+	run.numProducers = std::max(options.getUInt("producers", 4), 1u);
+	run.bidsPerProducer = numBids / run.numProducers;
+	const uint64 total = static_cast<uint64>(run.bidsPerProducer) * run.numProducers;
+
+	printf("%llu bids on %u items from %u producer threads, %u hardware threads\n", static_cast<unsigned long long>(total), numItems, run.numProducers, std::thread::hardware_concurrency());
+	printf("%-22s %14s %12s %12s\n", "", "bids/s", "accepted", "full waits");
+
+	resetRun(run, numItems);
+	const uint64 mutexTime = runMutex(run);
+	printf("%-22s %14.0f %12llu %12s\n", "recursive mutex", total / (mutexTime / 10000000.0), static_cast<unsigned long long>(run.numAccepted.load()), "-");
+
+	resetRun(run, numItems);
+	uint64 fullWaits = 0;
+	const uint64 ringTime = runRing(run, ringSize, fullWaits);
+	printf("%-22s %14.0f %12llu %12llu\n", "ring, single matcher", total / (ringTime / 10000000.0), static_cast<unsigned long long>(run.numAccepted.load()), static_cast<unsigned long long>(fullWaits));
+	return true;
+}
@@ -0,0 +1,120 @@
+#include "Bench.h"
+
+#include "Clock.h"
+#include "File.h"
+#include "Journal.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Threads append and commit REGISTER sized records for a fixed time under each sync policy, the
+// way the server journals a change and waits for it. For comparison a single thread also
+// rewrites the whole state file per change, synced, which is what saving connections.dat did.
+
+static constexpr char JOURNAL_PATH[] = "bench.journal";
+static constexpr char STATE_PATH[] = "bench.dat";
+static constexpr uint8 RECORD_TYPE = 1;
+
+struct JournalResult {
+	uint64 mutations;
+	uint64 syncs;
+	uint64 commits;
+};
+
+static JournalResult runJournal(JournalSyncPolicy policy, uint32 numThreads, uint64 duration) {
+	std::remove(JOURNAL_PATH);
+
+	// Same interval as the server's default
+	Journal journal(JOURNAL_PATH, policy, 100 * 10000ull);
+	journal.read();
+	journal.open(getSystemTime());
+
+	std::atomic<uint64> numMutations(0);
+	std::atomic<bool> running(true);
+	std::vector<std::thread> threads;
+	for (uint32 t = 0; t < numThreads; t++) {
+		threads.emplace_back([&journal, &numMutations, &running, t]() {
+			uint64 count = 0;
+			while (running) {
+				JournalRecord record;
+				record.writeString("client" + std::to_string(t) + "_" + std::to_string(count));
+				record.writeString("127.0.0.1:18081");
+				journal.commit(journal.append(RECORD_TYPE, record));
+				count++;
+			}
+			numMutations += count;
+		});
+	}
+
+	// Stands in for the persistence thread, which syncs the tail while idle
+	const uint64 end = getMonotonicTime() + duration;
+	while (getMonotonicTime() < end) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		journal.syncWritten(false);
+	}
+	running = false;
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	journal.syncWritten(true);
+
+	const JournalStatistics statistics = journal.getStatistics();
+	journal.close();
+	std::remove(JOURNAL_PATH);
+
+	return JournalResult{ numMutations, statistics.syncs, statistics.commits };
+}
+
+static JournalResult runRewrite(uint32 numClients, uint64 duration) {
+	// Roughly a connections.dat line per client
+	std::string state;
+	for (uint32 i = 0; i < numClients; i++) {
+		state += "client" + std::to_string(i) + " 127.0.0.1 18081\n";
+	}
+
+	JournalResult result = {};
+	const uint64 end = getMonotonicTime() + duration;
+	while (getMonotonicTime() < end) {
+		File::writeAtomically(STATE_PATH, state.data(), state.size());
+		result.mutations++;
+		result.syncs++;
+	}
+	std::remove(STATE_PATH);
+	return result;
+}
+
+bool runJournalBench(const BenchOptions& options) {
+	const uint64 duration = std::max(options.getUInt("ms", 1000), 1u) * 10000ull;
+	const uint32 maxThreads = std::max(options.getUInt("threads", 8), 1u);
+	const uint32 numClients = options.getUInt("clients", 1000);
+
+	const struct {
+		JournalSyncPolicy policy;
+		const char* name;
+	} policies[] = {
+		{ JournalSyncPolicy::NONE, "none" },
+		{ JournalSyncPolicy::COMMIT, "commit" },
+		{ JournalSyncPolicy::INTERVAL, "interval" },
+	};
+
+	const float64 seconds = duration / 10000000.0;
+	printf("%-28s %8s %14s %10s %12s\n", "", "threads", "mutations/s", "syncs", "per write");
+	for (const auto& policy : policies) {
+		// A single writer, then enough of them to form groups
+		for (uint32 numThreads = 1; numThreads <= maxThreads; numThreads = (numThreads < maxThreads) ? maxThreads : numThreads + 1) {
+			const JournalResult result = runJournal(policy.policy, numThreads, duration);
+			const std::string name = std::string("journal, ") + policy.name;
+			printf("%-28s %8u %14.0f %10llu %12.2f\n", name.c_str(), numThreads, result.mutations / seconds, static_cast<unsigned long long>(result.syncs), (result.commits > 0) ? static_cast<float64>(result.mutations) / result.commits : 0.0);
+		}
+	}
+
+	const JournalResult rewrite = runRewrite(numClients, duration);
+	const std::string name = "rewrite " + std::to_string(numClients) + " clients";
+	printf("%-28s %8u %14.0f %10llu %12.2f\n", name.c_str(), 1u, rewrite.mutations / seconds, static_cast<unsigned long long>(rewrite.syncs), 1.0);
+	return true;
+}
@@ -0,0 +1,205 @@
+#include "Bench.h"
+
+#include "Clock.h"
+#include "CompletionPort.h"
+#include "OverlappedBuffer.h"
+#include "UDPSocket.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// A sender blasts datagrams at a receiver on 127.0.0.1 and the receiver counts what arrives. The
+// blocking paths make a syscall per receive call, the completion port counts its own.
+
+static constexpr uint8 DATA_MARKER = 0;
+static constexpr uint8 END_MARKER = 0xFF;
+static constexpr uint32 END_MARKERS = 16;
+static constexpr uint32 RECEIVE_TIMEOUT = 2000;	// Milliseconds without a datagram that end a run
+
+enum class ReceiveMode : uint8 {
+	BLOCKING,		// UDPSocket::receive, one datagram per call
+	BATCHED,		// UDPSocket::receive into an array, as many as are waiting per call
+	PORT,			// Default completion port engine
+	URING
+};
+
+struct LoopbackResult {
+	uint64 received;
+	uint64 syscalls;
+	uint64 time;	// From the first send to the last datagram received
+};
+
+static void sendRoutine(const IPV4Address& destination, uint32 numMessages, uint32 size, std::atomic<uint64>* startTime) {
+	UDPSocket socket;
+
+	std::vector<uint8> data(size, DATA_MARKER);
+	std::vector<Packet> packets(UDPSocket::BATCH_SIZE, Packet(data.data(), size));
+	for (Packet& packet : packets) {
+		packet.setAddress(destination);
+	}
+
+	*startTime = getMonotonicTime();
+	uint32 sent = 0;
+	while (sent < numMessages) {
+		const uint32 count = std::min(numMessages - sent, UDPSocket::BATCH_SIZE);
+		socket.send(packets.data(), count);
+		sent += count;
+	}
+
+	// Once the receiver caught up, so the markers themselves aren't lost to a full buffer
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	data[0] = END_MARKER;
+	Packet end(data.data(), size);
+	end.setAddress(destination);
+	for (uint32 i = 0; i < END_MARKERS; i++) {
+		socket.send(end);
+	}
+}
+
+static LoopbackResult receiveBlocking(UDPSocket& socket, bool batched) {
+	LoopbackResult result = {};
+	uint64 lastReceived = 0;
+
+	std::vector<Packet> packets(batched ? UDPSocket::BATCH_SIZE : 1);
+	socket.setTimeout(RECEIVE_TIMEOUT);
+	try {
+		for (;;) {
+			uint32 count = 1;
+			if (batched) {
+				count = socket.receive(packets.data(), static_cast<uint32>(packets.size()));
+			}
+			else {
+				packets[0] = socket.receive();
+			}
+			result.syscalls++;
+
+			bool ended = false;
+			for (uint32 i = 0; i < count; i++) {
+				if (packets[i].getMessageData()[0] == END_MARKER) {
+					ended = true;
+				}
+				else {
+					result.received++;
+					lastReceived = getMonotonicTime();
+				}
+			}
+			if (ended) {
+				break;
+			}
+		}
+	}
+	catch (int32) {
+		// Timed out, the end markers were lost too
+	}
+
+	result.time = lastReceived;
+	return result;
+}
+
+static LoopbackResult receiveFromPort(UDPSocket& socket, IOEngine engine, uint32 numBuffers) {
+	LoopbackResult result = {};
+	uint64 lastReceived = 0;
+
+	CompletionPort* port = CompletionPort::create(engine);
+	port->associate(socket, 1);
+
+	std::vector<OverlappedBuffer> buffers(numBuffers);
+	for (OverlappedBuffer& buffer : buffers) {
+		socket.receiveOverlapped(buffer);
+	}
+
+	const uint64 syscalls = port->getStatistics().syscalls;
+	Completion completion;
+	while (port->wait(completion, RECEIVE_TIMEOUT)) {
+		if (completion.status == CompletionStatus::ABORTED) {
+			break;
+		}
+		if (completion.status == CompletionStatus::SUCCESS) {
+			if (completion.buffer->getData()[0] == END_MARKER) {
+				break;
+			}
+			result.received++;
+			lastReceived = getMonotonicTime();
+		}
+		socket.receiveOverlapped(*completion.buffer);
+	}
+	result.syscalls = port->getStatistics().syscalls - syscalls;
+
+	socket.close();
+	delete port;
+
+	result.time = lastReceived;
+	return result;
+}
+
+static LoopbackResult runMode(ReceiveMode mode, const IPV4Address& address, uint32 numMessages, uint32 size, uint32 numBuffers, uint32 socketBuffer) {
+	const bool overlapped = (mode == ReceiveMode::PORT || mode == ReceiveMode::URING);
+	UDPSocket socket(overlapped);
+	socket.bind(address);
+	socket.setReceiveBufferSize(socketBuffer);
+
+	std::atomic<uint64> startTime(0);
+	std::thread sender(sendRoutine, address, numMessages, size, &startTime);
+
+	LoopbackResult result = {};
+	switch (mode) {
+	case ReceiveMode::BLOCKING:
+		result = receiveBlocking(socket, false);
+		break;
+	case ReceiveMode::BATCHED:
+		result = receiveBlocking(socket, true);
+		break;
+	case ReceiveMode::PORT:
+		result = receiveFromPort(socket, IOEngine::DEFAULT, numBuffers);
+		break;
+	case ReceiveMode::URING:
+		result = receiveFromPort(socket, IOEngine::IO_URING, numBuffers);
+		break;
+	}
+	sender.join();
+	socket.close();
+
+	result.time = (result.time > startTime) ? result.time - startTime : 0;
+	return result;
+}
+
+bool runLoopbackBench(const BenchOptions& options) {
+	const uint32 numMessages = options.getUInt("messages", 1000000);
+	const uint32 size = std::max(std::min(options.getUInt("size", 64), Packet::PACKET_SIZE), 1u);
+	const uint32 numBuffers = std::max(options.getUInt("buffers", 16), 1u);
+	const uint32 socketBuffer = options.getUInt("socket-buffer", 8 * 1024 * 1024);
+	const IPV4Address address("127.0.0.1", options.getString("port", "18091"));
+
+	printf("%u datagrams of %u bytes over loopback, %u receives posted on the port\n", numMessages, size, numBuffers);
+	printf("%-10s %12s %8s %14s %14s\n", "receive", "received", "lost", "messages/s", "syscalls/msg");
+
+	const struct {
+		ReceiveMode mode;
+		const char* name;
+	} modes[] = {
+		{ ReceiveMode::BLOCKING, "blocking" },
+		{ ReceiveMode::BATCHED, "batched" },
+		{ ReceiveMode::PORT, "port" },
+#ifndef _WIN32
+		{ ReceiveMode::URING, "io_uring" },
+#endif
+	};
+
+	const std::string only = options.getString("mode", "");
+	for (const auto& mode : modes) {
+		if (!only.empty() && only != mode.name) {
+			continue;
+		}
+
+		const LoopbackResult result = runMode(mode.mode, address, numMessages, size, numBuffers, socketBuffer);
+		const float64 seconds = result.time / 10000000.0;
+		printf("%-10s %12llu %8llu %14.0f %14.3f\n", mode.name, static_cast<unsigned long long>(result.received), static_cast<unsigned long long>(numMessages - result.received),
+			(seconds > 0.0) ? result.received / seconds : 0.0, (result.received > 0) ? static_cast<float64>(result.syscalls) / result.received : 0.0);
+	}
+	return true;
+}
@@ -0,0 +1,87 @@
+#include "Bench.h"
+
+#include "Error.h"
+#include "ThreadPool.h"
+#include "WSA.h"
+
+#include <cstdio>
+
+struct Benchmark {
+	const char* name;
+	const char* description;
+	bool (*run)(const BenchOptions& options);
+};
+
+static const Benchmark BENCHMARKS[] = {
+	{ "loopback", "UDP loopback throughput and syscalls per message, blocking receive against the completion port", runLoopbackBench },
+	{ "udp-burst", "REGISTER bursts from many clients, datagrams lost with one receive and worker against the defaults", runUDPBurstBench },
+	{ "packet-alloc", "Heap allocations and pooled packet buffers per message while bids fan out as HIGHEST", runPacketAllocBench },
+	{ "timing-wheel", "Scheduling and firing 1M auction deadlines on the timing wheel against a sorted multimap", runTimingWheelBench },
+	{ "scheduler", "Work stealing pool throughput for submitted and spawned tasks, and spawn latency", runSchedulerBench },
+	{ "bids", "Bids per second through the sequencer ring and single matcher against the auction mutex", runBidBench },
+	{ "register-storm", "REGISTER round trip as the number of registered clients grows", runRegisterBench },
+	{ "journal", "Journal mutations per second under each sync policy against rewriting the state file", runJournalBench },
+	{ "snapshot", "Server startup time on the binary snapshot against the old text format", runSnapshotBench },
+};
+
+BenchOptions::BenchOptions(int32 argc, char** argv, int32 first) {
+	for (int32 i = first; i < argc; i++) {
+		std::string arg(argv[i]);
+		if (arg.compare(0, 2, "--") != 0) {
+			continue;
+		}
+
+		const size_t equals = arg.find('=');
+		if (equals == std::string::npos) {
+			m_values[arg.substr(2)] = "";
+		}
+		else {
+			m_values[arg.substr(2, equals - 2)] = arg.substr(equals + 1);
+		}
+	}
+}
+
+uint32 BenchOptions::getUInt(const std::string& name, uint32 defaultValue) const {
+	auto iter = m_values.find(name);
+	return (iter != m_values.end() && !iter->second.empty()) ? static_cast<uint32>(std::stoul(iter->second)) : defaultValue;
+}
+
+std::string BenchOptions::getString(const std::string& name, const std::string& defaultValue) const {
+	auto iter = m_values.find(name);
+	return (iter != m_values.end()) ? iter->second : defaultValue;
+}
+
+static void printUsage() {
+	printf("Usage: Bench <name> [--option=value ...]\n\n");
+	for (const Benchmark& benchmark : BENCHMARKS) {
+		printf("  %-14s %s\n", benchmark.name, benchmark.description);
+	}
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		printUsage();
+		return 1;
+	}
+
+	const Benchmark* benchmark = nullptr;
+	for (const Benchmark& candidate : BENCHMARKS) {
+		if (std::string(argv[1]) == candidate.name) {
+			benchmark = &candidate;
+		}
+	}
+	if (benchmark == nullptr) {
+		printUsage();
+		return 1;
+	}
+
+	initErrorCodeStringMap();
+	ThreadPool::init();
+	WSA::init();
+
+	const bool ran = benchmark->run(BenchOptions(argc, argv, 2));
+
+	ThreadPool::destroy();
+	WSA::destroy();
+	return ran ? 0 : 1;
+}
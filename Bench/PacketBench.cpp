@@ -0,0 +1,195 @@
+#include "Bench.h"
+
+#include "Clock.h"
+#include "Messages.h"
+#include "PacketPool.h"
+#include "Server.h"
+#include "TCPSocket.h"
+#include "UDPSocket.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Clients bid on a single item over TCP and each HIGHEST is sent back to all of them. Bids that
+// reach the shard in the same batch end in a single HIGHEST.
+// Heap allocations are counted on the server's threads only, the bench's own threads play the
+// clients and are left out.
+
+static constexpr uint32 CLIENT_SOCKET_BUFFER = 1024 * 1024;
+static constexpr uint64 IDLE_TIME = 5000000;	// Half a second without messages ends a run
+
+struct BenchClient {
+	UDPSocket udp;
+	TCPSocket tcp;
+};
+
+template<typename T>
+static void sendTo(UDPSocket& socket, const T& msg) {
+	Packet packet = serializeMessage(msg);
+	packet.setAddress(BenchServer::getAddress());
+	socket.send(packet);
+}
+
+static bool connectClient(BenchClient& client, uint32 index) {
+	const IPV4Address address = getClientAddress(index);
+	client.udp.bind(address);
+	client.udp.setTimeout(2000);
+
+	RegisterMessage msg;
+	msg.reqNum = 1;
+	snprintf(msg.name, NAMELENGTH, "client%u", index);
+	snprintf(msg.iPAddress, IPLENGTH, "%s", address.getSocketAddressAsString().c_str());
+	snprintf(msg.port, PORTLENGTH, "0");
+	sendTo(client.udp, msg);
+
+	try {
+		const Packet reply = client.udp.receive();
+		if (static_cast<MessageType>(reply.getMessageData()[0]) != MessageType::MSG_REGISTERED) {
+			return false;
+		}
+	}
+	catch (int32) {
+		return false;
+	}
+
+	// From the same address so the server binds the stream to the registration
+	client.tcp.bind(address);
+	client.tcp.setReceiveBufferSize(CLIENT_SOCKET_BUFFER);
+	client.tcp.connect(BenchServer::getAddress());
+	return true;
+}
+
+// Offers until the server has bound the seller's stream, returns the item number
+static bool offerItem(BenchClient& seller, uint32& itemNum) {
+	for (uint32 attempt = 0; attempt < 20; attempt++) {
+		OfferMessage msg;
+		msg.reqNum = attempt + 1;
+		snprintf(msg.name, NAMELENGTH, "client0");
+		msg.iPAddress[0] = '\0';
+		snprintf(msg.description, DESCLENGTH, "Bench item");
+		msg.minimum = 1.0f;
+		sendTo(seller.udp, msg);
+
+		try {
+			for (;;) {
+				// NEW_ITEM arrives on the same socket
+				const Packet reply = seller.udp.receive();
+				const MessageType type = static_cast<MessageType>(reply.getMessageData()[0]);
+				if (type == MessageType::MSG_OFFER_CONF) {
+					itemNum = deserializeMessage<OfferConfMessage>(reply).itemNum;
+					return true;
+				}
+				if (type == MessageType::MSG_OFFER_DENIED) {
+					break;
+				}
+			}
+		}
+		catch (int32) {
+			return false;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+	return false;
+}
+
+static void readRoutine(std::vector<std::unique_ptr<BenchClient>>* clients, std::atomic<bool>* running, std::atomic<uint64>* numReceived) {
+	setAllocationsCounted(false);
+
+	uint64 lastReceived = getMonotonicTime();
+	while (*running || getMonotonicTime() - lastReceived < IDLE_TIME) {
+		bool any = false;
+		for (std::unique_ptr<BenchClient>& client : *clients) {
+			while (client->tcp.canReceive()) {
+				client->tcp.receive();
+				(*numReceived)++;
+				lastReceived = getMonotonicTime();
+				any = true;
+			}
+		}
+		if (!any) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+}
+
+bool runPacketAllocBench(const BenchOptions& options) {
+	setAllocationsCounted(false);
+
+	const uint32 numClients = std::max(options.getUInt("clients", 50), 2u);
+	const uint32 numBids = options.getUInt("bids", 2000);
+
+	ServerOptions serverOptions;
+	serverOptions.journalSync = JournalSyncPolicy::NONE;
+	serverOptions.registeredConfirm = ConfirmPolicy::IMMEDIATE;
+	BenchServer server(serverOptions);
+
+	std::vector<std::unique_ptr<BenchClient>> clients;
+	for (uint32 i = 0; i < numClients; i++) {
+		clients.emplace_back(new BenchClient());
+		if (!connectClient(*clients.back(), i)) {
+			printf("Client %u could not register\n", i);
+			return false;
+		}
+	}
+
+	uint32 itemNum = 0;
+	if (!offerItem(*clients[0], itemNum)) {
+		printf("The offer was not accepted\n");
+		return false;
+	}
+
+	std::atomic<bool> running(true);
+	std::atomic<uint64> numReceived(0);
+	std::thread reader(readRoutine, &clients, &running, &numReceived);
+
+	// Every other client bids once first so all of them watch the item before counting starts
+	float32 amount = 1.0f;
+	for (uint32 i = 1; i < numClients; i++) {
+		BidMessage msg;
+		msg.reqNum = 1;
+		msg.itemNum = itemNum;
+		msg.amount = ++amount;
+		clients[i]->tcp.send(serializeMessage(msg));
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+	const uint64 allocations = getNumAllocations();
+	const PacketPoolStatistics pool = PacketPool::get().getStatistics();
+	const uint64 received = numReceived;
+
+	for (uint32 i = 0; i < numBids; i++) {
+		BidMessage msg;
+		msg.reqNum = 2 + i;
+		msg.itemNum = itemNum;
+		msg.amount = ++amount;
+		clients[1 + i % (numClients - 1)]->tcp.send(serializeMessage(msg));
+	}
+
+	running = false;
+	reader.join();
+
+	const uint64 serverAllocations = getNumAllocations() - allocations;
+	const PacketPoolStatistics after = PacketPool::get().getStatistics();
+	const uint64 highest = numReceived - received;
+	// The bench serialized each bid and received each HIGHEST into a buffer of its own
+	const uint64 serverAcquired = (after.acquired - pool.acquired) - numBids - highest;
+	const uint64 handled = numBids + highest;
+
+	printf("%u clients, %u bids, %llu HIGHEST received\n", numClients, numBids, static_cast<unsigned long long>(highest));
+	printf("%-40s %10s %14s\n", "", "count", "per message");
+	printf("%-40s %10llu %14.3f\n", "heap allocations on server threads", static_cast<unsigned long long>(serverAllocations), static_cast<float64>(serverAllocations) / handled);
+	// The old Packet allocated each of these, and every copy of one on top
+	printf("%-40s %10llu %14.3f\n", "packet buffers acquired by the server", static_cast<unsigned long long>(serverAcquired), static_cast<float64>(serverAcquired) / handled);
+	printf("%-40s %10llu %14.3f\n", "pool slabs allocated", static_cast<unsigned long long>(after.allocations - pool.allocations), static_cast<float64>(after.allocations - pool.allocations) / handled);
+
+	for (std::unique_ptr<BenchClient>& client : clients) {
+		client->tcp.close();
+		client->udp.close();
+	}
+	return true;
+}
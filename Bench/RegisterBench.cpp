@@ -0,0 +1,73 @@
+#include "Bench.h"
+
+#include "Clock.h"
+#include "Messages.h"
+#include "Server.h"
+#include "UDPSocket.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+// Clients register one after the other, each from its own address, while the registry grows.
+// Only the time from sending the REGISTER to receiving the reply is counted, so the cost per
+// REGISTER should stay flat from the first tenth of the clients to the last.
+
+bool runRegisterBench(const BenchOptions& options) {
+	const uint32 numClients = std::max(options.getUInt("clients", 20000), 10u);
+
+	ServerOptions serverOptions;
+	serverOptions.journalSync = JournalSyncPolicy::NONE;
+	serverOptions.registeredConfirm = ConfirmPolicy::IMMEDIATE;
+	BenchServer server(serverOptions);
+
+	std::vector<uint64> times;
+	times.reserve(numClients);
+	for (uint32 i = 0; i < numClients; i++) {
+		const IPV4Address address = getClientAddress(i);
+		UDPSocket socket;
+		socket.bind(address);
+		socket.setTimeout(2000);
+
+		RegisterMessage msg;
+		msg.reqNum = 1;
+		snprintf(msg.name, NAMELENGTH, "storm%u", i);
+		snprintf(msg.iPAddress, IPLENGTH, "%s", address.getSocketAddressAsString().c_str());
+		snprintf(msg.port, PORTLENGTH, "0");
+		Packet packet = serializeMessage(msg);
+		packet.setAddress(BenchServer::getAddress());
+
+		const uint64 start = getMonotonicTime();
+		socket.send(packet);
+		try {
+			const Packet reply = socket.receive();
+			if (static_cast<MessageType>(reply.getMessageData()[0]) != MessageType::MSG_REGISTERED) {
+				printf("Client %u was not registered\n", i);
+				return false;
+			}
+		}
+		catch (int32) {
+			printf("No reply to client %u\n", i);
+			return false;
+		}
+		times.push_back(getMonotonicTime() - start);
+
+		socket.close();
+	}
+
+	printf("%u clients registering one at a time\n", numClients);
+	printf("%-24s %14s %14s\n", "already registered", "mean us", "median us");
+	const uint32 tenth = numClients / 10;
+	for (uint32 decile = 0; decile < 10; decile++) {
+		std::vector<uint64> slice(times.begin() + decile * tenth, times.begin() + (decile + 1) * tenth);
+		uint64 sum = 0;
+		for (uint64 time : slice) {
+			sum += time;
+		}
+		std::sort(slice.begin(), slice.end());
+
+		const std::string range = std::to_string(decile * tenth) + " - " + std::to_string((decile + 1) * tenth - 1);
+		printf("%-24s %14.1f %14.1f\n", range.c_str(), toNanoseconds(sum) / slice.size() / 1000.0, toNanoseconds(slice[slice.size() / 2]) / 1000.0);
+	}
+	return true;
+}
@@ -0,0 +1,125 @@
+#include "Bench.h"
+
+#include "Clock.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+// Throughput of empty tasks submitted from outside the pool and spawned by tasks on the workers,
+// then the time from submitting a task to it starting on an idle pool. The latency is also taken
+// for a thread started per task.
+
+struct SpawnContext {
+	std::atomic<uint64> numDone;
+	uint32 fanOut;
+};
+
+struct LatencySample {
+	uint64 submitted;
+	uint64 started;
+	std::atomic<bool> done;
+};
+
+static SpawnContext g_spawn;
+
+static void emptyTask(void* parameter) {
+	g_spawn.numDone.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void spawningTask(void* parameter) {
+	for (uint32 i = 0; i < g_spawn.fanOut; i++) {
+		ThreadPool::get()->submit(emptyTask, nullptr);
+	}
+	g_spawn.numDone.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void latencyTask(void* parameter) {
+	LatencySample& sample = *reinterpret_cast<LatencySample*>(parameter);
+	sample.started = getMonotonicTime();
+	sample.done = true;
+}
+
+static void waitForTasks(uint64 count) {
+	while (g_spawn.numDone < count) {
+		std::this_thread::yield();
+	}
+}
+
+static void printLatency(const char* name, std::vector<uint64>& latencies) {
+	std::sort(latencies.begin(), latencies.end());
+	const uint64 median = latencies[latencies.size() / 2];
+	const uint64 p99 = latencies[latencies.size() * 99 / 100];
+	printf("%-28s %12.1f %12.1f\n", name, toNanoseconds(median) / 1000.0, toNanoseconds(p99) / 1000.0);
+}
+
+bool runSchedulerBench(const BenchOptions& options) {
+	const uint32 numTasks = options.getUInt("tasks", 1000000);
+	const uint32 fanOut = std::max(options.getUInt("fan-out", 100), 1u);
+	const uint32 numSamples = std::max(options.getUInt("samples", 10000), 1u);
+	ThreadPool& pool = *ThreadPool::get();
+
+	printf("%u workers\n", pool.getNumWorkers());
+
+	g_spawn.numDone = 0;
+	uint64 start = getMonotonicTime();
+	for (uint32 i = 0; i < numTasks; i++) {
+		pool.submit(emptyTask, nullptr);
+	}
+	waitForTasks(numTasks);
+	const uint64 external = getMonotonicTime() - start;
+
+	// Each root spawns its children from a worker, so they land on that worker's own deque
+	const uint32 numRoots = std::max(numTasks / (fanOut + 1), 1u);
+	const uint64 numSpawned = static_cast<uint64>(numRoots) * (fanOut + 1);
+	g_spawn.numDone = 0;
+	g_spawn.fanOut = fanOut;
+	start = getMonotonicTime();
+	for (uint32 i = 0; i < numRoots; i++) {
+		pool.submit(spawningTask, nullptr);
+	}
+	waitForTasks(numSpawned);
+	const uint64 nested = getMonotonicTime() - start;
+
+	const ThreadPoolStatistics statistics = pool.getStatistics();
+	printf("%-28s %12s %12s\n", "throughput", "tasks", "ns/task");
+	printf("%-28s %12u %12.1f\n", "submitted from outside", numTasks, toNanoseconds(external) / numTasks);
+	printf("%-28s %12llu %12.1f\n", "spawned by tasks", static_cast<unsigned long long>(numSpawned), toNanoseconds(nested) / numSpawned);
+	printf("%llu stolen, %llu sleeps so far\n\n", static_cast<unsigned long long>(statistics.stolen), static_cast<unsigned long long>(statistics.sleeps));
+
+	// One at a time with a pause in between, so every task finds the workers asleep
+	std::vector<uint64> latencies;
+	latencies.reserve(numSamples);
+	for (uint32 i = 0; i < numSamples; i++) {
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+
+		LatencySample sample;
+		sample.done = false;
+		sample.submitted = getMonotonicTime();
+		pool.submit(latencyTask, &sample);
+		while (!sample.done) {
+			std::this_thread::yield();
+		}
+		latencies.push_back(sample.started - sample.submitted);
+	}
+
+	printf("%-28s %12s %12s\n", "spawn latency", "median us", "p99 us");
+	printLatency("pool, idle workers", latencies);
+
+	latencies.clear();
+	const uint32 numThreads = std::min(numSamples, 1000u);
+	for (uint32 i = 0; i < numThreads; i++) {
+		LatencySample sample;
+		sample.done = false;
+		sample.submitted = getMonotonicTime();
+		std::thread thread(latencyTask, &sample);
+		thread.join();
+		latencies.push_back(sample.started - sample.submitted);
+	}
+	printLatency("thread per task", latencies);
+	return true;
+}
@@ -0,0 +1,90 @@
+#include "Bench.h"
+
+#include "Server.h"
+#include "Snapshot.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+// Starts a server on a connections.dat in the old text format, which it converts to a binary
+// snapshot when it shuts down, then starts another one on the snapshot. The time taken is
+// constructing the server and loading its files, before any thread starts.
+
+static constexpr char SNAPSHOT_PATH[] = "connections.dat";
+static constexpr uint64 ELAPSED_TIME = 600000000;	// One minute into each auction
+
+static uint64 getFileSize(const char* path) {
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	return file ? static_cast<uint64>(file.tellg()) : 0;
+}
+
+// Same layout Server::loadTextSnapshot reads
+static void writeTextSnapshot(uint32 numClients, uint32 numItems) {
+	std::ofstream output(SNAPSHOT_PATH);
+
+	output << numClients << '\n';
+	for (uint32 i = 0; i < numClients; i++) {
+		output << getClientAddress(i).getSocketAddressAsString() << '\n';
+		output << 5000 << '\n';
+		output << "client" << i << '\n';
+	}
+
+	output << numItems << '\n';
+	for (uint32 i = 0; i < numItems; i++) {
+		output << i + 1 << '\n';
+		output << "Item number " << i + 1 << '\n';
+		output << 10.0f << '\n';
+		output << ((i % 2 == 0) ? 10.0f : 25.5f) << '\n';
+		output << getClientAddress(i % numClients).getSocketAddressAsString() << '\n';
+		// Every other item has a bid
+		output << ((i % 2 == 0) ? std::string() : getClientAddress((i + 1) % numClients).getSocketAddressAsString()) << '\n';
+		output << ELAPSED_TIME << '\n';
+	}
+}
+
+bool runSnapshotBench(const BenchOptions& options) {
+	const uint32 numClients = std::max(options.getUInt("clients", 1000000), 2u);
+	const uint32 numItems = options.getUInt("items", 10000);
+	const uint32 numRuns = std::max(options.getUInt("runs", 3), 1u);
+
+	ServerOptions serverOptions;
+	serverOptions.journalSync = JournalSyncPolicy::NONE;
+
+	printf("%u clients and %u items\n", numClients, numItems);
+	printf("%-6s %14s %14s %14s %14s\n", "run", "text ms", "text bytes", "snapshot ms", "snapshot bytes");
+	for (uint32 run = 0; run < numRuns; run++) {
+		BenchServer::removeFiles();
+		writeTextSnapshot(numClients, numItems);
+		const uint64 textSize = getFileSize(SNAPSHOT_PATH);
+
+		uint64 textTime = 0;
+		{
+			// Saves a binary snapshot in place of the text once it shuts down
+			BenchServer server(serverOptions, true);
+			textTime = server.getLoadTime();
+		}
+
+		Snapshot snapshot;
+		const SnapshotStatus status = snapshot.open(SNAPSHOT_PATH);
+		const bool converted = (status == SnapshotStatus::LOADED && snapshot.getNumConnections() == numClients && snapshot.getNumItems() == numItems);
+		snapshot.close();
+		if (!converted) {
+			printf("The text snapshot wasn't converted with everything in it\n");
+			BenchServer::removeFiles();
+			return false;
+		}
+		const uint64 binarySize = getFileSize(SNAPSHOT_PATH);
+
+		uint64 binaryTime = 0;
+		{
+			BenchServer server(serverOptions, true);
+			binaryTime = server.getLoadTime();
+		}
+		BenchServer::removeFiles();
+
+		printf("%-6u %14.1f %14llu %14.1f %14llu\n", run + 1, toMilliseconds(textTime), static_cast<unsigned long long>(textSize), toMilliseconds(binaryTime), static_cast<unsigned long long>(binarySize));
+	}
+	return true;
+}
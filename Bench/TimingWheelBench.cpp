@@ -0,0 +1,75 @@
+#include "Bench.h"
+
+#include "Clock.h"
+#include "TimingWheel.h"
+
+#include <cstdio>
+#include <map>
+#include <random>
+#include <vector>
+
+// Auction deadlines spread over five minutes of 10 ms ticks, as the auction shards schedule them.
+// The same deadlines also go through a multimap, the sorted queue ThreadPool::submitTimer keeps.
+
+static constexpr uint64 TICKS_PER_RUN = 30000;
+
+bool runTimingWheelBench(const BenchOptions& options) {
+	const uint32 numTimers = options.getUInt("timers", 1000000);
+
+	std::mt19937 random(options.getUInt("seed", 1));
+	std::uniform_int_distribution<uint64> distribution(1, TICKS_PER_RUN);
+	std::vector<uint64> deadlines(numTimers);
+	for (uint64& deadline : deadlines) {
+		deadline = distribution(random);
+	}
+
+	std::vector<WheelTimer> timers(numTimers);
+	TimingWheel wheel;
+
+	uint64 start = getMonotonicTime();
+	for (uint32 i = 0; i < numTimers; i++) {
+		timers[i].context = &deadlines[i];
+		wheel.schedule(timers[i], deadlines[i]);
+	}
+	const uint64 wheelSchedule = getMonotonicTime() - start;
+
+	std::vector<WheelTimer*> expired;
+	expired.reserve(numTimers);
+	uint32 numFired = 0;
+	uint32 numLate = 0;
+
+	start = getMonotonicTime();
+	for (uint64 tick = 1; tick <= TICKS_PER_RUN; tick++) {
+		expired.clear();
+		wheel.advance(tick, expired);
+		for (WheelTimer* timer : expired) {
+			if (*reinterpret_cast<uint64*>(timer->context) != tick) {
+				numLate++;
+			}
+		}
+		numFired += static_cast<uint32>(expired.size());
+	}
+	const uint64 wheelFire = getMonotonicTime() - start;
+
+	std::multimap<uint64, void*> queue;
+
+	start = getMonotonicTime();
+	for (uint32 i = 0; i < numTimers; i++) {
+		queue.insert(std::make_pair(deadlines[i], &deadlines[i]));
+	}
+	const uint64 queueSchedule = getMonotonicTime() - start;
+
+	start = getMonotonicTime();
+	for (uint64 tick = 1; tick <= TICKS_PER_RUN; tick++) {
+		while (!queue.empty() && queue.begin()->first <= tick) {
+			queue.erase(queue.begin());
+		}
+	}
+	const uint64 queueFire = getMonotonicTime() - start;
+
+	printf("%u deadlines over %llu ticks, %u fired, %u not on their tick\n", numTimers, static_cast<unsigned long long>(TICKS_PER_RUN), numFired, numLate);
+	printf("%-10s %16s %16s\n", "", "ns/schedule", "ns/fire");
+	printf("%-10s %16.1f %16.1f\n", "wheel", toNanoseconds(wheelSchedule) / numTimers, toNanoseconds(wheelFire) / numTimers);
+	printf("%-10s %16.1f %16.1f\n", "multimap", toNanoseconds(queueSchedule) / numTimers, toNanoseconds(queueFire) / numTimers);
+	return numFired == numTimers && numLate == 0;
+}
@@ -0,0 +1,117 @@
+#include "Bench.h"
+
+#include "Clock.h"
+#include "Messages.h"
+#include "Server.h"
+#include "UDPSocket.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Every client fires its REGISTERs back to back at the server without waiting for replies. Each
+// REGISTER is answered, so whatever isn't answered was dropped before the server got to it.
+
+static constexpr uint32 CLIENT_SOCKET_BUFFER = 1024 * 1024;
+static constexpr uint64 IDLE_TIME = 5000000;	// Half a second without replies ends a run
+
+struct BurstResult {
+	uint32 sent;
+	uint32 answered;
+	uint64 time;	// From the first send to the last reply
+};
+
+static BurstResult runBurst(const ServerOptions& options, uint32 numClients, uint32 perClient) {
+	BurstResult result = {};
+
+	BenchServer server(options);
+	const IPV4Address serverAddress = BenchServer::getAddress();
+
+	std::vector<std::unique_ptr<UDPSocket>> clients;
+	for (uint32 i = 0; i < numClients; i++) {
+		clients.emplace_back(new UDPSocket());
+		clients.back()->bind(getClientAddress(i));
+		clients.back()->setReceiveBufferSize(CLIENT_SOCKET_BUFFER);
+	}
+
+	const uint64 start = getMonotonicTime();
+	for (uint32 round = 0; round < perClient; round++) {
+		for (uint32 i = 0; i < numClients; i++) {
+			RegisterMessage msg;
+			msg.reqNum = round;
+			snprintf(msg.name, NAMELENGTH, "burst%u", i);
+			snprintf(msg.iPAddress, IPLENGTH, "127.0.0.1");
+			snprintf(msg.port, PORTLENGTH, "0");
+
+			Packet packet = serializeMessage(msg);
+			packet.setAddress(serverAddress);
+			clients[i]->send(packet);
+			result.sent++;
+		}
+	}
+
+	uint64 lastReply = getMonotonicTime();
+	while (getMonotonicTime() - lastReply < IDLE_TIME) {
+		bool any = false;
+		for (std::unique_ptr<UDPSocket>& client : clients) {
+			while (client->canReceive()) {
+				const Packet reply = client->receive();
+				const MessageType type = static_cast<MessageType>(reply.getMessageData()[0]);
+				if (type == MessageType::MSG_REGISTERED || type == MessageType::MSG_UNREGISTERED) {
+					result.answered++;
+				}
+				lastReply = getMonotonicTime();
+				any = true;
+			}
+		}
+		if (!any) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+	result.time = lastReply - start;
+
+	for (std::unique_ptr<UDPSocket>& client : clients) {
+		client->close();
+	}
+	return result;
+}
+
+bool runUDPBurstBench(const BenchOptions& options) {
+	const uint32 numClients = options.getUInt("clients", 200);
+	const uint32 perClient = options.getUInt("per-client", 5);
+
+	// Replies don't wait for the journal, only the receive path is measured
+	ServerOptions defaults;
+	defaults.journalSync = JournalSyncPolicy::NONE;
+	defaults.registeredConfirm = ConfirmPolicy::IMMEDIATE;
+
+	// What the server had before: one posted receive and one worker
+	ServerOptions single = defaults;
+	single.udpReceiveBuffers = 1;
+	single.udpServiceThreads = 1;
+
+	// The same with the smallest socket buffer the OS allows
+	ServerOptions minimal = single;
+	minimal.udpSocketBufferSize = 0;
+
+	const struct {
+		const char* name;
+		const ServerOptions* options;
+	} configs[] = {
+		{ "1 receive, 1 worker, minimal socket buffer", &minimal },
+		{ "1 receive, 1 worker", &single },
+		{ "defaults", &defaults },
+	};
+
+	printf("%u clients sending %u REGISTERs each\n", numClients, perClient);
+	printf("%-44s %8s %8s %8s %10s\n", "server", "sent", "answered", "lost", "ms");
+	for (const auto& config : configs) {
+		const BurstResult result = runBurst(*config.options, numClients, perClient);
+		printf("%-44s %8u %8u %8u %10.1f\n", config.name, result.sent, result.answered, result.sent - result.answered, toMilliseconds(result.time));
+	}
+	return true;
+}
@@ -73,6 +73,10 @@ void Client::printMainMenu()
 		_state = ClientState::DISPLAYING_AH; break;
 	case 7:
 		_state = ClientState::DISCONNECTING; break;
+	case 8:
+		_state = ClientState::WATCHING; break;
+	case 9:
+		_state = ClientState::UNWATCHING; break;
 	default:
 		_state = ClientState::MAIN_MENU;
 	}
@@ -98,6 +102,10 @@ void Client::interpretState()
 		printAH(); break;
 	case ClientState::DISCONNECTING:
 		disconnect(); break;
+	case ClientState::WATCHING:
+		sendWatch(true); break;
+	case ClientState::UNWATCHING:
+		sendWatch(false); break;
 	case ClientState::MAIN_MENU:
 		printMainMenu(); break;
 	default:;
@@ -628,6 +636,46 @@ void Client::sendBid() {
 	_state = ClientState::MAIN_MENU;
 }
 
+void Client::sendWatch(bool watching) {
+	// Items we bid on or sell are watched already
+	if (_registered)
+	{
+		uint32 itemNum;
+		std::cout << "Enter the item number: " << std::endl;
+		std::cin >> itemNum;
+
+		Packet packet;
+		MessageType type;
+		if (watching) {
+			WatchMessage watchMsg;
+			watchMsg.reqNum = s_reqNum++;
+			watchMsg.itemNum = itemNum;
+			packet = serializeMessage(watchMsg);
+			type = watchMsg.type;
+		}
+		else {
+			UnwatchMessage unwatchMsg;
+			unwatchMsg.reqNum = s_reqNum++;
+			unwatchMsg.itemNum = itemNum;
+			packet = serializeMessage(unwatchMsg);
+			type = unwatchMsg.type;
+		}
+		packet.setAddress(_serverIpv4);
+
+		_tcpSocket->send(packet);
+
+		log(LogType::LOG_SEND, type, _serverIpv4);
+	}
+	else
+	{
+		// Not registered
+		log(s_notReg);
+	}
+
+	// Go back to main menu
+	_state = ClientState::MAIN_MENU;
+}
+
 void Client::printAH() {
 	log("The Auction House:");
 	log("Description\tItem Number\tAmount");
@@ -25,7 +25,9 @@ private:
 		DISPLAYING_OFFERS,
 		DISPLAYING_WON_ITEMS,
 		DISPLAYING_AH,
-		DISCONNECTING
+		DISCONNECTING,
+		WATCHING,
+		UNWATCHING
 	};
 
 	struct Item {
@@ -41,6 +43,7 @@ private:
 	void sendDeregister();
 	void sendOffer();
 	void sendBid();
+	void sendWatch(bool watching);
 
 	void disconnect();
 
@@ -0,0 +1,28 @@
+#include "Checksum.h"
+
+struct CRCTable {
+	uint32 entries[256];
+
+	CRCTable() {
+		for (uint32 i = 0; i < 256; i++) {
+			uint32 value = i;
+			for (uint32 bit = 0; bit < 8; bit++) {
+				value = (value & 1) ? (value >> 1) ^ 0xEDB88320u : (value >> 1);
+			}
+			entries[i] = value;
+		}
+	}
+};
+
+// Filled in before main runs
+static const CRCTable s_table;
+
+uint32 crc32(const void* data, uint64 size, uint32 crc) {
+	const uint8* bytes = reinterpret_cast<const uint8*>(data);
+
+	crc = ~crc;
+	for (uint64 i = 0; i < size; i++) {
+		crc = s_table.entries[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
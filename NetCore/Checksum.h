@@ -0,0 +1,6 @@
+#pragma once
+
+#include "Types.h"
+
+// CRC-32 (IEEE, as used by zlib). Pass the previous result as crc to continue a running checksum.
+uint32 crc32(const void* data, uint64 size, uint32 crc = 0);
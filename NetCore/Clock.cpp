@@ -0,0 +1,27 @@
+#include "Clock.h"
+
+#include "Platform.h"
+
+#include <chrono>
+
+#ifndef _WIN32
+#include <ctime>
+#endif
+
+uint64 getSystemTime() {
+#ifdef _WIN32
+	FILETIME fileTime;
+	GetSystemTimeAsFileTime(&fileTime);
+	ULARGE_INTEGER* time = reinterpret_cast<ULARGE_INTEGER*>(&fileTime);
+	return time->QuadPart;
+#else
+	timespec time;
+	clock_gettime(CLOCK_REALTIME, &time);
+	return static_cast<uint64>(time.tv_sec) * 10000000ull + static_cast<uint64>(time.tv_nsec) / 100ull;
+#endif
+}
+
+uint64 getMonotonicTime() {
+	typedef std::chrono::duration<uint64, std::ratio<1, 10000000>> Ticks;
+	return std::chrono::duration_cast<Ticks>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
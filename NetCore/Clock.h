@@ -0,0 +1,9 @@
+#pragma once
+
+#include "Types.h"
+
+// Wall clock time in 100 nanosecond ticks, the resolution auction times are stored in.
+uint64 getSystemTime();
+
+// Monotonic time in the same 100 nanosecond ticks. Unaffected by clock steps, only meaningful relative to itself.
+uint64 getMonotonicTime();
@@ -0,0 +1,40 @@
+#include "CompletionPort.h"
+
+#ifdef _WIN32
+#include "IOCPCompletionPort.h"
+#else
+#include "EpollCompletionPort.h"
+#include "URingCompletionPort.h"
+#include "Log.h"
+#endif
+
+#include <stdexcept>
+
+constexpr uint32 CompletionPort::INFINITE_WAIT;
+
+CompletionPort* CompletionPort::create(IOEngine engine) {
+#ifdef _WIN32
+	if (engine == IOEngine::IO_URING) {
+		log("[INFO] io_uring is not available on this platform, using IOCP");
+	}
+	return new IOCPCompletionPort();
+#else
+	if (engine == IOEngine::IO_URING) {
+		try {
+			return new URingCompletionPort();
+		}
+		catch (const std::runtime_error& e) {
+			log("[INFO] %s, using epoll", e.what());
+		}
+	}
+	return new EpollCompletionPort();
+#endif
+}
+
+CompletionPortStatistics CompletionPort::getStatistics() const {
+	CompletionPortStatistics statistics;
+	statistics.syscalls = m_numSyscalls;
+	statistics.completions = m_numCompletions;
+	statistics.sends = m_numSends;
+	return statistics;
+}
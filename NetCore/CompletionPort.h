@@ -0,0 +1,89 @@
+#pragma once
+
+#include "Types.h"
+
+#include <atomic>
+
+class Socket;
+class OverlappedBuffer;
+class Packet;
+
+enum class IOEngine : uint8 {
+	DEFAULT,	// IOCP on Windows, epoll on Linux
+	IO_URING
+};
+
+enum class CompletionStatus : uint8 {
+	SUCCESS,
+	ABORTED,		// The socket was closed locally while the operation was pending
+	DISCONNECTED,	// The peer reset the connection
+	FAILED
+};
+
+struct Completion {
+	uintptr key;
+	OverlappedBuffer* buffer;
+	uint32 numBytes;
+	CompletionStatus status;
+	int32 error;
+};
+
+struct SendQueueDepth {
+	uint32 messages;
+	uint32 bytes;
+};
+
+// Picks queued sends to drop
+typedef bool (*SendFilter)(const Packet& packet, void* context);
+
+struct CompletionPortStatistics {
+	uint64 syscalls;	// Kernel crossings made by the port itself
+	uint64 completions;
+	uint64 sends;		// Sends handed to the port instead of being made on the caller's thread
+};
+
+// Queue of finished socket operations. Sockets are associated with a port under a key, operations
+// are issued through the socket classes and their results are picked up by whichever thread waits
+// on the port. On Windows this is an I/O completion port, on Linux an edge triggered epoll set
+// that performs the operations itself once the socket becomes ready, or an io_uring instance.
+class CompletionPort {
+protected:
+	std::atomic<uint64> m_numSyscalls;
+	std::atomic<uint64> m_numCompletions;
+	std::atomic<uint64> m_numSends;
+public:
+	static constexpr uint32 INFINITE_WAIT = 0xFFFFFFFF;
+
+	CompletionPort() : m_numSyscalls(0), m_numCompletions(0), m_numSends(0) {}
+	virtual ~CompletionPort() {}
+
+	virtual void associate(Socket& socket, uintptr key) = 0;
+	virtual void dissociate(Socket& socket) = 0;
+
+	virtual void receiveFrom(Socket& socket, OverlappedBuffer& buffer) = 0;
+	virtual void receive(Socket& socket, OverlappedBuffer& buffer) = 0;
+	virtual void accept(Socket& listener, OverlappedBuffer& buffer) = 0;
+
+	// Engines that can send asynchronously hold on to the packet and return true, stream sockets
+	// send it with its frame header. The default leaves the send to the socket.
+	virtual bool send(Socket& socket, const Packet& packet) { return false; }
+	virtual bool send(Socket& socket, const Packet* packets, uint32 count) { return false; }
+
+	// Stream sends the port is holding for the socket, including the ones being written
+	virtual SendQueueDepth getSendQueueDepth(Socket& socket) { return SendQueueDepth{ 0, 0 }; }
+	// Drops up to maxCount queued sends the filter picks, oldest first. Sends already being
+	// written can't be taken back. Returns how many were dropped.
+	virtual uint32 dropQueuedSends(Socket& socket, SendFilter filter, void* context, uint32 maxCount) { return 0; }
+
+	// Blocks until an operation completes or something is posted. Returns false if the wait
+	// timed out or the port was closed.
+	virtual bool wait(Completion& completion, uint32 timeoutMs = INFINITE_WAIT) = 0;
+
+	// Wakes up one waiter with an empty completion for the given key
+	virtual void post(uintptr key) = 0;
+
+	CompletionPortStatistics getStatistics() const;
+
+	// Falls back to the default engine if the requested one is not available
+	static CompletionPort* create(IOEngine engine = IOEngine::DEFAULT);
+};
@@ -0,0 +1,549 @@
+#include "EpollCompletionPort.h"
+
+#ifdef __linux__
+
+#include "Socket.h"
+#include "OverlappedBuffer.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <chrono>
+#include <stdexcept>
+
+constexpr uint32 EpollCompletionPort::RECEIVE_BATCH_SIZE;
+constexpr uint32 EpollCompletionPort::MAX_COALESCED_SENDS;
+
+// Port the current thread is waiting on, its sends are written just before it waits again
+static thread_local EpollCompletionPort* g_servingPort = nullptr;
+
+EpollCompletionPort::EpollCompletionPort() : m_sleepers(0) {
+	m_epoll = epoll_create1(EPOLL_CLOEXEC);
+	if (m_epoll == -1) {
+		throw std::runtime_error("Failed to create epoll instance");
+	}
+
+	m_wakeEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (m_wakeEvent == -1) {
+		::close(m_epoll);
+		throw std::runtime_error("Failed to create wake event");
+	}
+
+	// Level triggered so every sleeping waiter notices until someone consumes it
+	epoll_event event;
+	event.events = EPOLLIN;
+	event.data.fd = m_wakeEvent;
+	epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeEvent, &event);
+}
+
+EpollCompletionPort::~EpollCompletionPort() {
+	::close(m_wakeEvent);
+	::close(m_epoll);
+}
+
+void EpollCompletionPort::associate(Socket& socket, uintptr key) {
+	std::shared_ptr<Registration> registration = std::make_shared<Registration>();
+	registration->socket = socket._winSocket;
+	registration->key = key;
+	registration->nonBlocking = false;
+	registration->closed = false;
+	registration->queuedBytes = 0;
+	registration->sendOffset = 0;
+	registration->flushScheduled = false;
+
+	int32 type = 0;
+	socklen_t typeSize = sizeof(type);
+	getsockopt(socket._winSocket, SOL_SOCKET, SO_TYPE, &type, &typeSize);
+	registration->datagram = (type == SOCK_DGRAM);
+
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_registrations[socket._winSocket] = registration;
+	}
+
+	epoll_event event;
+	// Writability edges resume sends that filled the socket buffer
+	event.events = EPOLLIN | EPOLLRDHUP | EPOLLET | (registration->datagram ? 0 : EPOLLOUT);
+	event.data.fd = socket._winSocket;
+	m_numSyscalls++;
+	if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, socket._winSocket, &event) == -1) {
+		int32 error = errno;
+
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_registrations.erase(socket._winSocket);
+		throw error;
+	}
+
+	socket._completionPort = this;
+	socket._completionKey = key;
+}
+
+void EpollCompletionPort::dissociate(Socket& socket) {
+	m_numSyscalls++;
+	epoll_ctl(m_epoll, EPOLL_CTL_DEL, socket._winSocket, nullptr);
+
+	std::shared_ptr<Registration> registration;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		auto iter = m_registrations.find(socket._winSocket);
+		if (iter == m_registrations.end()) {
+			return;
+		}
+		registration = iter->second;
+		m_registrations.erase(iter);
+	}
+
+	// Like closing a socket under IOCP, anything still pending completes as aborted
+	std::lock_guard<std::mutex> lock(registration->lock);
+	registration->closed = true;
+	registration->queuedSends.clear();
+	registration->queuedBytes = 0;
+	registration->sendOffset = 0;
+	for (const PendingOperation& operation : registration->pending) {
+		Completion completion;
+		completion.key = registration->key;
+		completion.buffer = operation.buffer;
+		completion.numBytes = 0;
+		completion.status = CompletionStatus::ABORTED;
+		completion.error = ECANCELED;
+		queueCompletion(completion);
+	}
+	registration->pending.clear();
+}
+
+void EpollCompletionPort::receiveFrom(Socket& socket, OverlappedBuffer& buffer) {
+	issue(socket, OperationType::RECEIVE_FROM, buffer);
+}
+
+void EpollCompletionPort::receive(Socket& socket, OverlappedBuffer& buffer) {
+	issue(socket, OperationType::RECEIVE, buffer);
+}
+
+void EpollCompletionPort::accept(Socket& listener, OverlappedBuffer& buffer) {
+	issue(listener, OperationType::ACCEPT, buffer);
+}
+
+bool EpollCompletionPort::send(Socket& socket, const Packet& packet) {
+	return send(socket, &packet, 1);
+}
+
+bool EpollCompletionPort::send(Socket& socket, const Packet* packets, uint32 count) {
+	std::shared_ptr<Registration> registration = findRegistration(socket._winSocket);
+	if (registration == nullptr || registration->datagram) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(registration->lock);
+	if (registration->closed) {
+		return true;
+	}
+
+	const bool idle = registration->queuedSends.empty();
+	for (uint32 i = 0; i < count; i++) {
+		registration->queuedSends.push_back(packets[i]);
+		registration->queuedBytes += packets[i].getFrameSize();
+	}
+	m_numSends += count;
+
+	if (!idle || registration->flushScheduled) {
+		// Already waiting for the socket buffer to drain or for the serving thread to flush
+		return true;
+	}
+
+	if (g_servingPort == this) {
+		// Anything else sent before this thread waits again joins the same write
+		registration->flushScheduled = true;
+		std::lock_guard<std::mutex> portLock(m_lock);
+		m_flushes.push_back(registration->socket);
+	}
+	else {
+		flushSends(*registration);
+	}
+	return true;
+}
+
+SendQueueDepth EpollCompletionPort::getSendQueueDepth(Socket& socket) {
+	SendQueueDepth depth = { 0, 0 };
+
+	std::shared_ptr<Registration> registration = findRegistration(socket._winSocket);
+	if (registration != nullptr) {
+		std::lock_guard<std::mutex> lock(registration->lock);
+		depth.messages = static_cast<uint32>(registration->queuedSends.size());
+		depth.bytes = registration->queuedBytes - registration->sendOffset;
+	}
+	return depth;
+}
+
+uint32 EpollCompletionPort::dropQueuedSends(Socket& socket, SendFilter filter, void* context, uint32 maxCount) {
+	std::shared_ptr<Registration> registration = findRegistration(socket._winSocket);
+	if (registration == nullptr) {
+		return 0;
+	}
+
+	std::lock_guard<std::mutex> lock(registration->lock);
+
+	// A partly written frame has to be finished
+	std::deque<Packet>& queue = registration->queuedSends;
+	auto iter = queue.begin();
+	if (iter != queue.end() && registration->sendOffset > 0) {
+		++iter;
+	}
+
+	uint32 dropped = 0;
+	while (iter != queue.end() && dropped < maxCount) {
+		if (filter(*iter, context)) {
+			registration->queuedBytes -= iter->getFrameSize();
+			iter = queue.erase(iter);
+			dropped++;
+		}
+		else {
+			++iter;
+		}
+	}
+	return dropped;
+}
+
+std::shared_ptr<EpollCompletionPort::Registration> EpollCompletionPort::findRegistration(SOCKET socket) {
+	std::lock_guard<std::mutex> lock(m_lock);
+	auto iter = m_registrations.find(socket);
+	if (iter == m_registrations.end()) {
+		return nullptr;
+	}
+	return iter->second;
+}
+
+void EpollCompletionPort::issue(Socket& socket, OperationType type, OverlappedBuffer& buffer) {
+	std::shared_ptr<Registration> registration = findRegistration(socket._winSocket);
+	if (registration == nullptr) {
+		throw std::runtime_error("Socket is not associated with this completion port");
+	}
+
+	std::lock_guard<std::mutex> lock(registration->lock);
+
+	if (type == OperationType::ACCEPT && !registration->nonBlocking) {
+		// There is no per call flag for accept, so the listener itself has to be non-blocking
+		int32 flags = fcntl(registration->socket, F_GETFL, 0);
+		fcntl(registration->socket, F_SETFL, flags | O_NONBLOCK);
+		registration->nonBlocking = true;
+		m_numSyscalls += 2;
+	}
+
+	// Queue first, then try. An edge that fires in between is handled by whoever gets the lock
+	// next, so readiness is never lost.
+	PendingOperation operation;
+	operation.type = type;
+	operation.buffer = &buffer;
+	registration->pending.push_back(operation);
+
+	drain(*registration);
+}
+
+void EpollCompletionPort::drain(Registration& registration) {
+	if (!registration.queuedSends.empty() && !registration.flushScheduled) {
+		flushSends(registration);
+	}
+
+	while (!registration.pending.empty()) {
+		if (registration.pending.front().type == OperationType::RECEIVE_FROM) {
+			if (!performReceiveFrom(registration)) {
+				break;
+			}
+			continue;
+		}
+
+		Completion completion;
+		if (!perform(registration, registration.pending.front(), completion)) {
+			// Would block, wait for the next edge
+			break;
+		}
+		registration.pending.pop_front();
+		queueCompletion(completion);
+	}
+}
+
+bool EpollCompletionPort::perform(Registration& registration, const PendingOperation& operation, Completion& completion) {
+	OverlappedBuffer& buffer = *operation.buffer;
+
+	completion.key = registration.key;
+	completion.buffer = &buffer;
+	completion.numBytes = 0;
+	completion.status = CompletionStatus::SUCCESS;
+	completion.error = 0;
+
+	for (;;) {
+		m_numSyscalls++;
+
+		ssize_t result = 0;
+		switch (operation.type) {
+		case OperationType::RECEIVE_FROM:
+			buffer.m_senderAddressSize = sizeof(buffer.m_senderAddress);
+			result = recvfrom(registration.socket, buffer.m_buffer, OVERLAPPED_BUFFER_SIZE, MSG_DONTWAIT, reinterpret_cast<sockaddr*>(&buffer.m_senderAddress), &buffer.m_senderAddressSize);
+			break;
+		case OperationType::RECEIVE:
+			result = recv(registration.socket, buffer.m_buffer, OVERLAPPED_BUFFER_SIZE, MSG_DONTWAIT);
+			break;
+		case OperationType::ACCEPT:
+			result = accept4(registration.socket, nullptr, nullptr, SOCK_CLOEXEC);
+			if (result >= 0) {
+				buffer.m_acceptSocket = static_cast<SOCKET>(result);
+				result = 0;
+			}
+			break;
+		}
+
+		if (result >= 0) {
+			completion.numBytes = static_cast<uint32>(result);
+			return true;
+		}
+
+		int32 error = errno;
+		if (error == EINTR) {
+			continue;
+		}
+		if (error == EAGAIN || error == EWOULDBLOCK) {
+			return false;
+		}
+		if (operation.type == OperationType::ACCEPT && error == ECONNABORTED) {
+			// The client gave up while queued in the backlog, take the next one
+			continue;
+		}
+
+		completion.error = error;
+		if (error == ECONNRESET || error == EPIPE || error == ETIMEDOUT) {
+			completion.status = CompletionStatus::DISCONNECTED;
+		}
+		else {
+			completion.status = CompletionStatus::FAILED;
+		}
+		return true;
+	}
+}
+
+bool EpollCompletionPort::performReceiveFrom(Registration& registration) {
+	// Fills every parked datagram receive at the front of the queue with a single recvmmsg
+	mmsghdr messages[RECEIVE_BATCH_SIZE];
+	iovec vectors[RECEIVE_BATCH_SIZE];
+
+	uint32 batchSize = 0;
+	for (const PendingOperation& operation : registration.pending) {
+		if (operation.type != OperationType::RECEIVE_FROM || batchSize == RECEIVE_BATCH_SIZE) {
+			break;
+		}
+
+		OverlappedBuffer& buffer = *operation.buffer;
+		vectors[batchSize].iov_base = buffer.m_buffer;
+		vectors[batchSize].iov_len = OVERLAPPED_BUFFER_SIZE;
+
+		memset(&messages[batchSize], 0, sizeof(mmsghdr));
+		messages[batchSize].msg_hdr.msg_name = &buffer.m_senderAddress;
+		messages[batchSize].msg_hdr.msg_namelen = sizeof(buffer.m_senderAddress);
+		messages[batchSize].msg_hdr.msg_iov = &vectors[batchSize];
+		messages[batchSize].msg_hdr.msg_iovlen = 1;
+		batchSize++;
+	}
+
+	Completion completion;
+	completion.key = registration.key;
+	completion.numBytes = 0;
+	completion.status = CompletionStatus::SUCCESS;
+	completion.error = 0;
+
+	for (;;) {
+		m_numSyscalls++;
+		int32 result = recvmmsg(registration.socket, messages, batchSize, MSG_DONTWAIT, nullptr);
+		if (result >= 0) {
+			for (int32 i = 0; i < result; i++) {
+				OverlappedBuffer& buffer = *registration.pending.front().buffer;
+				buffer.m_senderAddressSize = messages[i].msg_hdr.msg_namelen;
+
+				completion.buffer = &buffer;
+				completion.numBytes = messages[i].msg_len;
+				registration.pending.pop_front();
+				queueCompletion(completion);
+			}
+			return true;
+		}
+
+		int32 error = errno;
+		if (error == EINTR) {
+			continue;
+		}
+		if (error == EAGAIN || error == EWOULDBLOCK) {
+			return false;
+		}
+
+		// Datagram sockets report errors for earlier sends here, fail a single receive with it
+		completion.buffer = registration.pending.front().buffer;
+		completion.status = (error == ECONNRESET) ? CompletionStatus::DISCONNECTED : CompletionStatus::FAILED;
+		completion.error = error;
+		registration.pending.pop_front();
+		queueCompletion(completion);
+		return true;
+	}
+}
+
+void EpollCompletionPort::flushSends(Registration& registration) {
+	// Caller holds the registration's lock
+	registration.flushScheduled = false;
+
+	while (!registration.closed && !registration.queuedSends.empty()) {
+		// Stream sends include the frame header the packet keeps in front of the message
+		iovec vectors[MAX_COALESCED_SENDS];
+		uint32 count = 0;
+		for (const Packet& packet : registration.queuedSends) {
+			if (count == MAX_COALESCED_SENDS) {
+				break;
+			}
+			vectors[count].iov_base = const_cast<uint8*>(packet.getFrameData());
+			vectors[count].iov_len = packet.getFrameSize();
+			count++;
+		}
+		vectors[0].iov_base = static_cast<uint8*>(vectors[0].iov_base) + registration.sendOffset;
+		vectors[0].iov_len -= registration.sendOffset;
+
+		msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = vectors;
+		message.msg_iovlen = count;
+
+		m_numSyscalls++;
+		ssize_t result = sendmsg(registration.socket, &message, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (result < 0) {
+			int32 error = errno;
+			if (error == EINTR) {
+				continue;
+			}
+			if (error != EAGAIN && error != EWOULDBLOCK) {
+				// The connection is gone, its pending receive reports it
+				registration.queuedSends.clear();
+				registration.queuedBytes = 0;
+				registration.sendOffset = 0;
+			}
+			// Otherwise the socket buffer is full, the next writability edge resumes
+			return;
+		}
+
+		uint64 sent = static_cast<uint64>(result) + registration.sendOffset;
+		while (!registration.queuedSends.empty() && sent >= registration.queuedSends.front().getFrameSize()) {
+			sent -= registration.queuedSends.front().getFrameSize();
+			registration.queuedBytes -= registration.queuedSends.front().getFrameSize();
+			registration.queuedSends.pop_front();
+		}
+		registration.sendOffset = static_cast<uint32>(sent);
+	}
+}
+
+void EpollCompletionPort::queueCompletion(const Completion& completion) {
+	bool sleeping = false;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_completions.push_back(completion);
+		sleeping = m_sleepers > 0;
+	}
+
+	if (sleeping) {
+		wake();
+	}
+}
+
+void EpollCompletionPort::wake() {
+	m_numSyscalls++;
+	uint64 value = 1;
+	ssize_t result = write(m_wakeEvent, &value, sizeof(value));
+	(void)result;
+}
+
+bool EpollCompletionPort::wait(Completion& completion, uint32 timeoutMs) {
+	typedef std::chrono::steady_clock Clock;
+	const Clock::time_point deadline = Clock::now() + std::chrono::milliseconds((timeoutMs == INFINITE_WAIT) ? 0 : timeoutMs);
+
+	epoll_event events[MAX_EVENTS];
+
+	g_servingPort = this;
+
+	for (;;) {
+		std::vector<SOCKET> flushes;
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			flushes.swap(m_flushes);
+		}
+		for (SOCKET socket : flushes) {
+			std::shared_ptr<Registration> registration = findRegistration(socket);
+			if (registration != nullptr) {
+				std::lock_guard<std::mutex> lock(registration->lock);
+				flushSends(*registration);
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			if (!m_completions.empty()) {
+				completion = m_completions.front();
+				m_completions.pop_front();
+				m_numCompletions++;
+				return true;
+			}
+			m_sleepers++;
+		}
+
+		int32 timeout = -1;
+		if (timeoutMs != INFINITE_WAIT) {
+			int64 remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+			timeout = (remaining > 0) ? static_cast<int32>(remaining) : 0;
+		}
+
+		m_numSyscalls++;
+		int32 count = epoll_wait(m_epoll, events, MAX_EVENTS, timeout);
+
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_sleepers--;
+		}
+
+		if (count == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+
+		for (int32 i = 0; i < count; i++) {
+			if (events[i].data.fd == m_wakeEvent) {
+				m_numSyscalls++;
+				uint64 value = 0;
+				ssize_t result = read(m_wakeEvent, &value, sizeof(value));
+				(void)result;
+				continue;
+			}
+
+			std::shared_ptr<Registration> registration = findRegistration(events[i].data.fd);
+			if (registration != nullptr) {
+				std::lock_guard<std::mutex> lock(registration->lock);
+				drain(*registration);
+			}
+		}
+
+		if (count == 0) {
+			// Timed out, hand back anything that raced in
+			std::lock_guard<std::mutex> lock(m_lock);
+			if (m_completions.empty()) {
+				return false;
+			}
+			completion = m_completions.front();
+			m_completions.pop_front();
+			m_numCompletions++;
+			return true;
+		}
+	}
+}
+
+void EpollCompletionPort::post(uintptr key) {
+	Completion completion;
+	completion.key = key;
+	completion.buffer = nullptr;
+	completion.numBytes = 0;
+	completion.status = CompletionStatus::SUCCESS;
+	completion.error = 0;
+	queueCompletion(completion);
+}
+
+#endif
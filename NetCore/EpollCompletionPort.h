@@ -0,0 +1,95 @@
+#pragma once
+
+#ifdef __linux__
+
+#include "CompletionPort.h"
+#include "Packet.h"
+#include "Platform.h"
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Emulates completion semantics on top of edge triggered epoll. Issued operations are attempted
+// right away and parked on their socket if they would block. Whichever thread is waiting on the
+// port when the socket becomes ready performs them and queues the results. Stream sends are queued
+// on their socket and written with one sendmsg per socket before the serving thread waits again.
+class EpollCompletionPort : public CompletionPort {
+private:
+	enum class OperationType : uint8 {
+		RECEIVE_FROM,
+		RECEIVE,
+		ACCEPT
+	};
+
+	struct PendingOperation {
+		OperationType type;
+		OverlappedBuffer* buffer;
+	};
+
+	struct Registration {
+		SOCKET socket;
+		uintptr key;
+		bool nonBlocking;
+		bool datagram;
+		bool closed;
+
+		std::mutex lock;
+		std::deque<PendingOperation> pending;
+
+		// Stream sends waiting for room in the socket buffer, written out together
+		std::deque<Packet> queuedSends;
+		uint32 queuedBytes;
+		uint32 sendOffset;	// Bytes of the first queued frame already sent
+		bool flushScheduled;
+	};
+
+	static constexpr int32 MAX_EVENTS = 64;
+	// Most parked datagram receives filled by one recvmmsg
+	static constexpr uint32 RECEIVE_BATCH_SIZE = 64;
+	// Most queued stream sends written by one sendmsg
+	static constexpr uint32 MAX_COALESCED_SENDS = 64;
+
+	int32 m_epoll;
+	int32 m_wakeEvent;
+
+	std::mutex m_lock;
+	std::unordered_map<SOCKET, std::shared_ptr<Registration>> m_registrations;
+	std::deque<Completion> m_completions;
+	std::vector<SOCKET> m_flushes;	// Sockets with stream sends to write before the next wait
+	uint32 m_sleepers;
+
+	std::shared_ptr<Registration> findRegistration(SOCKET socket);
+
+	void issue(Socket& socket, OperationType type, OverlappedBuffer& buffer);
+	void drain(Registration& registration);
+	bool perform(Registration& registration, const PendingOperation& operation, Completion& completion);
+	bool performReceiveFrom(Registration& registration);
+	void flushSends(Registration& registration);
+
+	void queueCompletion(const Completion& completion);
+	void wake();
+public:
+	EpollCompletionPort();
+	virtual ~EpollCompletionPort();
+
+	virtual void associate(Socket& socket, uintptr key) override;
+	virtual void dissociate(Socket& socket) override;
+
+	virtual void receiveFrom(Socket& socket, OverlappedBuffer& buffer) override;
+	virtual void receive(Socket& socket, OverlappedBuffer& buffer) override;
+	virtual void accept(Socket& listener, OverlappedBuffer& buffer) override;
+
+	// Stream sockets only, datagrams are left to the socket
+	virtual bool send(Socket& socket, const Packet& packet) override;
+	virtual bool send(Socket& socket, const Packet* packets, uint32 count) override;
+	virtual SendQueueDepth getSendQueueDepth(Socket& socket) override;
+	virtual uint32 dropQueuedSends(Socket& socket, SendFilter filter, void* context, uint32 maxCount) override;
+
+	virtual bool wait(Completion& completion, uint32 timeoutMs = INFINITE_WAIT) override;
+	virtual void post(uintptr key) override;
+};
+
+#endif
@@ -1,11 +1,13 @@
 #include "Error.h"
 
+#include "Platform.h"
+
 #include <unordered_map>
-#include <Winsock2.h>
 
 static std::unordered_map<int32, std::string> g_errorCodeStringMap;
 
 std::string getWindowsErrorString(uint32 error) {
+#ifdef _WIN32
 	LPVOID message = nullptr;
 	FormatMessage(
 		FORMAT_MESSAGE_ALLOCATE_BUFFER |
@@ -21,6 +23,9 @@ std::string getWindowsErrorString(uint32 error) {
 	LocalFree(message);
 
 	return errorString;
+#else
+	return std::string(strerror(static_cast<int32>(error)));
+#endif
 }
 
 std::string getWSAErrorString(int32 error) {
@@ -29,11 +34,16 @@ std::string getWSAErrorString(int32 error) {
 		return (*iter).second;
 	}
 	else {
+#ifdef _WIN32
 		return "Unknown error.";
+#else
+		return std::string(strerror(error));
+#endif
 	}
 }
 
 void initErrorCodeStringMap() {
+#ifdef _WIN32
 	g_errorCodeStringMap[WSANOTINITIALISED] = "WSA not initialized.";
 	g_errorCodeStringMap[WSAENETDOWN] = "Network service provider failed.";
 	g_errorCodeStringMap[WSAEAFNOSUPPORT] = "Unsupported address family.";
@@ -60,4 +70,5 @@ void initErrorCodeStringMap() {
 	g_errorCodeStringMap[WSAECONNRESET] = "Virtual circuit was reset by remote side.";
 	g_errorCodeStringMap[WSAENOTCONN] = "Socket is not connected.";
 	g_errorCodeStringMap[WSAECONNABORTED] = "The virtual circuit was terminated due to a time-out or other failure.";
+#endif
 }
\ No newline at end of file
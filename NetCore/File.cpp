@@ -0,0 +1,134 @@
+#include "File.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+#ifdef _WIN32
+static const HANDLE INVALID_FILE = INVALID_HANDLE_VALUE;
+#else
+static constexpr int INVALID_FILE = -1;
+#endif
+
+File::File() : m_handle(INVALID_FILE) {}
+
+File::~File() {
+	close();
+}
+
+bool File::open(const std::string& path, bool truncate) {
+	close();
+
+#ifdef _WIN32
+	m_handle = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, truncate ? CREATE_ALWAYS : OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (m_handle == INVALID_FILE) {
+		return false;
+	}
+
+	LARGE_INTEGER end = {};
+	return SetFilePointerEx(m_handle, end, nullptr, FILE_END) != 0;
+#else
+	m_handle = ::open(path.c_str(), O_WRONLY | O_CREAT | (truncate ? O_TRUNC : 0) | O_CLOEXEC, 0644);
+	if (m_handle == INVALID_FILE) {
+		return false;
+	}
+	return lseek(m_handle, 0, SEEK_END) >= 0;
+#endif
+}
+
+void File::close() {
+	if (m_handle == INVALID_FILE) {
+		return;
+	}
+
+#ifdef _WIN32
+	CloseHandle(m_handle);
+#else
+	::close(m_handle);
+#endif
+	m_handle = INVALID_FILE;
+}
+
+bool File::isOpen() const {
+	return m_handle != INVALID_FILE;
+}
+
+bool File::write(const void* data, uint64 size) {
+	const uint8* bytes = reinterpret_cast<const uint8*>(data);
+
+	// Either call may write less than asked for
+	while (size > 0) {
+#ifdef _WIN32
+		DWORD written = 0;
+		const DWORD chunk = static_cast<DWORD>(std::min<uint64>(size, 0x40000000ull));
+		if (WriteFile(m_handle, bytes, chunk, &written, nullptr) == 0) {
+			return false;
+		}
+#else
+		const ssize_t written = ::write(m_handle, bytes, static_cast<size_t>(std::min<uint64>(size, 0x40000000ull)));
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+#endif
+		bytes += written;
+		size -= written;
+	}
+	return true;
+}
+
+bool File::setSize(uint64 size) {
+#ifdef _WIN32
+	LARGE_INTEGER position;
+	position.QuadPart = static_cast<LONGLONG>(size);
+	return SetFilePointerEx(m_handle, position, nullptr, FILE_BEGIN) != 0 && SetEndOfFile(m_handle) != 0;
+#else
+	return ftruncate(m_handle, static_cast<off_t>(size)) == 0 && lseek(m_handle, static_cast<off_t>(size), SEEK_SET) >= 0;
+#endif
+}
+
+bool File::sync() {
+#ifdef _WIN32
+	return FlushFileBuffers(m_handle) != 0;
+#else
+	// Only the data and the size, the rest of the metadata doesn't matter for getting it back
+	return fdatasync(m_handle) == 0;
+#endif
+}
+
+bool File::replace(const std::string& source, const std::string& destination) {
+#ifdef _WIN32
+	return MoveFileExA(source.c_str(), destination.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return ::rename(source.c_str(), destination.c_str()) == 0;
+#endif
+}
+
+bool File::read(const std::string& path, std::vector<uint8>& contents) {
+	std::ifstream input(path, std::ios::binary | std::ios::ate);
+	if (!input) {
+		return false;
+	}
+
+	const std::streamoff size = input.tellg();
+	input.seekg(0);
+	contents.resize(static_cast<size_t>(size));
+	if (size > 0) {
+		input.read(reinterpret_cast<char*>(contents.data()), size);
+	}
+	return static_cast<bool>(input);
+}
+
+bool File::writeAtomically(const std::string& path, const void* data, uint64 size) {
+	const std::string temporaryPath = path + ".tmp";
+
+	File file;
+	if (!file.open(temporaryPath, true) || !file.write(data, size) || !file.sync()) {
+		return false;
+	}
+	file.close();
+
+	return replace(temporaryPath, path);
+}
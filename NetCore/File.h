@@ -0,0 +1,41 @@
+#pragma once
+
+#include "Platform.h"
+#include "Types.h"
+
+#include <string>
+#include <vector>
+
+// Write only handle on a file, with the one thing the standard streams can't do: make sure what
+// was written is on disk before carrying on.
+class File {
+private:
+#ifdef _WIN32
+	HANDLE m_handle;
+#else
+	int m_handle;
+#endif
+public:
+	File();
+	File(const File&) = delete;
+	File& operator=(const File&) = delete;
+	virtual ~File();
+
+	// Created if it doesn't exist, writes go to the end
+	bool open(const std::string& path, bool truncate);
+	void close();
+	bool isOpen() const;
+
+	bool write(const void* data, uint64 size);
+	// Cuts the file down or extends it with zeros, writes continue from the new end
+	bool setSize(uint64 size);
+	// Returns once everything written so far survives a crash
+	bool sync();
+
+	// Replaces destination with source in a single step, so a reader sees one or the other
+	static bool replace(const std::string& source, const std::string& destination);
+	// Whole file in one go, false if it couldn't be opened
+	static bool read(const std::string& path, std::vector<uint8>& contents);
+	// Written next to the destination, synced and then swapped in, so a crash leaves the old one
+	static bool writeAtomically(const std::string& path, const void* data, uint64 size);
+};
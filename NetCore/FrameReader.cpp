@@ -0,0 +1,111 @@
+#include "FrameReader.h"
+
+#include "Platform.h"
+
+#include <algorithm>
+#include <cstring>
+
+constexpr uint32 FrameReader::HEADER_SIZE;
+constexpr uint32 FrameReader::MAX_MESSAGE_SIZE;
+
+FrameReader::FrameReader() {
+	reset();
+}
+
+void FrameReader::reset() {
+	m_partialSize = 0;
+	m_data = nullptr;
+	m_size = 0;
+	m_offset = 0;
+	m_corrupt = false;
+}
+
+void FrameReader::feed(const uint8* data, uint32 size) {
+	m_data = data;
+	m_size = size;
+	m_offset = 0;
+}
+
+bool FrameReader::next(const uint8*& message, uint32& size) {
+	if (m_corrupt) {
+		return false;
+	}
+
+	if (m_partialSize > 0) {
+		return completePartial(message, size);
+	}
+
+	const uint32 remaining = m_size - m_offset;
+	if (remaining < HEADER_SIZE) {
+		keepRemainder();
+		return false;
+	}
+
+	const uint32 messageSize = readHeader(m_data + m_offset);
+	if (messageSize == 0 || messageSize > MAX_MESSAGE_SIZE) {
+		m_corrupt = true;
+		return false;
+	}
+	if (remaining < HEADER_SIZE + messageSize) {
+		keepRemainder();
+		return false;
+	}
+
+	// Whole message in the received bytes, no copy needed
+	message = m_data + m_offset + HEADER_SIZE;
+	size = messageSize;
+	m_offset += HEADER_SIZE + messageSize;
+	return true;
+}
+
+bool FrameReader::completePartial(const uint8*& message, uint32& size) {
+	if (m_partialSize < HEADER_SIZE) {
+		const uint32 count = std::min(HEADER_SIZE - m_partialSize, m_size - m_offset);
+		memcpy(m_partial + m_partialSize, m_data + m_offset, count);
+		m_partialSize += count;
+		m_offset += count;
+
+		if (m_partialSize < HEADER_SIZE) {
+			return false;
+		}
+	}
+
+	const uint32 messageSize = readHeader(m_partial);
+	if (messageSize == 0 || messageSize > MAX_MESSAGE_SIZE) {
+		m_corrupt = true;
+		return false;
+	}
+
+	const uint32 count = std::min(HEADER_SIZE + messageSize - m_partialSize, m_size - m_offset);
+	memcpy(m_partial + m_partialSize, m_data + m_offset, count);
+	m_partialSize += count;
+	m_offset += count;
+
+	if (m_partialSize < HEADER_SIZE + messageSize) {
+		return false;
+	}
+
+	// Stays intact until the next call, nothing is copied into the buffer before then
+	message = m_partial + HEADER_SIZE;
+	size = messageSize;
+	m_partialSize = 0;
+	return true;
+}
+
+void FrameReader::keepRemainder() {
+	const uint32 remaining = m_size - m_offset;
+	memcpy(m_partial, m_data + m_offset, remaining);
+	m_partialSize = remaining;
+	m_offset = m_size;
+}
+
+void FrameReader::writeHeader(uint8* header, uint32 messageSize) {
+	const uint32 size = htonl(messageSize);
+	memcpy(header, &size, HEADER_SIZE);
+}
+
+uint32 FrameReader::readHeader(const uint8* header) {
+	uint32 size = 0;
+	memcpy(&size, header, HEADER_SIZE);
+	return ntohl(size);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "Types.h"
+#include "Packet.h"
+
+// Messages on a stream are sent as frames, a 4 byte length in network byte order followed by the
+// message itself. The reader takes whatever a receive produced and hands back every whole
+// message in it. Messages that arrive in one piece are returned where they lie, only a message
+// split across receives is put back together in the reader's own buffer.
+class FrameReader {
+public:
+	static constexpr uint32 HEADER_SIZE = PacketBuffer::HEADER_SIZE;	// Packets keep room for it
+	static constexpr uint32 MAX_MESSAGE_SIZE = Packet::PACKET_SIZE;
+private:
+	uint8 m_partial[HEADER_SIZE + MAX_MESSAGE_SIZE];
+	uint32 m_partialSize;
+
+	const uint8* m_data;
+	uint32 m_size;
+	uint32 m_offset;
+
+	bool m_corrupt;
+
+	bool completePartial(const uint8*& message, uint32& size);
+	void keepRemainder();
+public:
+	FrameReader();
+
+	// Hands over newly received bytes. They have to stay valid until next returns false.
+	void feed(const uint8* data, uint32 size);
+	// Gets the next whole message, valid until the next call. Returns false once the fed bytes
+	// are used up, anything left over is kept for the next feed.
+	bool next(const uint8*& message, uint32& size);
+
+	// Set when a header announces a message that can't be valid, the stream can't be trusted after that
+	bool isCorrupt() const { return m_corrupt; }
+	void reset();
+
+	static void writeHeader(uint8* header, uint32 messageSize);
+	static uint32 readHeader(const uint8* header);
+};
@@ -0,0 +1,373 @@
+#include "IOCPCompletionPort.h"
+
+#ifdef _WIN32
+
+#include "Socket.h"
+#include "OverlappedBuffer.h"
+
+#include <Mswsock.h>
+#include <algorithm>
+#include <stdexcept>
+
+constexpr uint32 IOCPCompletionPort::MAX_COALESCED_SENDS;
+
+IOCPCompletionPort::IOCPCompletionPort() {
+	m_port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
+	if (m_port == NULL) {
+		throw std::runtime_error("Failed to create I/O completion port");
+	}
+}
+
+IOCPCompletionPort::~IOCPCompletionPort() {
+	CloseHandle(m_port);
+}
+
+void IOCPCompletionPort::associate(Socket& socket, uintptr key) {
+	m_numSyscalls++;
+	if (CreateIoCompletionPort(socket.getWinSockHandle(), m_port, key, 0) == NULL) {
+		int32 error = GetLastError();
+		throw error;
+	}
+	std::shared_ptr<Registration> registration = std::make_shared<Registration>();
+	registration->socket = socket._winSocket;
+	registration->closed = false;
+	registration->sending = false;
+	registration->queuedBytes = 0;
+	registration->sendingDepth = SendQueueDepth{ 0, 0 };
+
+	int32 type = 0;
+	int32 typeSize = sizeof(type);
+	getsockopt(socket._winSocket, SOL_SOCKET, SO_TYPE, reinterpret_cast<char*>(&type), &typeSize);
+	registration->datagram = (type == SOCK_DGRAM);
+
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_registrations[socket._winSocket] = registration;
+	}
+
+	socket._completionPort = this;
+	socket._completionKey = key;
+}
+
+void IOCPCompletionPort::dissociate(Socket& socket) {
+	// Closing the socket cancels anything still pending, those completions are queued as aborted
+	std::shared_ptr<Registration> registration;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		auto iter = m_registrations.find(socket._winSocket);
+		if (iter == m_registrations.end()) {
+			return;
+		}
+		registration = iter->second;
+		m_registrations.erase(iter);
+	}
+
+	std::lock_guard<std::mutex> lock(registration->lock);
+	registration->closed = true;
+	registration->queuedSends.clear();
+	registration->queuedBytes = 0;
+}
+
+std::shared_ptr<IOCPCompletionPort::Registration> IOCPCompletionPort::findRegistration(SOCKET socket) {
+	std::lock_guard<std::mutex> lock(m_lock);
+	auto iter = m_registrations.find(socket);
+	if (iter == m_registrations.end()) {
+		return nullptr;
+	}
+	return iter->second;
+}
+
+void IOCPCompletionPort::receiveFrom(Socket& socket, OverlappedBuffer& buffer) {
+	buffer.m_overlapped.owner = &buffer;
+	buffer.m_senderAddressSize = sizeof(buffer.m_senderAddress);
+
+	m_numSyscalls++;
+	int32 status = WSARecvFrom(
+		socket._winSocket,
+		&buffer.m_WSAbuffer,
+		1,
+		NULL,
+		reinterpret_cast<LPDWORD>(&buffer.m_flags),
+		reinterpret_cast<sockaddr*>(&buffer.m_senderAddress),
+		&buffer.m_senderAddressSize,
+		&buffer.m_overlapped,
+		NULL
+	);
+	if (status == SOCKET_ERROR) {
+		int32 error = WSAGetLastError();
+		if (error != WSA_IO_PENDING) {
+			throw error;
+		}
+	}
+}
+
+void IOCPCompletionPort::receive(Socket& socket, OverlappedBuffer& buffer) {
+	buffer.m_overlapped.owner = &buffer;
+
+	m_numSyscalls++;
+	int32 status = WSARecv(
+		socket._winSocket,
+		&buffer.m_WSAbuffer,
+		1,
+		NULL,
+		reinterpret_cast<LPDWORD>(&buffer.m_flags),
+		&buffer.m_overlapped,
+		NULL
+	);
+	if (status == SOCKET_ERROR) {
+		int32 error = WSAGetLastError();
+		if (error != WSA_IO_PENDING) {
+			throw error;
+		}
+	}
+}
+
+void IOCPCompletionPort::accept(Socket& listener, OverlappedBuffer& buffer) {
+	buffer.m_overlapped.owner = &buffer;
+
+	m_numSyscalls += 2;
+	buffer.m_acceptSocket = WSASocketW(AF_INET, SOCK_STREAM, IPPROTO_TCP, nullptr, 0, WSA_FLAG_OVERLAPPED);
+	if (buffer.m_acceptSocket == INVALID_SOCKET) {
+		int32 error = WSAGetLastError();
+		throw error;
+	}
+
+	// The address block AcceptEx writes goes into the buffer's own storage
+	DWORD bytesReceived = 0;
+	bool result = AcceptEx(
+		listener._winSocket,
+		buffer.m_acceptSocket,
+		buffer.m_buffer,
+		0,
+		sizeof(sockaddr_in) + 16,
+		sizeof(sockaddr_in) + 16,
+		&bytesReceived,
+		&buffer.m_overlapped
+	);
+
+	if (!result) {
+		int32 error = WSAGetLastError();
+		if (error != ERROR_IO_PENDING) {
+			closesocket(buffer.m_acceptSocket);
+			buffer.m_acceptSocket = INVALID_SOCKET;
+			throw error;
+		}
+	}
+}
+
+bool IOCPCompletionPort::send(Socket& socket, const Packet& packet) {
+	return send(socket, &packet, 1);
+}
+
+bool IOCPCompletionPort::send(Socket& socket, const Packet* packets, uint32 count) {
+	std::shared_ptr<Registration> registration = findRegistration(socket._winSocket);
+	if (registration == nullptr || registration->datagram) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(registration->lock);
+	if (registration->closed) {
+		return true;
+	}
+
+	for (uint32 i = 0; i < count; i++) {
+		registration->queuedSends.push_back(packets[i]);
+		registration->queuedBytes += packets[i].getFrameSize();
+	}
+	m_numSends += count;
+
+	flushSends(*registration, registration);
+	return true;
+}
+
+SendQueueDepth IOCPCompletionPort::getSendQueueDepth(Socket& socket) {
+	SendQueueDepth depth = { 0, 0 };
+
+	std::shared_ptr<Registration> registration = findRegistration(socket._winSocket);
+	if (registration != nullptr) {
+		std::lock_guard<std::mutex> lock(registration->lock);
+		depth.messages = static_cast<uint32>(registration->queuedSends.size()) + registration->sendingDepth.messages;
+		depth.bytes = registration->queuedBytes + registration->sendingDepth.bytes;
+	}
+	return depth;
+}
+
+uint32 IOCPCompletionPort::dropQueuedSends(Socket& socket, SendFilter filter, void* context, uint32 maxCount) {
+	std::shared_ptr<Registration> registration = findRegistration(socket._winSocket);
+	if (registration == nullptr) {
+		return 0;
+	}
+
+	std::lock_guard<std::mutex> lock(registration->lock);
+
+	uint32 dropped = 0;
+	std::deque<Packet>& queue = registration->queuedSends;
+	for (auto iter = queue.begin(); iter != queue.end() && dropped < maxCount;) {
+		if (filter(*iter, context)) {
+			registration->queuedBytes -= iter->getFrameSize();
+			iter = queue.erase(iter);
+			dropped++;
+		}
+		else {
+			++iter;
+		}
+	}
+	return dropped;
+}
+
+void IOCPCompletionPort::flushSends(Registration& registration, const std::shared_ptr<Registration>& owner) {
+	// Caller holds the registration's lock
+	if (registration.closed || registration.sending || registration.queuedSends.empty()) {
+		return;
+	}
+
+	SendOperation* operation = new SendOperation();
+	operation->owner = nullptr;
+	operation->registration = owner;
+	operation->firstBuffer = 0;
+
+	// Stream sends include the frame header the packet keeps in front of the message
+	const uint32 count = std::min(static_cast<uint32>(registration.queuedSends.size()), MAX_COALESCED_SENDS);
+	operation->packets.reserve(count);
+	operation->buffers.reserve(count);
+	for (uint32 i = 0; i < count; i++) {
+		operation->packets.push_back(std::move(registration.queuedSends.front()));
+		registration.queuedSends.pop_front();
+
+		const Packet& packet = operation->packets.back();
+		WSABUF buffer;
+		buffer.buf = reinterpret_cast<CHAR*>(const_cast<uint8*>(packet.getFrameData()));
+		buffer.len = packet.getFrameSize();
+		operation->buffers.push_back(buffer);
+
+		registration.queuedBytes -= packet.getFrameSize();
+		registration.sendingDepth.bytes += packet.getFrameSize();
+	}
+	registration.sendingDepth.messages = count;
+
+	registration.sending = issueSend(operation);
+}
+
+bool IOCPCompletionPort::issueSend(SendOperation* operation) {
+	Registration& registration = *operation->registration;
+
+	WSAOVERLAPPED& overlapped = *operation;
+	memset(&overlapped, 0, sizeof(WSAOVERLAPPED));
+
+	m_numSyscalls++;
+	int32 status = WSASend(
+		registration.socket,
+		&operation->buffers[operation->firstBuffer],
+		static_cast<DWORD>(operation->buffers.size() - operation->firstBuffer),
+		NULL,
+		0,
+		operation,
+		NULL
+	);
+	if (status == SOCKET_ERROR && WSAGetLastError() != WSA_IO_PENDING) {
+		// The connection is gone, its pending receive reports it
+		registration.queuedSends.clear();
+		registration.queuedBytes = 0;
+		registration.sendingDepth = SendQueueDepth{ 0, 0 };
+		delete operation;
+		return false;
+	}
+	return true;
+}
+
+void IOCPCompletionPort::handleSend(SendOperation* operation, bool succeeded, uint32 numBytes) {
+	std::shared_ptr<Registration> registration = operation->registration;
+	std::lock_guard<std::mutex> lock(registration->lock);
+
+	if (succeeded && !registration->closed) {
+		// Skip whatever went out, a short write sends the rest before anything queued behind it
+		std::vector<WSABUF>& buffers = operation->buffers;
+		while (operation->firstBuffer < buffers.size() && numBytes >= buffers[operation->firstBuffer].len) {
+			numBytes -= buffers[operation->firstBuffer].len;
+			operation->firstBuffer++;
+		}
+
+		if (operation->firstBuffer < buffers.size()) {
+			WSABUF& buffer = buffers[operation->firstBuffer];
+			buffer.buf += numBytes;
+			buffer.len -= numBytes;
+			registration->sending = issueSend(operation);
+			return;
+		}
+	}
+	else if (!succeeded) {
+		registration->queuedSends.clear();
+		registration->queuedBytes = 0;
+	}
+	delete operation;
+
+	registration->sending = false;
+	registration->sendingDepth = SendQueueDepth{ 0, 0 };
+	flushSends(*registration, registration);
+}
+
+bool IOCPCompletionPort::wait(Completion& completion, uint32 timeoutMs) {
+	DWORD numBytes = 0;
+	ULONG_PTR key = 0;
+	LPOVERLAPPED overlapped = nullptr;
+	bool result = false;
+
+	const ULONGLONG deadline = GetTickCount64() + timeoutMs;
+	for (;;) {
+		DWORD timeout = INFINITE;
+		if (timeoutMs != INFINITE_WAIT) {
+			ULONGLONG now = GetTickCount64();
+			timeout = (now < deadline) ? static_cast<DWORD>(deadline - now) : 0;
+		}
+
+		m_numSyscalls++;
+		result = GetQueuedCompletionStatus(m_port, &numBytes, &key, &overlapped, timeout);
+		if (!result && overlapped == nullptr) {
+			// Timed out or the port itself was closed
+			return false;
+		}
+
+		OverlappedContext* context = static_cast<OverlappedContext*>(overlapped);
+		if (context == nullptr || context->owner != nullptr) {
+			break;
+		}
+		// Sends finish inside the port, nobody waits on them
+		handleSend(static_cast<SendOperation*>(context), result, numBytes);
+	}
+
+	completion.key = key;
+	completion.buffer = (overlapped != nullptr) ? static_cast<OverlappedContext*>(overlapped)->owner : nullptr;
+	completion.numBytes = numBytes;
+	completion.status = CompletionStatus::SUCCESS;
+	completion.error = 0;
+	m_numCompletions++;
+
+	if (!result) {
+		DWORD error = GetLastError();
+		completion.error = error;
+
+		switch (error) {
+		case ERROR_OPERATION_ABORTED:
+			completion.status = CompletionStatus::ABORTED;
+			break;
+		case ERROR_NETNAME_DELETED:
+		case ERROR_CONNECTION_ABORTED:
+		case WSAECONNRESET:
+			// Ungraceful shutdown (AKA crash on client)
+			completion.status = CompletionStatus::DISCONNECTED;
+			break;
+		default:
+			completion.status = CompletionStatus::FAILED;
+			break;
+		}
+	}
+
+	return true;
+}
+
+void IOCPCompletionPort::post(uintptr key) {
+	m_numSyscalls++;
+	PostQueuedCompletionStatus(m_port, 0, key, nullptr);
+}
+
+#endif
@@ -0,0 +1,73 @@
+#pragma once
+
+#ifdef _WIN32
+
+#include "CompletionPort.h"
+#include "OverlappedBuffer.h"
+#include "Packet.h"
+#include "Platform.h"
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Stream sends are queued on their socket and go out one WSASend at a time, whatever queues up
+// while one is in flight is gathered into the next.
+class IOCPCompletionPort : public CompletionPort {
+private:
+	struct Registration {
+		SOCKET socket;
+		bool datagram;
+		bool closed;
+
+		std::mutex lock;
+		bool sending;
+		std::deque<Packet> queuedSends;
+		uint32 queuedBytes;
+		SendQueueDepth sendingDepth;	// What the WSASend in flight carries
+	};
+
+	// Told apart from receives by having no owning buffer
+	struct SendOperation : OverlappedContext {
+		std::shared_ptr<Registration> registration;
+		std::vector<Packet> packets;	// Keep the shared buffers alive until the send completes
+		std::vector<WSABUF> buffers;
+		uint32 firstBuffer;				// Everything before it has gone out
+	};
+
+	static constexpr uint32 MAX_COALESCED_SENDS = 64;
+
+	HANDLE m_port;
+
+	std::mutex m_lock;
+	std::unordered_map<SOCKET, std::shared_ptr<Registration>> m_registrations;
+
+	std::shared_ptr<Registration> findRegistration(SOCKET socket);
+
+	void flushSends(Registration& registration, const std::shared_ptr<Registration>& owner);
+	bool issueSend(SendOperation* operation);
+	void handleSend(SendOperation* operation, bool succeeded, uint32 numBytes);
+public:
+	IOCPCompletionPort();
+	virtual ~IOCPCompletionPort();
+
+	virtual void associate(Socket& socket, uintptr key) override;
+	virtual void dissociate(Socket& socket) override;
+
+	virtual void receiveFrom(Socket& socket, OverlappedBuffer& buffer) override;
+	virtual void receive(Socket& socket, OverlappedBuffer& buffer) override;
+	virtual void accept(Socket& listener, OverlappedBuffer& buffer) override;
+
+	// Stream sockets only, datagrams are left to the socket
+	virtual bool send(Socket& socket, const Packet& packet) override;
+	virtual bool send(Socket& socket, const Packet* packets, uint32 count) override;
+	virtual SendQueueDepth getSendQueueDepth(Socket& socket) override;
+	virtual uint32 dropQueuedSends(Socket& socket, SendFilter filter, void* context, uint32 maxCount) override;
+
+	virtual bool wait(Completion& completion, uint32 timeoutMs = INFINITE_WAIT) override;
+	virtual void post(uintptr key) override;
+};
+
+#endif
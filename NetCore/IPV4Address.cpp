@@ -2,14 +2,14 @@
 
 #include "Types.h"
 
-#include <ws2tcpip.h>
+#include <cstring>
 
 IPV4Address::IPV4Address() {
-	ZeroMemory(&m_address, sizeof(m_address));
+	memset(&m_address, 0, sizeof(m_address));
 }
 
 IPV4Address::IPV4Address(const std::string& address, const std::string& port) {
-	ZeroMemory(&m_address, sizeof(m_address));
+	memset(&m_address, 0, sizeof(m_address));
 	m_address.sin_family = AF_INET;
 	
 	// Convert port number
@@ -17,7 +17,7 @@ IPV4Address::IPV4Address(const std::string& address, const std::string& port) {
 	m_address.sin_port = htons(portNum);
 
 	// Convert ip
-	int32 error = InetPton(AF_INET, address.c_str(), &m_address.sin_addr);
+	int32 error = inet_pton(AF_INET, address.c_str(), &m_address.sin_addr);
 	if (error != 1) {
 		// TODO go back and look at docs for this function because error can be either 0 or -1
 		// error occured
@@ -31,7 +31,7 @@ IPV4Address::~IPV4Address() {}
 std::string IPV4Address::getSocketAddressAsString() const {
 	constexpr uint32 bufferSize = 128;
 	char buffer[bufferSize];
-	PCTSTR error = InetNtop(AF_INET, &m_address.sin_addr, buffer, bufferSize);
+	const char* error = inet_ntop(AF_INET, &m_address.sin_addr, buffer, bufferSize);
 	if (error == nullptr) {
 		// TODO go back and look at docs for this function
 		// error occured
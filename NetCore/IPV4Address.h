@@ -1,10 +1,24 @@
 #pragma once
 
 #include <string>
-#include <Winsock2.h>
 
+#include "Platform.h"
 #include "Types.h"
 
+// What the server tells clients apart by, the IP address alone. Cheap to compare and hash where
+// the address string is neither.
+struct EndpointKey {
+	uint32 address;	// Network byte order
+
+	bool operator==(const EndpointKey& other) const { return address == other.address; }
+	bool operator!=(const EndpointKey& other) const { return address != other.address; }
+};
+
+struct EndpointKeyHash {
+	// Fibonacci hashing, so neighbouring addresses don't crowd the same buckets
+	size_t operator()(const EndpointKey& key) const { return static_cast<size_t>(key.address * 0x9E3779B1u); }
+};
+
 class IPV4Address {
 private:
 	sockaddr_in m_address;
@@ -17,6 +31,9 @@ public:
 	const sockaddr* getSocketAddress() const { return reinterpret_cast<const sockaddr*>(&m_address); }
 	uint32 getSocketAddressSize() const { return sizeof(sockaddr_in); }
 
+	EndpointKey getEndpointKey() const { return EndpointKey{ m_address.sin_addr.s_addr }; }
+
+	// For logging and persistence, these format the address on every call
 	std::string getSocketAddressAsString() const;
 	std::string getSocketPortAsString() const;
 };
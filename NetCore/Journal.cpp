@@ -0,0 +1,299 @@
+#include "Journal.h"
+
+#include "Checksum.h"
+#include "Clock.h"
+
+#include <algorithm>
+
+Journal::Journal(const std::string& path, JournalSyncPolicy syncPolicy, uint64 syncInterval) :
+	m_path(path)
+	, m_syncPolicy(syncPolicy)
+	, m_syncInterval(syncInterval)
+	, m_appended(0)
+	, m_writtenTo(0)
+	, m_durable(0)
+	, m_writing(false)
+	, m_failed(false)
+	, m_fileSize(0)
+	, m_lastSync(0)
+	, m_baseTime(0)
+	, m_validSize(0)
+	, m_retaining(false)
+	, m_numRecords(0)
+	, m_numCommits(0)
+	, m_numSyncs(0)
+	, m_numCompactions(0)
+{}
+
+Journal::~Journal() {
+	close();
+}
+
+bool Journal::read() {
+	m_validSize = 0;
+	if (!File::read(m_path, m_contents) || m_contents.size() < HEADER_SIZE) {
+		m_contents.clear();
+		return false;
+	}
+
+	uint32 magic = 0;
+	uint32 version = 0;
+	memcpy(&magic, m_contents.data(), sizeof(magic));
+	memcpy(&version, m_contents.data() + 4, sizeof(version));
+	if (magic != MAGIC || version != VERSION) {
+		m_contents.clear();
+		return false;
+	}
+
+	memcpy(&m_baseTime, m_contents.data() + 8, sizeof(m_baseTime));
+	return true;
+}
+
+const uint8* Journal::parse(const std::vector<uint8>& contents, uint32& offset, uint8& type, uint64& time, uint32& size) const {
+	const uint64 remaining = (contents.size() > offset) ? contents.size() - offset : 0;
+	if (remaining < RECORD_HEADER_SIZE) {
+		return nullptr;
+	}
+
+	const uint8* record = contents.data() + offset;
+	uint32 checksum = 0;
+	memcpy(&size, record, sizeof(size));
+	memcpy(&checksum, record + 4, sizeof(checksum));
+	if (remaining - RECORD_HEADER_SIZE < size) {
+		// Torn, the write of the last record never finished
+		return nullptr;
+	}
+
+	// Covers everything after the checksum
+	if (crc32(record + 8, RECORD_HEADER_SIZE - 8 + size) != checksum) {
+		return nullptr;
+	}
+
+	type = record[8];
+	memcpy(&time, record + 12, sizeof(time));
+	offset += RECORD_HEADER_SIZE + size;
+	return record + RECORD_HEADER_SIZE;
+}
+
+void Journal::writeHeader(uint8* header, uint64 baseTime) {
+	const uint32 magic = MAGIC;
+	const uint32 version = VERSION;
+
+	memcpy(header, &magic, sizeof(magic));
+	memcpy(header + 4, &version, sizeof(version));
+	memcpy(header + 8, &baseTime, sizeof(baseTime));
+}
+
+bool Journal::restart(uint64 baseTime) {
+	uint8 header[HEADER_SIZE];
+	writeHeader(header, baseTime);
+
+	m_baseTime = baseTime;
+	m_fileSize = HEADER_SIZE;
+	if (!m_file.setSize(0) || !m_file.write(header, HEADER_SIZE) || !m_file.sync()) {
+		m_failed = true;
+		return false;
+	}
+	return true;
+}
+
+bool Journal::open(uint64 baseTime) {
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (!m_file.open(m_path, false)) {
+		m_failed = true;
+		return false;
+	}
+
+	if (m_validSize < HEADER_SIZE) {
+		return restart(baseTime);
+	}
+
+	m_fileSize = m_validSize;
+	if (!m_file.setSize(m_validSize)) {
+		m_failed = true;
+		return false;
+	}
+	return true;
+}
+
+void Journal::close() {
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_file.close();
+}
+
+uint64 Journal::append(uint8 type, const JournalRecord& record) {
+	const uint32 size = record.getSize();
+
+	uint8 header[RECORD_HEADER_SIZE] = {};
+	memcpy(header, &size, sizeof(size));
+	header[8] = type;
+
+	std::lock_guard<std::mutex> lock(m_lock);
+
+	// Stamped under the lock so times never go back along the journal
+	const uint64 time = getSystemTime();
+	memcpy(header + 12, &time, sizeof(time));
+
+	uint32 checksum = crc32(header + 8, RECORD_HEADER_SIZE - 8);
+	checksum = crc32(record.getData(), size, checksum);
+	memcpy(header + 4, &checksum, sizeof(checksum));
+
+	m_pending.insert(m_pending.end(), header, header + RECORD_HEADER_SIZE);
+	m_pending.insert(m_pending.end(), record.getData(), record.getData() + size);
+	if (m_retaining) {
+		m_retained.insert(m_retained.end(), header, header + RECORD_HEADER_SIZE);
+		m_retained.insert(m_retained.end(), record.getData(), record.getData() + size);
+	}
+	m_appended += RECORD_HEADER_SIZE + size;
+	m_numRecords++;
+	return m_appended;
+}
+
+bool Journal::commit(uint64 offset) {
+	std::unique_lock<std::mutex> lock(m_lock);
+	while (m_writtenTo < offset && !m_failed) {
+		if (m_writing) {
+			// The group being written may not have this one, look again once it's done
+			m_written.wait(lock);
+			continue;
+		}
+
+		// Everything appended so far goes out in this group, records of threads waiting included
+		m_writing = true;
+		m_group.clear();
+		m_group.swap(m_pending);
+		const uint64 end = m_appended;
+		lock.unlock();
+
+		bool written = m_file.write(m_group.data(), m_group.size());
+		const uint64 now = getMonotonicTime();
+		const bool sync = (m_syncPolicy == JournalSyncPolicy::COMMIT) || (m_syncPolicy == JournalSyncPolicy::INTERVAL && now - m_lastSync >= m_syncInterval);
+		if (written && sync) {
+			written = m_file.sync();
+			m_lastSync = now;
+			m_numSyncs++;
+		}
+
+		lock.lock();
+		m_writing = false;
+		m_fileSize += m_group.size();
+		m_numCommits++;
+		if (written) {
+			m_writtenTo = end;
+			if (sync || m_syncPolicy == JournalSyncPolicy::NONE) {
+				m_durable = end;
+			}
+		}
+		else {
+			m_failed = true;
+		}
+		m_written.notify_all();
+	}
+	return !m_failed;
+}
+
+bool Journal::syncWritten(bool force) {
+	std::unique_lock<std::mutex> lock(m_lock);
+	while (m_writing) {
+		m_written.wait(lock);
+	}
+	if (m_failed || m_durable >= m_writtenTo) {
+		return !m_failed;
+	}
+
+	const uint64 now = getMonotonicTime();
+	if (!force && m_syncPolicy == JournalSyncPolicy::INTERVAL && now - m_lastSync < m_syncInterval) {
+		return true;
+	}
+
+	m_writing = true;
+	const uint64 end = m_writtenTo;
+	lock.unlock();
+
+	const bool synced = m_file.sync();
+
+	lock.lock();
+	m_writing = false;
+	m_lastSync = now;
+	m_numSyncs++;
+	if (synced) {
+		m_durable = end;
+	}
+	else {
+		m_failed = true;
+	}
+	m_written.notify_all();
+	return !m_failed;
+}
+
+uint64 Journal::getDurable() {
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_durable;
+}
+
+bool Journal::hasFailed() {
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_failed;
+}
+
+void Journal::beginCheckpoint() {
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_retaining = true;
+	m_retained.clear();
+}
+
+bool Journal::endCheckpoint(uint64 baseTime) {
+	std::unique_lock<std::mutex> lock(m_lock);
+	while (m_writing) {
+		m_written.wait(lock);
+	}
+	m_retaining = false;
+
+	// The tail of what was kept may not be written yet, it goes out with the next commit as usual.
+	// Anything pending from before the checkpoint is in it already.
+	const uint64 unwritten = std::min<uint64>(m_pending.size(), m_retained.size());
+	const uint64 written = m_retained.size() - unwritten;
+
+	std::vector<uint8> contents(HEADER_SIZE + static_cast<size_t>(written));
+	writeHeader(contents.data(), baseTime);
+	if (written > 0) {
+		memcpy(contents.data() + HEADER_SIZE, m_retained.data(), static_cast<size_t>(written));
+	}
+	std::vector<uint8>().swap(m_retained);
+
+	// Closed first, a file that is open can't be replaced everywhere
+	m_file.close();
+	const bool replaced = File::writeAtomically(m_path, contents.data(), contents.size());
+	if (!m_file.open(m_path, false)) {
+		m_failed = true;
+		return false;
+	}
+	if (!replaced) {
+		// Still the whole journal, nothing was lost
+		return false;
+	}
+
+	m_pending.erase(m_pending.begin(), m_pending.end() - static_cast<size_t>(unwritten));
+	// The new file was synced before it was swapped in and holds everything written since
+	m_durable = m_writtenTo;
+	m_baseTime = baseTime;
+	m_fileSize = contents.size();
+	m_numCompactions++;
+	return true;
+}
+
+void Journal::cancelCheckpoint() {
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_retaining = false;
+	std::vector<uint8>().swap(m_retained);
+}
+
+uint64 Journal::getSize() {
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_fileSize + m_pending.size();
+}
+
+JournalStatistics Journal::getStatistics() {
+	std::lock_guard<std::mutex> lock(m_lock);
+	return JournalStatistics{ m_numRecords, m_numCommits, m_numSyncs, m_numCompactions, m_fileSize + m_pending.size(), m_appended, m_writtenTo, m_durable };
+}
@@ -0,0 +1,201 @@
+#pragma once
+
+#include "Types.h"
+#include "File.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum class JournalSyncPolicy : uint8 {
+	NONE,		// Left to the OS, a crash of the machine loses what it hadn't written out yet
+	COMMIT,		// Every commit waits for the disk
+	INTERVAL	// At most one sync per interval, a crash of the machine loses at most that much
+};
+
+struct JournalStatistics {
+	uint64 records;
+	uint64 commits;		// Groups written, each one holding whatever was appended while the last was going out
+	uint64 syncs;
+	uint64 compactions;
+	uint64 size;		// Bytes in the journal now, including what isn't written yet
+	uint64 appended;	// Offset of the last record appended
+	uint64 written;		// Everything before it is written, possibly only as far as the OS cache
+	uint64 durable;		// Everything before it is synced, or written under NONE which never syncs
+};
+
+// Payload of a journal record. Fields are stored in the machine's byte order, the journal is
+// only ever read back by the server that wrote it.
+class JournalRecord {
+private:
+	std::vector<uint8> m_data;
+
+	void write(const void* data, uint32 size) {
+		const uint8* bytes = reinterpret_cast<const uint8*>(data);
+		m_data.insert(m_data.end(), bytes, bytes + size);
+	}
+public:
+	void writeUInt8(uint8 value) { write(&value, sizeof(value)); }
+	void writeUInt32(uint32 value) { write(&value, sizeof(value)); }
+	void writeUInt64(uint64 value) { write(&value, sizeof(value)); }
+	void writeFloat32(float32 value) { write(&value, sizeof(value)); }
+	void writeString(const std::string& value) {
+		writeUInt32(static_cast<uint32>(value.size()));
+		write(value.data(), static_cast<uint32>(value.size()));
+	}
+
+	const uint8* getData() const { return m_data.data(); }
+	uint32 getSize() const { return static_cast<uint32>(m_data.size()); }
+};
+
+// Reads a payload back in the order it was written. Reading past the end gives zeros and marks
+// the reader invalid instead of failing on the spot.
+class JournalReader {
+private:
+	const uint8* m_data;
+	uint32 m_size;
+	uint32 m_offset;
+	bool m_valid;
+
+	void read(void* value, uint32 size) {
+		if (m_size - m_offset < size) {
+			memset(value, 0, size);
+			m_offset = m_size;
+			m_valid = false;
+			return;
+		}
+		memcpy(value, m_data + m_offset, size);
+		m_offset += size;
+	}
+public:
+	JournalReader(const uint8* data, uint32 size) : m_data(data), m_size(size), m_offset(0), m_valid(true) {}
+
+	uint8 readUInt8() { uint8 value; read(&value, sizeof(value)); return value; }
+	uint32 readUInt32() { uint32 value; read(&value, sizeof(value)); return value; }
+	uint64 readUInt64() { uint64 value; read(&value, sizeof(value)); return value; }
+	float32 readFloat32() { float32 value; read(&value, sizeof(value)); return value; }
+	std::string readString() {
+		const uint32 size = readUInt32();
+		if (m_size - m_offset < size) {
+			m_offset = m_size;
+			m_valid = false;
+			return std::string();
+		}
+		std::string value(reinterpret_cast<const char*>(m_data + m_offset), size);
+		m_offset += size;
+		return value;
+	}
+
+	bool isValid() const { return m_valid; }
+};
+
+// Append only log of changes since the last snapshot. Appending only copies the record into
+// memory, commit writes it out. Threads committing while a write is in progress have their
+// records written together by the next one, so under load one write and sync covers many
+// commits. Every record carries a checksum, replaying stops at the first one that is torn or
+// corrupt and opening cuts the file back to there.
+class Journal {
+private:
+	static constexpr uint32 MAGIC = 0x4C4E524A;	// "JRNL"
+	static constexpr uint32 VERSION = 1;
+	static constexpr uint32 HEADER_SIZE = 16;			// Magic, version and base time
+	static constexpr uint32 RECORD_HEADER_SIZE = 20;	// Size, checksum, type, 3 bytes padding and time
+
+	std::string m_path;
+	JournalSyncPolicy m_syncPolicy;
+	uint64 m_syncInterval;	// In 100 nanosecond ticks
+	File m_file;
+
+	std::mutex m_lock;
+	std::condition_variable m_written;
+	std::vector<uint8> m_pending;	// Appended and not written yet
+	std::vector<uint8> m_group;		// Being written, only touched by the writing thread
+	// Offsets count every byte ever appended and never go back, not even when the file starts over
+	uint64 m_appended;
+	uint64 m_writtenTo;
+	uint64 m_durable;		// Synced, or written under NONE
+	bool m_writing;			// A write or sync is in progress, only one runs at a time
+	bool m_failed;			// A write failed, nothing after it can be trusted to be on disk
+	uint64 m_fileSize;
+	uint64 m_lastSync;		// Monotonic
+
+	uint64 m_baseTime;
+	std::vector<uint8> m_contents;	// Read back for replaying, freed once replayed
+	uint64 m_validSize;				// Of the file as replayed
+
+	bool m_retaining;
+	std::vector<uint8> m_retained;	// Appended since the checkpoint began
+
+	std::atomic<uint64> m_numRecords;
+	std::atomic<uint64> m_numCommits;
+	std::atomic<uint64> m_numSyncs;
+	std::atomic<uint64> m_numCompactions;
+
+	static void writeHeader(uint8* header, uint64 baseTime);
+	// Truncates the file and writes a fresh header, caller holds m_lock
+	bool restart(uint64 baseTime);
+	const uint8* parse(const std::vector<uint8>& contents, uint32& offset, uint8& type, uint64& time, uint32& size) const;
+public:
+	Journal(const std::string& path, JournalSyncPolicy syncPolicy, uint64 syncInterval);
+	virtual ~Journal();
+
+	// Reads the journal back before opening it, false if there is none or it isn't one. The base
+	// time is known from here on.
+	bool read();
+
+	// Calls visit(type, time, reader) for every intact record read and returns how many there were
+	template<typename Visitor>
+	uint32 replay(Visitor visit) {
+		if (m_contents.empty()) {
+			return 0;
+		}
+
+		uint32 numRecords = 0;
+		uint32 offset = HEADER_SIZE;
+		uint8 type = 0;
+		uint64 time = 0;
+		uint32 size = 0;
+		while (const uint8* payload = parse(m_contents, offset, type, time, size)) {
+			JournalReader reader(payload, size);
+			visit(type, time, reader);
+			numRecords++;
+		}
+
+		m_validSize = offset;
+		std::vector<uint8>().swap(m_contents);
+		return numRecords;
+	}
+
+	// After replaying, drops anything after the last intact record. A journal that is missing or
+	// unreadable is started over with the base time given.
+	bool open(uint64 baseTime);
+	void close();
+
+	// When the snapshot the journal follows was taken, in 100 nanosecond ticks
+	uint64 getBaseTime() const { return m_baseTime; }
+
+	// Stamps the record with the current time. Returns the offset to commit to have it on disk.
+	uint64 append(uint8 type, const JournalRecord& record);
+	// Returns once everything up to offset is written, and synced if the policy asks for it now.
+	// False if writing failed.
+	bool commit(uint64 offset);
+	// Syncs what was written since the last sync once the interval is up, or right away if forced.
+	// Under INTERVAL this has to be called while idle, or the tail of the journal is never synced.
+	bool syncWritten(bool force);
+	// Everything before it survives a crash of the machine as far as the policy allows
+	uint64 getDurable();
+	bool hasFailed();
+
+	// A checkpoint covers everything appended before beginCheckpoint. Appending carries on while it
+	// is being written, and what comes in meanwhile is kept so that endCheckpoint can start the
+	// journal over at baseTime with only that. Cancelling leaves the journal as it is.
+	void beginCheckpoint();
+	bool endCheckpoint(uint64 baseTime);
+	void cancelCheckpoint();
+
+	uint64 getSize();
+	JournalStatistics getStatistics();
+};
@@ -1,11 +1,24 @@
 #include "Log.h"
 
+#include "IPV4Address.h"
+
+#include <atomic>
 #include <iostream>
 #include <mutex>
+#include <cstdarg>
+#include <cstdio>
 
 static std::mutex g_lock;
+static std::atomic<bool> g_enabled(true);
+
+void setLogEnabled(bool enabled) {
+	g_enabled = enabled;
+}
 
 void log(LogType logType, MessageType msgType, const IPV4Address& address) {
+	if (!g_enabled) {
+		return;
+	}
 	std::lock_guard<std::mutex> lock(g_lock);
 	
 	switch (logType) {
@@ -21,15 +34,23 @@ void log(LogType logType, MessageType msgType, const IPV4Address& address) {
 }
 
 void log(const char* format, ...) {
+	if (!g_enabled) {
+		return;
+	}
 	std::lock_guard<std::mutex> lock(g_lock);
 
 	va_list args;
 	va_start(args, format);
 
-	const int32 numChars = vsnprintf(nullptr, 0, format, args);
+	// The first pass consumes the argument list, so format from a copy of it
+	va_list argsCopy;
+	va_copy(argsCopy, args);
+	const int32 numChars = vsnprintf(nullptr, 0, format, argsCopy);
+	va_end(argsCopy);
+
 	char* buffer = new char[numChars + 1];
 
-	vsprintf_s(buffer, numChars + 1, format, args);
+	vsnprintf(buffer, numChars + 1, format, args);
 
 	std::cout << buffer << std::endl;
 
@@ -12,3 +12,6 @@ enum class LogType {
 void log(LogType logType, MessageType msgType, const IPV4Address& address);
 void log(const char* format, ...);
 
+// Both overloads do nothing while disabled, for benchmarks running the server in process
+void setLogEnabled(bool enabled);
+
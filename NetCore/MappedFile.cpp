@@ -0,0 +1,106 @@
+#include "MappedFile.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+MappedFile::MappedFile() :
+#ifdef _WIN32
+	m_file(INVALID_HANDLE_VALUE)
+	, m_mapping(nullptr)
+	, m_data(nullptr)
+#else
+	m_data(nullptr)
+#endif
+	, m_size(0)
+{}
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+bool MappedFile::open(const std::string& path) {
+	close();
+
+#ifdef _WIN32
+	m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER size = {};
+	if (GetFileSizeEx(m_file, &size) == 0) {
+		close();
+		return false;
+	}
+	m_size = static_cast<uint64>(size.QuadPart);
+	if (m_size == 0) {
+		// Can't map nothing
+		return true;
+	}
+
+	m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (m_mapping == nullptr) {
+		close();
+		return false;
+	}
+
+	m_data = reinterpret_cast<const uint8*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+	if (m_data == nullptr) {
+		close();
+		return false;
+	}
+	return true;
+#else
+	const int file = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (file < 0) {
+		return false;
+	}
+
+	struct stat status;
+	if (fstat(file, &status) != 0) {
+		::close(file);
+		return false;
+	}
+	m_size = static_cast<uint64>(status.st_size);
+	if (m_size == 0) {
+		::close(file);
+		return true;
+	}
+
+	// The mapping keeps the file alive, the descriptor isn't needed past here
+	void* data = mmap(nullptr, static_cast<size_t>(m_size), PROT_READ, MAP_PRIVATE, file, 0);
+	::close(file);
+	if (data == MAP_FAILED) {
+		m_size = 0;
+		return false;
+	}
+	madvise(data, static_cast<size_t>(m_size), MADV_SEQUENTIAL);
+
+	m_data = reinterpret_cast<const uint8*>(data);
+	return true;
+#endif
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+	if (m_data != nullptr) {
+		UnmapViewOfFile(m_data);
+	}
+	if (m_mapping != nullptr) {
+		CloseHandle(m_mapping);
+		m_mapping = nullptr;
+	}
+	if (m_file != INVALID_HANDLE_VALUE) {
+		CloseHandle(m_file);
+		m_file = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (m_data != nullptr) {
+		munmap(const_cast<uint8*>(m_data), static_cast<size_t>(m_size));
+	}
+#endif
+	m_data = nullptr;
+	m_size = 0;
+}
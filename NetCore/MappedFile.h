@@ -0,0 +1,30 @@
+#pragma once
+
+#include "Platform.h"
+#include "Types.h"
+
+#include <string>
+
+// Read only view of a whole file, the OS pages it in as it is touched instead of it being copied
+// into memory up front.
+class MappedFile {
+private:
+#ifdef _WIN32
+	HANDLE m_file;
+	HANDLE m_mapping;
+#endif
+	const uint8* m_data;
+	uint64 m_size;
+public:
+	MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	virtual ~MappedFile();
+
+	// False if the file doesn't exist or couldn't be mapped. An empty file maps to no data.
+	bool open(const std::string& path);
+	void close();
+
+	const uint8* getData() const { return m_data; }
+	uint64 getSize() const { return m_size; }
+};
@@ -34,6 +34,10 @@ std::string messageTypeToString(MessageType msgType) {
 		return "SOLD_TO";
 	case MessageType::MSG_NOT_SOLD:
 		return "NOT_SOLD";
+	case MessageType::MSG_WATCH:
+		return "WATCH";
+	case MessageType::MSG_UNWATCH:
+		return "UNWATCH";
 	default:
 		return "UNKNOWN";
 	}
@@ -28,18 +28,16 @@ enum class MessageType : uint8 {
 	MSG_WIN,
 	MSG_BID_OVER,
 	MSG_SOLD_TO,
-	MSG_NOT_SOLD
+	MSG_NOT_SOLD,
+	MSG_WATCH,
+	MSG_UNWATCH
 };
 
 std::string messageTypeToString(MessageType msgType);
 
 template<typename T>
 Packet serializeMessage(const T& msg) {
-	const uint32 size = sizeof(T);
-	uint8 buffer[size];
-	memcpy(buffer, &msg, size);
-
-	return Packet(buffer, size);
+	return Packet(reinterpret_cast<const uint8*>(&msg), sizeof(T));
 }
 
 template<typename T>
@@ -164,4 +162,18 @@ struct NotSoldMessage {
 	const MessageType type = MessageType::MSG_NOT_SOLD;
 	uint32 itemNum;
 	char reason[REASONLENGTH];
+};
+
+// Sent over TCP, HIGHEST for an item only goes to the clients watching it. Sellers and bidders
+// watch their items without asking.
+struct WatchMessage {
+	const MessageType type = MessageType::MSG_WATCH;
+	uint32 reqNum;
+	uint32 itemNum;
+};
+
+struct UnwatchMessage {
+	const MessageType type = MessageType::MSG_UNWATCH;
+	uint32 reqNum;
+	uint32 itemNum;
 };
\ No newline at end of file
@@ -1,18 +1,23 @@
 #include "OverlappedBuffer.h"
 
+#include <cstring>
 
+OverlappedBuffer::OverlappedBuffer() : m_flags(0), m_acceptSocket(INVALID_SOCKET) {
+	m_buffer = new char[OVERLAPPED_BUFFER_SIZE];
+	m_data = m_buffer;
+	m_providedBuffer = -1;
 
-OverlappedBuffer::OverlappedBuffer() : m_flags(0) {
+#ifdef _WIN32
 	ZeroMemory(&m_overlapped, sizeof(m_overlapped));
 	m_overlapped.hEvent = nullptr;
+	m_overlapped.owner = this;
 
-
-	m_buffer = new char[OVERLAPPED_BUFFER_SIZE];
 	m_WSAbuffer.buf = m_buffer;
 	m_WSAbuffer.len = OVERLAPPED_BUFFER_SIZE;
+#endif
 
 	m_senderAddressSize = sizeof(m_senderAddress);
-	ZeroMemory(&m_senderAddress, m_senderAddressSize);
+	memset(&m_senderAddress, 0, m_senderAddressSize);
 }
 
 
@@ -21,5 +26,5 @@ OverlappedBuffer::~OverlappedBuffer() {
 }
 
 uint8* OverlappedBuffer::getData() {
-	return reinterpret_cast<uint8*>(m_WSAbuffer.buf);
-}
\ No newline at end of file
+	return reinterpret_cast<uint8*>(m_data);
+}
@@ -3,31 +3,51 @@
 #include "Types.h"
 #include "Packet.h"
 #include "IPV4Address.h"
-
-#include <Winsock2.h>
+#include "Platform.h"
 
 constexpr uint32 OVERLAPPED_BUFFER_SIZE = 512;
 
 class Connection;
+class OverlappedBuffer;
+
+#ifdef _WIN32
+// The OVERLAPPED handed to Winsock, tagged with the buffer that owns it so completions can be
+// mapped back without pointer arithmetic on the containing class
+struct OverlappedContext : WSAOVERLAPPED {
+	OverlappedBuffer* owner;
+};
+#endif
 
 class OverlappedBuffer {
 	friend class UDPSocket;
 	friend class TCPSocket;
 	friend class Connection;
+	friend class IOCPCompletionPort;
+	friend class EpollCompletionPort;
+	friend class URingCompletionPort;
 private:
 	char* m_buffer;
+	// Where the last receive landed. Usually m_buffer, but engines with their own buffer pool
+	// lend one of theirs until the next receive is issued.
+	char* m_data;
+	int32 m_providedBuffer;
+#ifdef _WIN32
 	WSABUF m_WSAbuffer;
-	WSAOVERLAPPED m_overlapped;
+	OverlappedContext m_overlapped;
+#endif
 
 	uint32 m_flags;
 
 	sockaddr_in m_senderAddress;
-	int32 m_senderAddressSize;
+	socklen_t m_senderAddressSize;
+
+	// Socket handed out by a completed accept
+	SOCKET m_acceptSocket;
 public:
 	OverlappedBuffer();
 	virtual ~OverlappedBuffer();
 
 	uint8* getData();
+	uint32 getCapacity() const { return OVERLAPPED_BUFFER_SIZE; }
 	IPV4Address getAddress() { return IPV4Address(m_senderAddress); }
 };
-
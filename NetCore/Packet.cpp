@@ -1,25 +1,27 @@
 #include "Packet.h"
 
+#include "FrameReader.h"
+
 #include <cstring>
 #include <algorithm>
 
-const uint32 Packet::PACKET_SIZE = 512;
+constexpr uint32 Packet::PACKET_SIZE;
 
-Packet::Packet() : m_messageSize(0) {
-	m_buffer = new uint8[PACKET_SIZE];
-}
+Packet::Packet() : m_buffer(nullptr), m_messageSize(0) {}
 
-Packet::Packet(uint8* buffer, uint32 buffSize) : Packet() {
-	m_messageSize = min(buffSize, PACKET_SIZE);
-	memcpy(m_buffer, buffer, m_messageSize);
+Packet::Packet(const uint8* buffer, uint32 buffSize) : Packet() {
+	memcpy(prepareWrite(), buffer, std::min(buffSize, PACKET_SIZE));
+	setMessageSize(buffSize);
 }
 
 Packet::Packet(const Packet& packet) {
-	m_buffer = new uint8[PACKET_SIZE];
+	m_buffer = packet.m_buffer;
 	m_messageSize = packet.m_messageSize;
 	m_address = packet.m_address;
 
-	memcpy(m_buffer, packet.m_buffer, m_messageSize);
+	if (m_buffer != nullptr) {
+		m_buffer->references.fetch_add(1, std::memory_order_relaxed);
+	}
 }
 
 Packet::Packet(Packet&& packet) {
@@ -28,25 +30,51 @@ Packet::Packet(Packet&& packet) {
 	m_address = packet.m_address;
 
 	packet.m_buffer = nullptr;
+	packet.m_messageSize = 0;
 }
 
 Packet::~Packet() {
-	delete[] m_buffer;
+	releaseBuffer();
 }
 
 Packet& Packet::operator=(const Packet& packet) {
+	if (packet.m_buffer != nullptr) {
+		packet.m_buffer->references.fetch_add(1, std::memory_order_relaxed);
+	}
+	releaseBuffer();
+
+	m_buffer = packet.m_buffer;
 	m_messageSize = packet.m_messageSize;
-	memcpy(m_buffer, packet.m_buffer, m_messageSize);
 	m_address = packet.m_address;
 
 	return *this;
 }
 
 Packet& Packet::operator=(Packet&& packet) {
-	m_buffer = packet.m_buffer;
+	// Swap so the moved from packet lets go of the old buffer and stays assignable
+	std::swap(m_buffer, packet.m_buffer);
 	m_messageSize = packet.m_messageSize;
 	m_address = packet.m_address;
 
-	packet.m_buffer = nullptr;
 	return *this;
-}
\ No newline at end of file
+}
+
+uint8* Packet::prepareWrite() {
+	if (m_buffer == nullptr || m_buffer->references.load(std::memory_order_acquire) != 1) {
+		releaseBuffer();
+		m_buffer = PacketPool::get().acquire();
+	}
+	return m_buffer->getData();
+}
+
+void Packet::setMessageSize(uint32 size) {
+	m_messageSize = std::min(size, PACKET_SIZE);
+	FrameReader::writeHeader(m_buffer->getHeader(), m_messageSize);
+}
+
+void Packet::releaseBuffer() {
+	if (m_buffer != nullptr) {
+		PacketPool::get().release(m_buffer);
+		m_buffer = nullptr;
+	}
+}
@@ -3,18 +3,29 @@
 #include "Types.h"
 
 #include "IPV4Address.h"
+#include "PacketPool.h"
 
+// Copies of a packet share its buffer, so handing the same message to many recipients costs
+// one buffer no matter how many copies are made.
 class Packet {
+	// Receives fill packets in place
+	friend class UDPSocket;
+	friend class TCPSocket;
 public:
-	const static uint32 PACKET_SIZE;
+	static constexpr uint32 PACKET_SIZE = PacketBuffer::DATA_SIZE;
 private:
-	uint8* m_buffer;
+	PacketBuffer* m_buffer;
 	uint32 m_messageSize;
 
 	IPV4Address m_address;
+
+	// Gives this packet a buffer nobody else is reading from, the contents are not kept
+	uint8* prepareWrite();
+	void setMessageSize(uint32 size);
+	void releaseBuffer();
 public:
 	Packet();
-	Packet(uint8* buffer, uint32 buffSize);
+	Packet(const uint8* buffer, uint32 buffSize);
 	Packet(const Packet& packet);
 	Packet(Packet&& packet);
 	virtual ~Packet();
@@ -22,11 +33,14 @@ public:
 	Packet& operator=(const Packet& packet);
 	Packet& operator=(Packet&& packet);
 
-	const uint8* getMessageData() const { return m_buffer; }
+	const uint8* getMessageData() const { return (m_buffer != nullptr) ? m_buffer->getData() : nullptr; }
 	uint32 getMessageSize() const { return m_messageSize; }
 
+	// The message preceded by its stream frame header, see FrameReader
+	const uint8* getFrameData() const { return (m_buffer != nullptr) ? m_buffer->getHeader() : nullptr; }
+	uint32 getFrameSize() const { return PacketBuffer::HEADER_SIZE + m_messageSize; }
+
 	// Really only for UDP more than anything
 	void setAddress(const IPV4Address& address) { m_address = address; }
 	const IPV4Address& getAddress() const { return m_address; }
 };
-
@@ -0,0 +1,106 @@
+#include "PacketPool.h"
+
+constexpr uint32 PacketBuffer::HEADER_SIZE;
+constexpr uint32 PacketBuffer::DATA_SIZE;
+constexpr uint32 PacketPool::SLAB_SIZE;
+constexpr uint32 PacketPool::CACHE_SIZE;
+
+thread_local PacketPool::ThreadCache PacketPool::s_cache;
+
+PacketPool::ThreadCache::~ThreadCache() {
+	PacketPool::get().spill(*this, count);
+}
+
+PacketPool::PacketPool() :
+	m_freeBuffers(nullptr)
+	, m_numAcquired(0)
+	, m_numAllocations(0)
+{}
+
+PacketPool::~PacketPool() {
+	for (PacketBuffer* slab : m_slabs) {
+		delete[] slab;
+	}
+}
+
+PacketPool& PacketPool::get() {
+	// Never destroyed, packets in other static objects and thread caches may outlive any other
+	// point it could be torn down at
+	static PacketPool* s_instance = new PacketPool();
+	return *s_instance;
+}
+
+PacketBuffer* PacketPool::acquire() {
+	ThreadCache& cache = s_cache;
+	if (cache.count == 0) {
+		refill(cache);
+	}
+
+	PacketBuffer* buffer = cache.buffers;
+	cache.buffers = buffer->next;
+	cache.count--;
+
+	buffer->references.store(1, std::memory_order_relaxed);
+	buffer->next = nullptr;
+	m_numAcquired.fetch_add(1, std::memory_order_relaxed);
+	return buffer;
+}
+
+void PacketPool::release(PacketBuffer* buffer) {
+	if (buffer->references.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+		return;
+	}
+
+	ThreadCache& cache = s_cache;
+	buffer->next = cache.buffers;
+	cache.buffers = buffer;
+	cache.count++;
+
+	if (cache.count > CACHE_SIZE * 2) {
+		spill(cache, CACHE_SIZE);
+	}
+}
+
+void PacketPool::refill(ThreadCache& cache) {
+	std::lock_guard<std::mutex> lock(m_lock);
+
+	if (m_freeBuffers == nullptr) {
+		PacketBuffer* slab = new PacketBuffer[SLAB_SIZE];
+		m_slabs.push_back(slab);
+		m_numAllocations.fetch_add(1, std::memory_order_relaxed);
+
+		for (uint32 i = 0; i < SLAB_SIZE; i++) {
+			slab[i].next = m_freeBuffers;
+			m_freeBuffers = &slab[i];
+		}
+	}
+
+	while (m_freeBuffers != nullptr && cache.count < CACHE_SIZE) {
+		PacketBuffer* buffer = m_freeBuffers;
+		m_freeBuffers = buffer->next;
+		buffer->next = cache.buffers;
+		cache.buffers = buffer;
+		cache.count++;
+	}
+}
+
+void PacketPool::spill(ThreadCache& cache, uint32 count) {
+	std::lock_guard<std::mutex> lock(m_lock);
+
+	while (count > 0 && cache.buffers != nullptr) {
+		PacketBuffer* buffer = cache.buffers;
+		cache.buffers = buffer->next;
+		cache.count--;
+		count--;
+
+		buffer->next = m_freeBuffers;
+		m_freeBuffers = buffer;
+	}
+}
+
+PacketPoolStatistics PacketPool::getStatistics() const {
+	PacketPoolStatistics statistics;
+	statistics.acquired = m_numAcquired.load();
+	statistics.allocations = m_numAllocations.load();
+	return statistics;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Types.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// Storage behind a Packet. Packets that copy each other share one buffer and the last one to let
+// go of it hands it back to the pool. The message is preceded by room for a stream frame header
+// so a packet can go out on TCP without being copied again.
+struct PacketBuffer {
+	static constexpr uint32 HEADER_SIZE = 4;
+	static constexpr uint32 DATA_SIZE = 512;
+
+	std::atomic<uint32> references;
+	PacketBuffer* next;
+	uint8 storage[HEADER_SIZE + DATA_SIZE];
+
+	uint8* getHeader() { return storage; }
+	uint8* getData() { return storage + HEADER_SIZE; }
+};
+
+struct PacketPoolStatistics {
+	uint64 acquired;		// Buffers handed out
+	uint64 allocations;		// Heap allocations made to grow the pool
+};
+
+// Free list of packet buffers, grown a slab at a time. Every thread keeps a few buffers of its own
+// so acquiring and releasing usually takes no lock.
+class PacketPool {
+private:
+	static constexpr uint32 SLAB_SIZE = 256;
+	static constexpr uint32 CACHE_SIZE = 64;
+
+	struct ThreadCache {
+		PacketBuffer* buffers;
+		uint32 count;
+
+		ThreadCache() : buffers(nullptr), count(0) {}
+		~ThreadCache();
+	};
+
+	static thread_local ThreadCache s_cache;
+
+	std::mutex m_lock;
+	PacketBuffer* m_freeBuffers;
+	std::vector<PacketBuffer*> m_slabs;
+
+	std::atomic<uint64> m_numAcquired;
+	std::atomic<uint64> m_numAllocations;
+
+	PacketPool();
+	~PacketPool();
+
+	void refill(ThreadCache& cache);
+	void spill(ThreadCache& cache, uint32 count);
+public:
+	// Buffers come back with a single reference
+	PacketBuffer* acquire();
+	void release(PacketBuffer* buffer);
+
+	PacketPoolStatistics getStatistics() const;
+
+	static PacketPool& get();
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+// Pulls in the native socket headers. On Windows this is Winsock, everywhere else the handful of
+// Winsock names NetCore relies on are mapped onto their BSD socket equivalents.
+
+#ifdef _WIN32
+
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+
+#include <Winsock2.h>
+#include <Ws2tcpip.h>
+#include <Windows.h>
+
+#else
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+
+typedef int SOCKET;
+
+static constexpr SOCKET INVALID_SOCKET = -1;
+static constexpr int SOCKET_ERROR = -1;
+
+#define SD_SEND SHUT_WR
+
+#define WSAEWOULDBLOCK EWOULDBLOCK
+#define WSAECONNRESET ECONNRESET
+#define WSAECONNABORTED ECONNABORTED
+#define WSAETIMEDOUT ETIMEDOUT
+#define WSAENOTCONN ENOTCONN
+#define WSAEMSGSIZE EMSGSIZE
+
+inline int closesocket(SOCKET socket) { return ::close(socket); }
+inline int WSAGetLastError() { return errno; }
+
+#endif
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "Types.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Bounded queue between any number of producers and a single consumer, preallocated and lock free
+// on both ends. Every entry is stamped with its position in the stream, so the consumer sees them
+// in one total order no matter how many threads pushed. Producers wait for room when it is full,
+// the consumer can block until something arrives.
+template<typename T>
+class SequenceRing {
+private:
+	struct Slot {
+		// Position + 1 once the entry is readable, position + capacity once it can be written again
+		std::atomic<uint64> sequence;
+		T value;
+	};
+
+	std::unique_ptr<Slot[]> m_slots;
+	uint64 m_mask;
+
+	// Producers and the consumer each write their own end, padded apart so they don't share a cache line
+	std::atomic<uint64> m_claimed;	// Next position handed to a producer
+	uint8 m_padding[64];
+	std::atomic<uint64> m_consumed;	// Next position the consumer reads, only it moves this
+
+	std::mutex m_sleepLock;
+	std::condition_variable m_dataAvailable;
+	std::atomic<bool> m_sleeping;
+	std::atomic<uint64> m_numFullWaits;
+public:
+	// Capacity is rounded up to a power of two
+	explicit SequenceRing(uint32 capacity) : m_claimed(0), m_consumed(0), m_sleeping(false), m_numFullWaits(0) {
+		uint64 size = 1;
+		while (size < capacity) {
+			size <<= 1;
+		}
+		m_slots.reset(new Slot[size]);
+		m_mask = size - 1;
+		for (uint64 i = 0; i < size; i++) {
+			m_slots[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	SequenceRing(const SequenceRing&) = delete;
+	SequenceRing& operator=(const SequenceRing&) = delete;
+
+	// Returns the entry's position in the stream
+	uint64 push(const T& value) {
+		uint64 position = m_claimed.load(std::memory_order_relaxed);
+		bool waited = false;
+		for (;;) {
+			Slot& slot = m_slots[position & m_mask];
+			const uint64 sequence = slot.sequence.load(std::memory_order_acquire);
+			const int64 difference = static_cast<int64>(sequence - position);
+			if (difference == 0) {
+				if (m_claimed.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+					slot.value = value;
+					slot.sequence.store(position + 1, std::memory_order_release);
+					break;
+				}
+			}
+			else if (difference < 0) {
+				// Full, wait for the consumer to catch up. Counted once per push, not per spin
+				if (!waited) {
+					waited = true;
+					m_numFullWaits++;
+				}
+				std::this_thread::yield();
+				position = m_claimed.load(std::memory_order_relaxed);
+			}
+			else {
+				position = m_claimed.load(std::memory_order_relaxed);
+			}
+		}
+
+		// Paired with the consumer announcing it is going to sleep before its last look
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (m_sleeping.load()) {
+			std::lock_guard<std::mutex> lock(m_sleepLock);
+			m_dataAvailable.notify_one();
+		}
+		return position;
+	}
+
+	// Consumer only
+	bool pop(T& value) {
+		const uint64 position = m_consumed.load(std::memory_order_relaxed);
+		Slot& slot = m_slots[position & m_mask];
+		if (slot.sequence.load(std::memory_order_acquire) != position + 1) {
+			return false;
+		}
+
+		value = slot.value;
+		slot.value = T();
+		slot.sequence.store(position + m_mask + 1, std::memory_order_release);
+		m_consumed.store(position + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// Consumer only, returns once an entry is ready to pop or the timeout passed
+	void wait(std::chrono::microseconds timeout) {
+		std::unique_lock<std::mutex> lock(m_sleepLock);
+		m_sleeping.store(true);
+		const uint64 position = m_consumed.load(std::memory_order_relaxed);
+		if (m_slots[position & m_mask].sequence.load() != position + 1) {
+			m_dataAvailable.wait_for(lock, timeout);
+		}
+		m_sleeping.store(false);
+	}
+
+	// Wakes the consumer without handing it anything
+	void wake() {
+		std::lock_guard<std::mutex> lock(m_sleepLock);
+		m_dataAvailable.notify_one();
+	}
+
+	uint64 getPushed() const { return m_claimed; }
+	uint64 getConsumed() const { return m_consumed; }
+	uint64 getNumFullWaits() const { return m_numFullWaits; }
+};
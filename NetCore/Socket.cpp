@@ -1,13 +1,21 @@
 #include "Socket.h"
 
 #include <stdexcept>
-#include <ws2tcpip.h>
+#include <cstring>
+#include <cstdio>
+#include "CompletionPort.h"
 #include "Error.h"
 
 Socket::Socket(SOCKET winSocket)
-	: _winSocket(winSocket) {}
-
-Socket::Socket(SOCKET_TYPE type, bool overlapped) {
+	: _winSocket(winSocket)
+	, _completionPort(nullptr)
+	, _completionKey(0)
+{}
+
+Socket::Socket(SOCKET_TYPE type, bool overlapped)
+	: _completionPort(nullptr)
+	, _completionKey(0)
+{
 	//addrinfo hints;
 	//ZeroMemory(&hints, sizeof(hints));
 	//hints.ai_family = AF_INET;
@@ -33,7 +41,12 @@ Socket::Socket(SOCKET_TYPE type, bool overlapped) {
 	//}
 
 	//_winSocket = socket(AF_INET, sockType, protocol);
+#ifdef _WIN32
 	_winSocket = WSASocketW(AF_INET, sockType, protocol, nullptr, 0, (overlapped) ? WSA_FLAG_OVERLAPPED : 0);
+#else
+	// Any socket can be driven by epoll, overlapped only matters to Winsock
+	_winSocket = socket(AF_INET, sockType | SOCK_CLOEXEC, protocol);
+#endif
 	if (_winSocket == INVALID_SOCKET) {
 		int errorCode = WSAGetLastError();
 		printf("%s", getWSAErrorString(errorCode).c_str());
@@ -41,14 +54,24 @@ Socket::Socket(SOCKET_TYPE type, bool overlapped) {
 	}
 }
 
-Socket::Socket(Socket&& sock) : _winSocket(sock._winSocket) {
+Socket::Socket(Socket&& sock)
+	: _winSocket(sock._winSocket)
+	, _completionPort(sock._completionPort)
+	, _completionKey(sock._completionKey)
+{
 	sock._winSocket = INVALID_SOCKET;
+	sock._completionPort = nullptr;
+	sock._completionKey = 0;
 }
 
 Socket& Socket::operator=(Socket&& sock) {
-	closesocket(_winSocket);
+	close();
 	_winSocket = sock._winSocket;
+	_completionPort = sock._completionPort;
+	_completionKey = sock._completionKey;
 	sock._winSocket = INVALID_SOCKET;
+	sock._completionPort = nullptr;
+	sock._completionKey = 0;
 	return *this;
 }
 
@@ -61,12 +84,39 @@ void Socket::bind(const IPV4Address& address) {
 }
 
 void Socket::setTimeout(uint32 ms) {
-	setsockopt(_winSocket, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(ms), sizeof(uint32));
+#ifdef _WIN32
+	DWORD timeout = ms;
+#else
+	timeval timeout;
+	timeout.tv_sec = ms / 1000;
+	timeout.tv_usec = (ms % 1000) * 1000;
+#endif
+	setsockopt(_winSocket, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+}
+
+void Socket::setReceiveBufferSize(uint32 size) {
+	int32 bufferSize = static_cast<int32>(size);
+	setsockopt(_winSocket, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char*>(&bufferSize), sizeof(bufferSize));
 }
 
+#ifndef _WIN32
+void Socket::setReusePort(bool reuse) {
+	int32 value = reuse ? 1 : 0;
+	if (setsockopt(_winSocket, SOL_SOCKET, SO_REUSEPORT, &value, sizeof(value)) == SOCKET_ERROR) {
+		int32 errorCode = WSAGetLastError();
+		throw errorCode;
+	}
+}
+#endif
+
 void Socket::setBlocking(bool blocking) {
+#ifdef _WIN32
 	uint64 arg = (blocking) ? 0 : 1;
 	int32 status = ioctlsocket(_winSocket, FIONBIO, (u_long*)&arg);
+#else
+	int32 flags = fcntl(_winSocket, F_GETFL, 0);
+	int32 status = (flags == -1) ? -1 : fcntl(_winSocket, F_SETFL, (blocking) ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK));
+#endif
 	if (status == SOCKET_ERROR) {
 		int errorCode = WSAGetLastError();
 		printf("%s", getWSAErrorString(errorCode).c_str());
@@ -80,20 +130,32 @@ Socket::~Socket() {
 
 void Socket::close() {
 	if (_winSocket != INVALID_SOCKET) {
+		if (_completionPort != nullptr) {
+			_completionPort->dissociate(*this);
+			_completionPort = nullptr;
+			_completionKey = 0;
+		}
 		closesocket(_winSocket);
 		_winSocket = INVALID_SOCKET;
 	}
 }
 
+CompletionPort& Socket::getAssociatedPort() const {
+	if (_completionPort == nullptr) {
+		throw std::runtime_error("Socket is not associated with a completion port");
+	}
+	return *_completionPort;
+}
+
 bool Socket::canReceive() const {
-	TIMEVAL timeVal;
-	ZeroMemory(&timeVal, sizeof(TIMEVAL));
+	timeval timeVal;
+	memset(&timeVal, 0, sizeof(timeval));
 
 	fd_set set;
 	FD_ZERO(&set);
 	FD_SET(_winSocket, &set);
 
-	int32 result = select(0, &set, NULL, NULL, &timeVal);
+	int32 result = select(static_cast<int32>(_winSocket) + 1, &set, NULL, NULL, &timeVal);
 	if (result == SOCKET_ERROR) {
 		int errorCode = WSAGetLastError();
 		printf("%s", getWSAErrorString(errorCode).c_str());
@@ -104,14 +166,14 @@ bool Socket::canReceive() const {
 }
 
 bool Socket::canSend() const {
-	TIMEVAL timeVal;
-	ZeroMemory(&timeVal, sizeof(TIMEVAL));
+	timeval timeVal;
+	memset(&timeVal, 0, sizeof(timeval));
 
 	fd_set set;
 	FD_ZERO(&set);
 	FD_SET(_winSocket, &set);
 
-	int32 result = select(0, NULL, &set, NULL, &timeVal);
+	int32 result = select(static_cast<int32>(_winSocket) + 1, NULL, &set, NULL, &timeVal);
 	if (result == SOCKET_ERROR) {
 		int errorCode = WSAGetLastError();
 		printf("%s", getWSAErrorString(errorCode).c_str());
@@ -1,8 +1,6 @@
 #pragma once
 
-#define NOMINMAX
-
-#include <Winsock2.h>
+#include "Platform.h"
 #include "Types.h"
 #include "Packet.h"
 #include "IPV4Address.h"
@@ -12,7 +10,12 @@
 
 static constexpr char DEFAULT_PORT[] = "18081";
 
+class CompletionPort;
+
 class Socket {
+	friend class IOCPCompletionPort;
+	friend class EpollCompletionPort;
+	friend class URingCompletionPort;
 public:
 	enum class SOCKET_TYPE
 	{
@@ -33,6 +36,12 @@ public:
 	virtual void receiveOverlapped(OverlappedBuffer& overlappedBuffer) = 0;
 	
 	void setTimeout(uint32 ms);
+	void setReceiveBufferSize(uint32 size);
+#ifndef _WIN32
+	// Lets several sockets bind the same port, the kernel spreads traffic between them. Must be
+	// set before bind.
+	void setReusePort(bool reuse);
+#endif
 	void setBlocking(bool blocking);
 
 	bool canReceive() const;
@@ -40,11 +49,20 @@ public:
 
 	Socket& operator=(Socket&& sock);
 
+#ifdef _WIN32
 	HANDLE getWinSockHandle() { return reinterpret_cast<HANDLE>(_winSocket); }
+#endif
 	SOCKET getWinSockSocket() { return _winSocket; }
 
+	CompletionPort* getCompletionPort() const { return _completionPort; }
+
 	void close();
 protected:
 	SOCKET _winSocket;
-};
 
+	// Set while the socket is associated with a completion port
+	CompletionPort* _completionPort;
+	uintptr _completionKey;
+
+	CompletionPort& getAssociatedPort() const;
+};
@@ -1,9 +1,13 @@
 #include "TCPSocket.h"
 
 #include "OverlappedBuffer.h"
+#include "CompletionPort.h"
+#include "FrameReader.h"
 #include "Error.h"
 
+#ifdef _WIN32
 #include <Mswsock.h>
+#endif
 #include <iostream>
 
 TCPSocket::TCPSocket(bool overlapped) : Socket(Socket::SOCKET_TYPE::TCP, overlapped) {}
@@ -18,33 +22,55 @@ TCPSocket& TCPSocket::operator=(TCPSocket&& sock) {
 }
 
 void TCPSocket::send(const Packet& packet) {
-	if (::send(_winSocket, reinterpret_cast<const char*>(packet.getMessageData()), packet.getMessageSize(), 0) == SOCKET_ERROR) {
-		int32 errorCode = WSAGetLastError();
-		throw errorCode;
+	// Packets carry their frame header in front of the message
+	if (_completionPort != nullptr && _completionPort->send(*this, packet)) {
+		return;
+	}
+
+	uint32 numBytesSent = 0;
+	while (numBytesSent < packet.getFrameSize()) {
+		int32 result = ::send(_winSocket, reinterpret_cast<const char*>(packet.getFrameData()) + numBytesSent, packet.getFrameSize() - numBytesSent, 0);
+		if (result == SOCKET_ERROR) {
+			int32 errorCode = WSAGetLastError();
+			throw errorCode;
+		}
+		numBytesSent += result;
 	}
 }
 
 Packet TCPSocket::receive() {
-	uint8* buffer = new uint8[Packet::PACKET_SIZE];
+	uint8 header[FrameReader::HEADER_SIZE];
+	receiveExactly(header, FrameReader::HEADER_SIZE);
 
-	int32 numBytesreceived = recv(_winSocket, reinterpret_cast<char*>(buffer), Packet::PACKET_SIZE, 0);
-	if (numBytesreceived == 0) {
-		delete[] buffer;
-		// Connection was shutdown
-		throw 0;
-	}
-	else if (numBytesreceived == SOCKET_ERROR) {
-		delete[] buffer;
-		int32 errorCode = WSAGetLastError();
-		throw errorCode;
+	uint32 messageSize = FrameReader::readHeader(header);
+	if (messageSize == 0 || messageSize > FrameReader::MAX_MESSAGE_SIZE) {
+		// Can't find the next frame anymore, treat it like a broken connection
+		throw static_cast<int32>(WSAECONNABORTED);
 	}
 
-	Packet packet(buffer, numBytesreceived);
+	Packet packet;
+	receiveExactly(packet.prepareWrite(), messageSize);
+	packet.setMessageSize(messageSize);
 
-	delete[] buffer;
 	return packet;
 }
 
+void TCPSocket::receiveExactly(uint8* buffer, uint32 size) {
+	uint32 numBytesReceived = 0;
+	while (numBytesReceived < size) {
+		int32 result = recv(_winSocket, reinterpret_cast<char*>(buffer) + numBytesReceived, size - numBytesReceived, 0);
+		if (result == 0) {
+			// Connection was shutdown
+			throw 0;
+		}
+		else if (result == SOCKET_ERROR) {
+			int32 errorCode = WSAGetLastError();
+			throw errorCode;
+		}
+		numBytesReceived += result;
+	}
+}
+
 void TCPSocket::listen() {
 	if (::listen(_winSocket, SOMAXCONN) == SOCKET_ERROR) {
 		int32 errorCode = WSAGetLastError();
@@ -61,29 +87,23 @@ TCPSocket TCPSocket::accept() {
 	return { clientSocket };
 }
 
-TCPSocket TCPSocket::acceptOverlapped(OverlappedBuffer& overlappedBuffer) {
-	TCPSocket clientSocket(true);
-
-	uint8* receiveData = new uint8[Packet::PACKET_SIZE];
-	DWORD bytesReceived = 0;
-	bool result = AcceptEx(
-		_winSocket,
-		clientSocket._winSocket,
-		receiveData,
-		0,
-		128,
-		128,
-		&bytesReceived,
-		&overlappedBuffer.m_overlapped
-	);
-	//delete[] receiveData;
-	
-	if (!result) {
+void TCPSocket::acceptOverlapped(OverlappedBuffer& overlappedBuffer) {
+	getAssociatedPort().accept(*this, overlappedBuffer);
+}
+
+TCPSocket TCPSocket::completeAccept(OverlappedBuffer& overlappedBuffer) {
+	TCPSocket clientSocket(overlappedBuffer.m_acceptSocket);
+	overlappedBuffer.m_acceptSocket = INVALID_SOCKET;
+
+#ifdef _WIN32
+	// AcceptEx leaves the socket without the listener's properties until this is set
+	SOCKET listenSocket = _winSocket;
+	int32 result = setsockopt(clientSocket._winSocket, SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT, reinterpret_cast<char*>(&listenSocket), sizeof(listenSocket));
+	if (result == SOCKET_ERROR) {
 		int32 error = WSAGetLastError();
-		if (error != ERROR_IO_PENDING) {
-			throw error;
-		}
+		throw error;
 	}
+#endif
 
 	return clientSocket;
 }
@@ -104,7 +124,7 @@ void TCPSocket::shutdown() {
 
 IPV4Address TCPSocket::getPeerAddress() const {
 	sockaddr_in sockAddress;
-	int32 sockAddressSize = sizeof(sockaddr_in);
+	socklen_t sockAddressSize = sizeof(sockaddr_in);
 	int32 result = getpeername(_winSocket, reinterpret_cast<sockaddr*>(&sockAddress), &sockAddressSize);
 	if (result == SOCKET_ERROR) {
 		int32 error = WSAGetLastError();
@@ -114,20 +134,28 @@ IPV4Address TCPSocket::getPeerAddress() const {
 	return IPV4Address(sockAddress);
 }
 
-void TCPSocket::receiveOverlapped(OverlappedBuffer& overlappedBuffer) {
-	int32 status = WSARecv(
-		_winSocket,
-		&overlappedBuffer.m_WSAbuffer,
-		1,
-		NULL,
-		reinterpret_cast<LPDWORD>(&overlappedBuffer.m_flags),
-		&overlappedBuffer.m_overlapped,
-		NULL
-	);
-	if (status == SOCKET_ERROR) {
+uint32 TCPSocket::getConnectedTime() const {
+#ifdef _WIN32
+	DWORD seconds = 0;
+	int32 size = sizeof(seconds);
+	if (getsockopt(_winSocket, SOL_SOCKET, SO_CONNECT_TIME, reinterpret_cast<char*>(&seconds), &size) == SOCKET_ERROR) {
 		int32 error = WSAGetLastError();
-		if (error != WSA_IO_PENDING) {
-			throw error;
-		}
+		throw error;
+	}
+	return (seconds == 0xFFFFFFFF) ? 0 : seconds * 1000;
+#else
+	// The last ACK received on a connection that has not sent anything yet is the one that
+	// completed the handshake
+	tcp_info info;
+	socklen_t size = sizeof(info);
+	if (getsockopt(_winSocket, IPPROTO_TCP, TCP_INFO, &info, &size) == SOCKET_ERROR) {
+		int32 error = WSAGetLastError();
+		throw error;
 	}
+	return info.tcpi_last_ack_recv;
+#endif
+}
+
+void TCPSocket::receiveOverlapped(OverlappedBuffer& overlappedBuffer) {
+	getAssociatedPort().receive(*this, overlappedBuffer);
 }
\ No newline at end of file
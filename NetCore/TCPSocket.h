@@ -5,6 +5,8 @@
 class OverlappedBuffer;
 
 class TCPSocket : public Socket {
+private:
+	void receiveExactly(uint8* buffer, uint32 size);
 public:
 	TCPSocket(bool overlapped = false);
 	TCPSocket(SOCKET socket);
@@ -16,18 +18,23 @@ public:
 	void listen();
 	TCPSocket accept();
 
-	TCPSocket acceptOverlapped(OverlappedBuffer& overlappedBuffer);
+	// Issues an asynchronous accept, once it completes the new socket is claimed with completeAccept
+	void acceptOverlapped(OverlappedBuffer& overlappedBuffer);
+	TCPSocket completeAccept(OverlappedBuffer& overlappedBuffer);
 
 	// Clientside
 	void connect(const IPV4Address& address);
 	void shutdown();
 
-	// Hybrid
+	// Hybrid, messages are framed with their length so they can be told apart on the stream
 	virtual void send(const Packet& packet) override;
 	virtual Packet receive() override;
 
 	virtual void receiveOverlapped(OverlappedBuffer& overlappedBuffer) override;
 
 	IPV4Address getPeerAddress() const;
+	// Milliseconds since the connection was established, as precise as the kernel's clock tick on
+	// Linux and in whole seconds on Windows
+	uint32 getConnectedTime() const;
 };
 
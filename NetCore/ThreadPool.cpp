@@ -1,51 +1,213 @@
 #include "ThreadPool.h"
 
-#include <iostream>
-#include <string>
+#include "Clock.h"
+
+#include <chrono>
 
 ThreadPool* ThreadPool::s_instance = nullptr;
+thread_local ThreadPool::Worker* ThreadPool::s_currentWorker = nullptr;
+
+ThreadPool::ThreadPool() :
+	m_nextWorker(0)
+	, m_running(true)
+	, m_numQueued(0)
+	, m_numSleeping(0)
+	, m_numExecuted(0)
+	, m_numStolen(0)
+	, m_numSleeps(0)
+{
+	uint32 numWorkers = std::thread::hardware_concurrency();
+	if (numWorkers == 0) {
+		numWorkers = 4;
+	}
 
-ThreadPool::ThreadPool() {
-	m_pool = CreateThreadpool(NULL);
-	SetThreadpoolThreadMinimum(m_pool, 300);
-	SetThreadpoolThreadMaximum(m_pool, 500);
+	// Every queue exists before any worker starts looking for something to steal
+	for (uint32 i = 0; i < numWorkers; i++) {
+		m_workers.push_back(new Worker());
+	}
+	for (uint32 i = 0; i < numWorkers; i++) {
+		m_workerThreads.emplace_back(&ThreadPool::workerRoutine, this, i);
+	}
+	m_timerThread = std::thread(&ThreadPool::timerRoutine, this);
+}
 
-	InitializeThreadpoolEnvironment(&m_callbackEnvironment);
+ThreadPool::~ThreadPool() {
+	m_running = false;
+	{
+		std::lock_guard<std::mutex> lock(m_idleLock);
+		m_workAvailable.notify_all();
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_timerLock);
+		m_timers.clear();
+		m_timersChanged.notify_all();
+	}
 
-	m_cleanUpGroup = CreateThreadpoolCleanupGroup();
+	for (std::thread& thread : m_workerThreads) {
+		thread.join();
+	}
+	m_timerThread.join();
 
-	SetThreadpoolCallbackPool(&m_callbackEnvironment, m_pool);
-	SetThreadpoolCallbackCleanupGroup(&m_callbackEnvironment, m_cleanUpGroup, NULL);
+	// Service loops are expected to have been told to stop by now
+	joinLongRunning();
+
+	for (Worker* worker : m_workers) {
+		delete worker;
+	}
 }
 
-ThreadPool::~ThreadPool() {
-	CloseThreadpoolCleanupGroupMembers(m_cleanUpGroup, TRUE, NULL);
-	CloseThreadpoolCleanupGroup(m_cleanUpGroup);
-	CloseThreadpool(m_pool);
-	DestroyThreadpoolEnvironment(&m_callbackEnvironment);
+void ThreadPool::push(Worker& worker, const Task& task, bool external) {
+	// Counted before it is visible so a worker that finds it can never take the count below zero
+	m_numQueued++;
+	{
+		std::lock_guard<std::mutex> lock(worker.lock);
+		if (external) {
+			worker.inbox.push_back(task);
+		}
+		else {
+			worker.tasks.push_back(task);
+		}
+	}
+
+	if (m_numSleeping > 0) {
+		std::lock_guard<std::mutex> lock(m_idleLock);
+		m_workAvailable.notify_one();
+	}
 }
 
-PTP_WORK ThreadPool::submit(ThreadExecutionFunc func, void* ptr) {
-	PTP_WORK workObject = CreateThreadpoolWork(func, ptr, &m_callbackEnvironment);
+bool ThreadPool::take(Worker& worker, Task& task) {
+	std::lock_guard<std::mutex> lock(worker.lock);
+	// Every so often the inbox goes first, so outside work can't sit behind a worker that keeps spawning
+	const bool inboxFirst = (++worker.numTaken % INBOX_INTERVAL) == 0;
+	if (!worker.tasks.empty() && !(inboxFirst && !worker.inbox.empty())) {
+		task = worker.tasks.back();
+		worker.tasks.pop_back();
+	}
+	else if (!worker.inbox.empty()) {
+		task = worker.inbox.front();
+		worker.inbox.pop_front();
+	}
+	else {
+		return false;
+	}
 
-	SubmitThreadpoolWork(workObject);
+	m_numQueued--;
+	return true;
+}
+
+bool ThreadPool::steal(uint32 thief, Task& task) {
+	const uint32 numWorkers = static_cast<uint32>(m_workers.size());
+	for (uint32 i = 1; i < numWorkers; i++) {
+		Worker& victim = *m_workers[(thief + i) % numWorkers];
+
+		// Oldest first, outside work has waited longest and isn't hot for the victim anyway
+		std::lock_guard<std::mutex> lock(victim.lock);
+		std::deque<Task>& tasks = victim.inbox.empty() ? victim.tasks : victim.inbox;
+		if (!tasks.empty()) {
+			task = tasks.front();
+			tasks.pop_front();
+			m_numQueued--;
+			m_numStolen++;
+			return true;
+		}
+	}
 
-	return workObject;
+	return false;
 }
 
-PTP_TIMER ThreadPool::submitTimer(TimerCallback func, void* ptr, uint64 auctionTime) {
-	PTP_TIMER timerObject = CreateThreadpoolTimer(func, ptr, &m_callbackEnvironment);
+void ThreadPool::submit(ThreadExecutionFunc func, void* ptr) {
+	const Task task{ func, ptr };
 
-	FILETIME fileTime;
-	GetSystemTimeAsFileTime(&fileTime);
-	ULARGE_INTEGER* time = reinterpret_cast<ULARGE_INTEGER*>(&fileTime);
-	time->QuadPart += auctionTime;
+	Worker* current = s_currentWorker;
+	if (current != nullptr) {
+		// Spawned by a running task, likely to use what that task just touched
+		push(*current, task, false);
+	}
+	else {
+		// The inbox runs in the order tasks came in, behind whatever the worker spawned itself
+		push(*m_workers[m_nextWorker++ % m_workers.size()], task, true);
+	}
+}
 
-	SetThreadpoolTimer(timerObject, &fileTime, 0, 0);
+void ThreadPool::submitLongRunning(ThreadExecutionFunc func, void* ptr) {
+	std::lock_guard<std::mutex> lock(m_longRunningLock);
+	m_longRunningThreads.emplace_back(func, ptr);
+}
 
-	return timerObject;
+void ThreadPool::joinLongRunning() {
+	std::lock_guard<std::mutex> lock(m_longRunningLock);
+	for (std::thread& thread : m_longRunningThreads) {
+		thread.join();
+	}
+	m_longRunningThreads.clear();
+}
+
+void ThreadPool::submitTimer(TimerCallback func, void* ptr, uint64 delay) {
+	{
+		std::lock_guard<std::mutex> lock(m_timerLock);
+		m_timers.insert(std::make_pair(getMonotonicTime() + delay, Task{ func, ptr }));
+	}
+	m_timersChanged.notify_one();
 }
 
 void ThreadPool::clean() {
-	CloseThreadpoolCleanupGroupMembers(m_cleanUpGroup, FALSE, NULL);
+	for (Worker* worker : m_workers) {
+		std::lock_guard<std::mutex> lock(worker->lock);
+		m_numQueued -= static_cast<uint32>(worker->tasks.size() + worker->inbox.size());
+		worker->tasks.clear();
+		worker->inbox.clear();
+	}
+
+	std::lock_guard<std::mutex> lock(m_timerLock);
+	m_timers.clear();
+}
+
+ThreadPoolStatistics ThreadPool::getStatistics() const {
+	return ThreadPoolStatistics{ m_numExecuted, m_numStolen, m_numSleeps };
+}
+
+void ThreadPool::workerRoutine(uint32 index) {
+	Worker& worker = *m_workers[index];
+	s_currentWorker = &worker;
+
+	while (m_running) {
+		Task task;
+		if (take(worker, task) || steal(index, task)) {
+			task.func(task.parameter);
+			m_numExecuted++;
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_idleLock);
+		m_numSleeping++;
+		if (m_numQueued == 0 && m_running) {
+			m_numSleeps++;
+			m_workAvailable.wait(lock);
+		}
+		m_numSleeping--;
+	}
+}
+
+void ThreadPool::timerRoutine() {
+	std::unique_lock<std::mutex> lock(m_timerLock);
+	while (m_running) {
+		if (m_timers.empty()) {
+			m_timersChanged.wait(lock);
+			continue;
+		}
+
+		uint64 now = getMonotonicTime();
+		auto first = m_timers.begin();
+		if (first->first > now) {
+			m_timersChanged.wait_for(lock, std::chrono::microseconds((first->first - now) / 10));
+			continue;
+		}
+
+		// Expired timers run on the workers so a slow callback does not hold up the others
+		const Task task = first->second;
+		m_timers.erase(first);
+		lock.unlock();
+		submit(task.func, task.parameter);
+		lock.lock();
+	}
 }
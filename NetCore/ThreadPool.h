@@ -1,32 +1,100 @@
 #pragma once
 
-#include <Winsock2.h>
-#include <Windows.h>
 #include "Types.h"
 
-typedef VOID (CALLBACK *ThreadExecutionFunc)(PTP_CALLBACK_INSTANCE instance, PVOID parameter, PTP_WORK work);
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
 
-typedef VOID (CALLBACK *TimerCallback)(PTP_CALLBACK_INSTANCE instance, PVOID context, PTP_TIMER timer);
+typedef void (*ThreadExecutionFunc)(void* parameter);
 
+typedef void (*TimerCallback)(void* parameter);
 
+struct ThreadPoolStatistics {
+	uint64 executed;
+	uint64 stolen;		// Tasks a worker took from another worker's queue
+	uint64 sleeps;		// Times a worker found nothing to do and blocked
+};
+
+// Work stealing pool with one worker per hardware thread. Every worker has its own queue, tasks
+// submitted from a worker go on its own queue and run newest first while they are still hot.
+// Tasks from other threads are spread over the workers' inboxes, which run oldest first when the
+// worker's own queue is empty and periodically ahead of it. A worker that runs dry takes the
+// oldest task from another worker, inbox first, before going to sleep. Service loops get threads
+// of their own so they never hold up a worker, and timers are kept by a single thread that hands
+// them to the workers.
 class ThreadPool {
 private:
+	struct Task {
+		ThreadExecutionFunc func;
+		void* parameter;
+	};
+
+	struct Worker {
+		std::mutex lock;
+		std::deque<Task> tasks;	// Spawned by the worker's own tasks, newest at the back
+		std::deque<Task> inbox;	// Submitted from outside the pool, in arrival order
+		uint32 numTaken = 0;
+	};
+
+	static constexpr uint32 INBOX_INTERVAL = 8;	// The owner checks its inbox first on every this many takes
+
 	static ThreadPool* s_instance;
+	static thread_local Worker* s_currentWorker;
+
+	std::vector<Worker*> m_workers;
+	std::vector<std::thread> m_workerThreads;
+	std::atomic<uint32> m_nextWorker;	// Where the next task from outside the pool goes
+	std::atomic<bool> m_running;
+
+	// Workers with nothing to do sleep here. m_numQueued is raised before a submit checks for
+	// sleepers and a worker counts itself as sleeping before its last look, so no wake up is lost.
+	std::mutex m_idleLock;
+	std::condition_variable m_workAvailable;
+	std::atomic<uint32> m_numQueued;
+	std::atomic<uint32> m_numSleeping;
+
+	std::mutex m_timerLock;
+	std::condition_variable m_timersChanged;
+	std::multimap<uint64, Task> m_timers;
+	std::thread m_timerThread;
+
+	std::mutex m_longRunningLock;
+	std::vector<std::thread> m_longRunningThreads;
+
+	std::atomic<uint64> m_numExecuted;
+	std::atomic<uint64> m_numStolen;
+	std::atomic<uint64> m_numSleeps;
+
+	void push(Worker& worker, const Task& task, bool external);
+	bool take(Worker& worker, Task& task);
+	bool steal(uint32 thief, Task& task);
+
+	void workerRoutine(uint32 index);
+	void timerRoutine();
 
-	PTP_POOL m_pool;
-	TP_CALLBACK_ENVIRON m_callbackEnvironment;
-	PTP_CLEANUP_GROUP m_cleanUpGroup;
-	
 	ThreadPool();
 public:
 	virtual ~ThreadPool();
 
-	PTP_WORK submit(ThreadExecutionFunc func, void* ptr);
-	PTP_TIMER submitTimer(TimerCallback func, void* ptr, uint64 auctionTime = 3000000000ull);
+	void submit(ThreadExecutionFunc func, void* ptr);
+	// For service loops that block for the lifetime of the server
+	void submitLongRunning(ThreadExecutionFunc func, void* ptr);
+	// Calls func once after delay, in 100 nanosecond ticks
+	void submitTimer(TimerCallback func, void* ptr, uint64 delay);
+	// Waits for every service loop to return, they have to have been told to stop
+	void joinLongRunning();
+	// Drops tasks and timers that haven't started yet
 	void clean();
 
+	uint32 getNumWorkers() const { return static_cast<uint32>(m_workers.size()); }
+	ThreadPoolStatistics getStatistics() const;
+
 	static void init() { s_instance = new ThreadPool(); }
 	static void destroy() { delete s_instance; }
 	static ThreadPool* get() { return s_instance; }
 };
-
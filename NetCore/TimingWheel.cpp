@@ -0,0 +1,101 @@
+#include "TimingWheel.h"
+
+TimingWheel::TimingWheel(uint64 startTick) : m_currentTick(startTick), m_size(0) {
+	for (uint32 level = 0; level < LEVEL_COUNT; level++) {
+		for (uint32 slot = 0; slot < SLOT_COUNT; slot++) {
+			m_slots[level][slot].prev = &m_slots[level][slot];
+			m_slots[level][slot].next = &m_slots[level][slot];
+		}
+	}
+}
+
+void TimingWheel::insert(WheelTimer& timer) {
+	// Cascading timers can be due on the current tick, whose slot is about to be emptied
+	const uint64 deadline = timer.deadline;
+	const uint64 delta = deadline - m_currentTick;
+
+	uint32 level = 0;
+	while (level < LEVEL_COUNT - 1 && delta >= (1ull << (LEVEL_BITS * (level + 1)))) {
+		level++;
+	}
+
+	// Too far out for the top level, park it in the last slot it can reach and sort it out later
+	uint64 placement = deadline;
+	const uint64 maxDelta = (1ull << (LEVEL_BITS * LEVEL_COUNT)) - 1;
+	if (delta > maxDelta) {
+		placement = m_currentTick + maxDelta;
+	}
+
+	WheelTimer& slot = m_slots[level][(placement >> (LEVEL_BITS * level)) & (SLOT_COUNT - 1)];
+	timer.next = &slot;
+	timer.prev = slot.prev;
+	slot.prev->next = &timer;
+	slot.prev = &timer;
+}
+
+void TimingWheel::cascade(uint32 level) {
+	WheelTimer& slot = m_slots[level][(m_currentTick >> (LEVEL_BITS * level)) & (SLOT_COUNT - 1)];
+
+	// Detach the whole slot first, its timers land in lower levels or back in this one
+	WheelTimer* timer = slot.next;
+	slot.prev = &slot;
+	slot.next = &slot;
+	while (timer != &slot) {
+		WheelTimer* next = timer->next;
+		insert(*timer);
+		timer = next;
+	}
+}
+
+void TimingWheel::schedule(WheelTimer& timer, uint64 deadline) {
+	// The current tick's slot has already been emptied, the earliest a new timer can fire is the next
+	timer.deadline = (deadline > m_currentTick) ? deadline : m_currentTick + 1;
+	insert(timer);
+	m_size++;
+}
+
+void TimingWheel::cancel(WheelTimer& timer) {
+	if (!timer.isScheduled()) {
+		return;
+	}
+
+	timer.prev->next = timer.next;
+	timer.next->prev = timer.prev;
+	timer.prev = nullptr;
+	timer.next = nullptr;
+	m_size--;
+}
+
+void TimingWheel::reschedule(WheelTimer& timer, uint64 deadline) {
+	cancel(timer);
+	schedule(timer, deadline);
+}
+
+void TimingWheel::advance(uint64 tick, std::vector<WheelTimer*>& expired) {
+	while (m_currentTick < tick) {
+		if (m_size == 0) {
+			// Nothing to cascade or fire, skip straight ahead
+			m_currentTick = tick;
+			return;
+		}
+
+		m_currentTick++;
+
+		// Crossing into a new slot of a higher level brings its timers down, highest level first
+		// so whatever it hands down is in place before the level below is cascaded
+		uint32 topLevel = 0;
+		while (topLevel < LEVEL_COUNT - 1 && (m_currentTick & ((1ull << (LEVEL_BITS * (topLevel + 1))) - 1)) == 0) {
+			topLevel++;
+		}
+		for (uint32 level = topLevel; level > 0; level--) {
+			cascade(level);
+		}
+
+		WheelTimer& slot = m_slots[0][m_currentTick & (SLOT_COUNT - 1)];
+		while (slot.next != &slot) {
+			WheelTimer* timer = slot.next;
+			cancel(*timer);
+			expired.push_back(timer);
+		}
+	}
+}
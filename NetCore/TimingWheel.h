@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Types.h"
+
+#include <vector>
+
+// Embedded in whatever is being timed. Copying a timer gives an unscheduled one.
+struct WheelTimer {
+	WheelTimer* prev;
+	WheelTimer* next;
+	uint64 deadline;	// In wheel ticks
+	void* context;
+
+	WheelTimer() : prev(nullptr), next(nullptr), deadline(0), context(nullptr) {}
+	WheelTimer(const WheelTimer& other) : prev(nullptr), next(nullptr), deadline(0), context(other.context) {}
+	WheelTimer& operator=(const WheelTimer& other) { context = other.context; return *this; }
+
+	bool isScheduled() const { return prev != nullptr; }
+};
+
+// Hierarchical timing wheel. Each level has 256 slots covering 256 times the span of the level
+// below, so four levels reach 2^32 ticks ahead and anything further waits in the top level until
+// it comes into range. Scheduling and cancelling are O(1), a timer moves down a level at most
+// three times before it fires. Not thread safe, the owner serializes access.
+class TimingWheel {
+private:
+	static constexpr uint32 LEVEL_BITS = 8;
+	static constexpr uint32 SLOT_COUNT = 1 << LEVEL_BITS;
+	static constexpr uint32 LEVEL_COUNT = 4;
+
+	// Slots are circular lists around a sentinel
+	WheelTimer m_slots[LEVEL_COUNT][SLOT_COUNT];
+
+	uint64 m_currentTick;
+	uint32 m_size;
+
+	void insert(WheelTimer& timer);
+	void cascade(uint32 level);
+public:
+	explicit TimingWheel(uint64 startTick = 0);
+
+	// Deadlines already passed fire on the next advance
+	void schedule(WheelTimer& timer, uint64 deadline);
+	void cancel(WheelTimer& timer);
+	void reschedule(WheelTimer& timer, uint64 deadline);
+
+	// Moves up to the given tick and appends every timer that came due, in deadline order
+	void advance(uint64 tick, std::vector<WheelTimer*>& expired);
+
+	uint64 getCurrentTick() const { return m_currentTick; }
+	uint32 getSize() const { return m_size; }
+};
@@ -15,4 +15,6 @@ typedef int64_t int64;
 typedef uint64_t uint64;
 
 typedef float float32;
-typedef double float64;
\ No newline at end of file
+typedef double float64;
+
+typedef uintptr_t uintptr;
\ No newline at end of file
@@ -1,14 +1,21 @@
 #include "UDPSocket.h"
 
 #include <iostream>
-#include <Ws2tcpip.h>
+#include <algorithm>
 
 #include "OverlappedBuffer.h"
+#include "CompletionPort.h"
 #include "Error.h"
 
+constexpr uint32 UDPSocket::BATCH_SIZE;
+
 UDPSocket::UDPSocket(bool overlapped) : Socket(Socket::SOCKET_TYPE::UDP, overlapped) {}
 
 void UDPSocket::send(const Packet& packet) {
+	if (_completionPort != nullptr && _completionPort->send(*this, packet)) {
+		return;
+	}
+
 	const sockaddr* sockAddr = packet.getAddress().getSocketAddress();
 	const uint32 sockAddrSize = packet.getAddress().getSocketAddressSize();
 
@@ -21,46 +28,118 @@ void UDPSocket::send(const Packet& packet) {
 
 Packet UDPSocket::receive() {
 	sockaddr_in senderAddress;
-	int32 senderAddressSize = sizeof(senderAddress);
+	socklen_t senderAddressSize = sizeof(senderAddress);
 
-	uint8* buffer = new uint8[Packet::PACKET_SIZE];
+	Packet packet;
+	uint8* buffer = packet.prepareWrite();
 	int32 numBytesreceived = recvfrom(_winSocket, reinterpret_cast<char*>(buffer), Packet::PACKET_SIZE, 0, reinterpret_cast<sockaddr*>(&senderAddress), &senderAddressSize);
 	if (numBytesreceived == 0) {
-		delete[] buffer;
 		// Socket shutdown gracefully
 		throw 0;
 	}
 	else if (numBytesreceived == SOCKET_ERROR) {
-		delete[] buffer;
 		int32 errorCode = WSAGetLastError();
 		throw errorCode;
 	}
 
-	Packet packet(buffer, numBytesreceived);
+	packet.setMessageSize(numBytesreceived);
 	packet.setAddress(IPV4Address(senderAddress));
-	delete[] buffer;
 
 	return packet;
 }
 
+void UDPSocket::send(const Packet* packets, uint32 count) {
+	if (_completionPort != nullptr && _completionPort->send(*this, packets, count)) {
+		return;
+	}
 
+#ifdef _WIN32
+	// Winsock has no multiple datagram send
+	for (uint32 i = 0; i < count; i++) {
+		send(packets[i]);
+	}
+#else
+	mmsghdr messages[BATCH_SIZE];
+	iovec vectors[BATCH_SIZE];
 
-void UDPSocket::receiveOverlapped(OverlappedBuffer& overlappedBuffer) {
-	int32 status = WSARecvFrom(
-		_winSocket,
-		&overlappedBuffer.m_WSAbuffer,
-		1,
-		NULL,
-		reinterpret_cast<LPDWORD>(&overlappedBuffer.m_flags),
-		reinterpret_cast<sockaddr*>(&overlappedBuffer.m_senderAddress),
-		&overlappedBuffer.m_senderAddressSize,
-		&overlappedBuffer.m_overlapped,
-		NULL
-	);
-	if (status == SOCKET_ERROR) {
-		int32 error = WSAGetLastError();
-		if (error != WSA_IO_PENDING) {
-			throw error;
+	uint32 sent = 0;
+	while (sent < count) {
+		const uint32 batchSize = std::min(count - sent, BATCH_SIZE);
+		for (uint32 i = 0; i < batchSize; i++) {
+			const Packet& packet = packets[sent + i];
+			vectors[i].iov_base = const_cast<uint8*>(packet.getMessageData());
+			vectors[i].iov_len = packet.getMessageSize();
+
+			memset(&messages[i], 0, sizeof(mmsghdr));
+			messages[i].msg_hdr.msg_name = const_cast<sockaddr*>(packet.getAddress().getSocketAddress());
+			messages[i].msg_hdr.msg_namelen = packet.getAddress().getSocketAddressSize();
+			messages[i].msg_hdr.msg_iov = &vectors[i];
+			messages[i].msg_hdr.msg_iovlen = 1;
 		}
+
+		int32 numSent = sendmmsg(_winSocket, messages, batchSize, 0);
+		if (numSent == SOCKET_ERROR) {
+			if (errno == EINTR) {
+				continue;
+			}
+			int32 errorCode = WSAGetLastError();
+			throw errorCode;
+		}
+		sent += numSent;
+	}
+#endif
+}
+
+uint32 UDPSocket::receive(Packet* packets, uint32 maxPackets) {
+	maxPackets = std::min(maxPackets, BATCH_SIZE);
+	if (maxPackets == 0) {
+		return 0;
+	}
+
+#ifdef _WIN32
+	// Winsock has no multiple datagram receive, take single datagrams for as long as more are waiting
+	uint32 received = 0;
+	do {
+		packets[received] = receive();
+		received++;
+	} while (received < maxPackets && canReceive());
+
+	return received;
+#else
+	mmsghdr messages[BATCH_SIZE];
+	iovec vectors[BATCH_SIZE];
+	sockaddr_in senderAddresses[BATCH_SIZE];
+
+	for (uint32 i = 0; i < maxPackets; i++) {
+		vectors[i].iov_base = packets[i].prepareWrite();
+		vectors[i].iov_len = Packet::PACKET_SIZE;
+
+		memset(&messages[i], 0, sizeof(mmsghdr));
+		messages[i].msg_hdr.msg_name = &senderAddresses[i];
+		messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+		messages[i].msg_hdr.msg_iov = &vectors[i];
+		messages[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	int32 numReceived = 0;
+	do {
+		numReceived = recvmmsg(_winSocket, messages, maxPackets, MSG_WAITFORONE, nullptr);
+	} while (numReceived == SOCKET_ERROR && errno == EINTR);
+
+	if (numReceived == SOCKET_ERROR) {
+		int32 errorCode = WSAGetLastError();
+		throw errorCode;
+	}
+
+	for (int32 i = 0; i < numReceived; i++) {
+		packets[i].setMessageSize(messages[i].msg_len);
+		packets[i].setAddress(IPV4Address(senderAddresses[i]));
 	}
+
+	return static_cast<uint32>(numReceived);
+#endif
+}
+
+void UDPSocket::receiveOverlapped(OverlappedBuffer& overlappedBuffer) {
+	getAssociatedPort().receiveFrom(*this, overlappedBuffer);
 }
\ No newline at end of file
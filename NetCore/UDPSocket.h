@@ -6,11 +6,21 @@ class OverlappedBuffer;
 
 class UDPSocket : public Socket {
 public:
+	// Most datagrams moved by a single syscall when batching
+	static constexpr uint32 BATCH_SIZE = 64;
+
 	UDPSocket(bool overlapped = false);
 
 	virtual void send(const Packet& packet) override;
 	virtual Packet receive() override;
 
+	// Sends every packet to its own address, BATCH_SIZE datagrams per syscall where the platform
+	// supports it
+	void send(const Packet* packets, uint32 count);
+	// Blocks until a datagram arrives, then also takes whatever else is already waiting, up to
+	// maxPackets. Returns the number of packets filled.
+	uint32 receive(Packet* packets, uint32 maxPackets);
+
 	virtual void receiveOverlapped(OverlappedBuffer& overlappedBuffer) override;
 };
 
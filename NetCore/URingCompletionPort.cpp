@@ -0,0 +1,1015 @@
+#include "URingCompletionPort.h"
+
+#ifdef __linux__
+
+#include "Socket.h"
+#include "OverlappedBuffer.h"
+#include "Packet.h"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <csignal>
+#include <cstdlib>
+#include <algorithm>
+#include <stdexcept>
+
+// The port the current thread is serving, SQEs it queues ride along with its next wait
+static thread_local URingCompletionPort* g_servingPort = nullptr;
+
+static constexpr uint64 TAG_MASK = 7;
+static constexpr uint32 COMPLETION_ENTRIES = 4096;
+
+constexpr uint32 URingCompletionPort::RING_ENTRIES;
+constexpr uint32 URingCompletionPort::BUFFER_COUNT;
+constexpr uint32 URingCompletionPort::BUFFER_SIZE;
+constexpr uint16 URingCompletionPort::BUFFER_GROUP;
+constexpr uint32 URingCompletionPort::FIXED_FILE_COUNT;
+constexpr uint32 URingCompletionPort::MAX_COALESCED_SENDS;
+
+URingCompletionPort::URingCompletionPort() :
+	m_ring(-1)
+	, m_ringMemory(MAP_FAILED)
+	, m_ringMemorySize(0)
+	, m_sqes(nullptr)
+	, m_sqesSize(0)
+	, m_sqLocalTail(0)
+	, m_bufferRing(nullptr)
+	, m_bufferMemory(nullptr)
+	, m_bufferTail(0)
+	, m_freeBuffers(0)
+	, m_fixedFiles(false)
+	, m_nextRegistrationID(1)
+	, m_sleepers(0)
+{
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = COMPLETION_ENTRIES;
+
+	m_ring = static_cast<int32>(syscall(__NR_io_uring_setup, RING_ENTRIES, &params));
+	if (m_ring < 0) {
+		throw std::runtime_error("Failed to create io_uring instance");
+	}
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+		release();
+		throw std::runtime_error("Kernel io_uring support is too old");
+	}
+
+	// Submission and completion rings share one mapping
+	m_ringMemorySize = std::max(params.sq_off.array + params.sq_entries * sizeof(uint32), params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+	m_ringMemory = mmap(nullptr, m_ringMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQ_RING);
+	m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+	void* sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQES);
+	if (m_ringMemory == MAP_FAILED || sqes == MAP_FAILED) {
+		if (sqes != MAP_FAILED) {
+			munmap(sqes, m_sqesSize);
+		}
+		release();
+		throw std::runtime_error("Failed to map io_uring rings");
+	}
+	m_sqes = reinterpret_cast<io_uring_sqe*>(sqes);
+
+	char* ring = reinterpret_cast<char*>(m_ringMemory);
+	m_sqHead = reinterpret_cast<uint32*>(ring + params.sq_off.head);
+	m_sqTail = reinterpret_cast<uint32*>(ring + params.sq_off.tail);
+	m_sqArray = reinterpret_cast<uint32*>(ring + params.sq_off.array);
+	m_sqMask = *reinterpret_cast<uint32*>(ring + params.sq_off.ring_mask);
+	m_sqEntries = params.sq_entries;
+	m_sqLocalTail = *m_sqTail;
+
+	m_cqHead = reinterpret_cast<uint32*>(ring + params.cq_off.head);
+	m_cqTail = reinterpret_cast<uint32*>(ring + params.cq_off.tail);
+	m_cqes = reinterpret_cast<io_uring_cqe*>(ring + params.cq_off.cqes);
+	m_cqMask = *reinterpret_cast<uint32*>(ring + params.cq_off.ring_mask);
+
+	// Provided buffer ring every receive on this port draws from
+	void* bufferRing = nullptr;
+	if (posix_memalign(&bufferRing, 4096, BUFFER_COUNT * sizeof(io_uring_buf)) != 0) {
+		release();
+		throw std::runtime_error("Failed to allocate io_uring buffer ring");
+	}
+	memset(bufferRing, 0, BUFFER_COUNT * sizeof(io_uring_buf));
+	m_bufferRing = reinterpret_cast<io_uring_buf_ring*>(bufferRing);
+
+	io_uring_buf_reg bufferRegistration;
+	memset(&bufferRegistration, 0, sizeof(bufferRegistration));
+	bufferRegistration.ring_addr = reinterpret_cast<uint64>(m_bufferRing);
+	bufferRegistration.ring_entries = BUFFER_COUNT;
+	bufferRegistration.bgid = BUFFER_GROUP;
+	if (syscall(__NR_io_uring_register, m_ring, IORING_REGISTER_PBUF_RING, &bufferRegistration, 1) < 0) {
+		release();
+		throw std::runtime_error("Kernel does not support provided buffer rings");
+	}
+
+	m_bufferMemory = new char[static_cast<size_t>(BUFFER_COUNT) * BUFFER_SIZE];
+	for (uint32 i = 0; i < BUFFER_COUNT; i++) {
+		recycle(static_cast<int32>(i));
+	}
+
+	// Sparse table for registered sockets, if it is not available sockets are used by descriptor
+	std::vector<int32> files(FIXED_FILE_COUNT, -1);
+	if (syscall(__NR_io_uring_register, m_ring, IORING_REGISTER_FILES, files.data(), FIXED_FILE_COUNT) == 0) {
+		m_fixedFiles = true;
+		for (uint32 i = FIXED_FILE_COUNT; i > 0; i--) {
+			m_freeFixedFiles.push_back(static_cast<int32>(i - 1));
+		}
+	}
+
+	m_numSyscalls += 4;
+}
+
+URingCompletionPort::~URingCompletionPort() {
+	release();
+}
+
+void URingCompletionPort::release() {
+	// Closing the ring cancels everything still in flight
+	if (m_ring >= 0) {
+		::close(m_ring);
+		m_ring = -1;
+	}
+	if (m_sqes != nullptr) {
+		munmap(m_sqes, m_sqesSize);
+		m_sqes = nullptr;
+	}
+	if (m_ringMemory != MAP_FAILED) {
+		munmap(m_ringMemory, m_ringMemorySize);
+		m_ringMemory = MAP_FAILED;
+	}
+
+	free(m_bufferRing);
+	m_bufferRing = nullptr;
+	delete[] m_bufferMemory;
+	m_bufferMemory = nullptr;
+
+	for (auto& pair : m_registrations) {
+		pair.second->queuedSends.clear();
+	}
+}
+
+void URingCompletionPort::associate(Socket& socket, uintptr key) {
+	std::shared_ptr<Registration> registration = std::make_shared<Registration>();
+	registration->socket = socket._winSocket;
+	registration->fixedFile = -1;
+	registration->key = key;
+	registration->closing = false;
+	registration->receiveArmed = false;
+	registration->receiveFinished = false;
+	registration->acceptArmed = false;
+	registration->sending = false;
+	registration->flushScheduled = false;
+	registration->queuedBytes = 0;
+	registration->sendingDepth = SendQueueDepth{ 0, 0 };
+	registration->sendsInFlight = 0;
+
+	int32 type = 0;
+	socklen_t typeSize = sizeof(type);
+	getsockopt(socket._winSocket, SOL_SOCKET, SO_TYPE, &type, &typeSize);
+	registration->datagram = (type == SOCK_DGRAM);
+	m_numSyscalls++;
+
+	memset(&registration->receiveMessage, 0, sizeof(registration->receiveMessage));
+	registration->receiveMessage.msg_namelen = sizeof(sockaddr_in);
+
+	int32 fixedFile = -1;
+	if (m_fixedFiles) {
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (!m_freeFixedFiles.empty()) {
+			fixedFile = m_freeFixedFiles.back();
+			m_freeFixedFiles.pop_back();
+		}
+	}
+	if (fixedFile >= 0) {
+		int32 descriptor = socket._winSocket;
+		io_uring_files_update update;
+		memset(&update, 0, sizeof(update));
+		update.offset = fixedFile;
+		update.fds = reinterpret_cast<uint64>(&descriptor);
+
+		m_numSyscalls++;
+		if (syscall(__NR_io_uring_register, m_ring, IORING_REGISTER_FILES_UPDATE, &update, 1) == 1) {
+			registration->fixedFile = fixedFile;
+		}
+		else {
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_freeFixedFiles.push_back(fixedFile);
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		registration->id = m_nextRegistrationID++;
+		m_sockets[socket._winSocket] = registration;
+		m_registrations[registration->id] = registration;
+	}
+
+	socket._completionPort = this;
+	socket._completionKey = key;
+}
+
+void URingCompletionPort::dissociate(Socket& socket) {
+	std::shared_ptr<Registration> registration;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		auto iter = m_sockets.find(socket._winSocket);
+		if (iter == m_sockets.end()) {
+			return;
+		}
+		registration = iter->second;
+		m_sockets.erase(iter);
+	}
+
+	std::lock_guard<std::mutex> lock(registration->lock);
+	registration->closing = true;
+
+	// Like closing a socket under IOCP, anything still pending completes as aborted
+	Completion completion;
+	completion.key = registration->key;
+	completion.numBytes = 0;
+	completion.status = CompletionStatus::ABORTED;
+	completion.error = ECANCELED;
+	for (OverlappedBuffer* buffer : registration->postedReceives) {
+		completion.buffer = buffer;
+		queueCompletion(completion);
+	}
+	for (OverlappedBuffer* buffer : registration->postedAccepts) {
+		completion.buffer = buffer;
+		queueCompletion(completion);
+	}
+	registration->postedReceives.clear();
+	registration->postedAccepts.clear();
+
+	// Give back everything the socket was holding on to
+	for (const ReadyResult& ready : registration->readyReceives) {
+		if (ready.bufferID >= 0) {
+			recycle(ready.bufferID);
+		}
+	}
+	registration->readyReceives.clear();
+	for (int32 acceptedSocket : registration->readyAccepts) {
+		::close(acceptedSocket);
+	}
+	registration->readyAccepts.clear();
+	for (OverlappedBuffer* buffer : registration->lentBuffers) {
+		reclaim(*registration, *buffer);
+	}
+	registration->lentBuffers.clear();
+	registration->queuedSends.clear();
+	registration->queuedBytes = 0;
+
+	if (registration->receiveArmed) {
+		cancel(*registration, TAG_RECEIVE);
+	}
+	if (registration->acceptArmed) {
+		cancel(*registration, TAG_ACCEPT);
+	}
+
+	if (registration->fixedFile >= 0) {
+		int32 descriptor = -1;
+		io_uring_files_update update;
+		memset(&update, 0, sizeof(update));
+		update.offset = registration->fixedFile;
+		update.fds = reinterpret_cast<uint64>(&descriptor);
+
+		m_numSyscalls++;
+		syscall(__NR_io_uring_register, m_ring, IORING_REGISTER_FILES_UPDATE, &update, 1);
+
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_freeFixedFiles.push_back(registration->fixedFile);
+	}
+
+	// The cancellations have to reach the kernel before the descriptor is closed
+	submit(false);
+	retire(*registration);
+}
+
+void URingCompletionPort::receiveFrom(Socket& socket, OverlappedBuffer& buffer) {
+	receive(socket, buffer);
+}
+
+void URingCompletionPort::receive(Socket& socket, OverlappedBuffer& buffer) {
+	std::shared_ptr<Registration> registration = findSocket(socket._winSocket);
+	if (registration == nullptr) {
+		throw std::runtime_error("Socket is not associated with this completion port");
+	}
+
+	std::lock_guard<std::mutex> lock(registration->lock);
+
+	// Posting a buffer again means the caller is done with the slot it was lent
+	reclaim(*registration, buffer);
+
+	if (!registration->readyReceives.empty()) {
+		ReadyResult ready = registration->readyReceives.front();
+		registration->readyReceives.pop_front();
+		deliverReceive(*registration, buffer, ready);
+	}
+	else {
+		registration->postedReceives.push_back(&buffer);
+	}
+
+	if (!registration->receiveArmed && !registration->receiveFinished) {
+		armReceive(*registration);
+	}
+}
+
+void URingCompletionPort::accept(Socket& listener, OverlappedBuffer& buffer) {
+	std::shared_ptr<Registration> registration = findSocket(listener._winSocket);
+	if (registration == nullptr) {
+		throw std::runtime_error("Socket is not associated with this completion port");
+	}
+
+	std::lock_guard<std::mutex> lock(registration->lock);
+
+	if (!registration->readyAccepts.empty()) {
+		buffer.m_acceptSocket = registration->readyAccepts.front();
+		registration->readyAccepts.pop_front();
+
+		Completion completion;
+		completion.key = registration->key;
+		completion.buffer = &buffer;
+		completion.numBytes = 0;
+		completion.status = CompletionStatus::SUCCESS;
+		completion.error = 0;
+		queueCompletion(completion);
+	}
+	else {
+		registration->postedAccepts.push_back(&buffer);
+	}
+
+	if (!registration->acceptArmed) {
+		armAccept(*registration);
+	}
+}
+
+bool URingCompletionPort::send(Socket& socket, const Packet& packet) {
+	return send(socket, &packet, 1);
+}
+
+bool URingCompletionPort::send(Socket& socket, const Packet* packets, uint32 count) {
+	std::shared_ptr<Registration> registration = findSocket(socket._winSocket);
+	if (registration == nullptr) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(registration->lock);
+	if (registration->closing) {
+		return true;
+	}
+
+	// Every SQE is queued before anything is submitted so a batch costs a single syscall
+	for (uint32 i = 0; i < count; i++) {
+		if (registration->datagram) {
+			submitSend(*registration, createDatagramSend(*registration, packets[i]));
+		}
+		else {
+			registration->queuedSends.push_back(packets[i]);
+			registration->queuedBytes += packets[i].getFrameSize();
+		}
+	}
+	m_numSends += count;
+
+	if (!registration->datagram) {
+		scheduleFlush(*registration);
+	}
+	submit(true);
+	return true;
+}
+
+SendQueueDepth URingCompletionPort::getSendQueueDepth(Socket& socket) {
+	SendQueueDepth depth = { 0, 0 };
+
+	std::shared_ptr<Registration> registration = findSocket(socket._winSocket);
+	if (registration != nullptr) {
+		std::lock_guard<std::mutex> lock(registration->lock);
+		depth.messages = static_cast<uint32>(registration->queuedSends.size()) + registration->sendingDepth.messages;
+		depth.bytes = registration->queuedBytes + registration->sendingDepth.bytes;
+	}
+	return depth;
+}
+
+uint32 URingCompletionPort::dropQueuedSends(Socket& socket, SendFilter filter, void* context, uint32 maxCount) {
+	std::shared_ptr<Registration> registration = findSocket(socket._winSocket);
+	if (registration == nullptr) {
+		return 0;
+	}
+
+	std::lock_guard<std::mutex> lock(registration->lock);
+
+	uint32 dropped = 0;
+	std::deque<Packet>& queue = registration->queuedSends;
+	for (auto iter = queue.begin(); iter != queue.end() && dropped < maxCount;) {
+		if (filter(*iter, context)) {
+			registration->queuedBytes -= iter->getFrameSize();
+			iter = queue.erase(iter);
+			dropped++;
+		}
+		else {
+			++iter;
+		}
+	}
+	return dropped;
+}
+
+bool URingCompletionPort::wait(Completion& completion, uint32 timeoutMs) {
+	g_servingPort = this;
+
+	__kernel_timespec timeout;
+	timeout.tv_sec = (timeoutMs == INFINITE_WAIT) ? 0 : timeoutMs / 1000;
+	timeout.tv_nsec = (timeoutMs == INFINITE_WAIT) ? 0 : static_cast<int64>(timeoutMs % 1000) * 1000000;
+
+	io_uring_getevents_arg argument;
+	memset(&argument, 0, sizeof(argument));
+	argument.sigmask_sz = _NSIG / 8;
+	argument.ts = reinterpret_cast<uint64>(&timeout);
+
+	bool timedOut = false;
+	for (;;) {
+		reap();
+
+		std::vector<uint64> starved;
+		{
+			std::lock_guard<std::mutex> lock(m_bufferLock);
+			if (m_freeBuffers > 0 && !m_starved.empty()) {
+				starved.swap(m_starved);
+			}
+		}
+		for (uint64 id : starved) {
+			std::shared_ptr<Registration> registration = findRegistration(id);
+			if (registration != nullptr) {
+				std::lock_guard<std::mutex> lock(registration->lock);
+				if (!registration->closing && !registration->receiveArmed && !registration->receiveFinished && !registration->postedReceives.empty()) {
+					armReceive(*registration);
+				}
+			}
+		}
+
+		std::vector<uint64> flushes;
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			flushes.swap(m_flushes);
+		}
+		for (uint64 id : flushes) {
+			std::shared_ptr<Registration> registration = findRegistration(id);
+			if (registration != nullptr) {
+				std::lock_guard<std::mutex> lock(registration->lock);
+				flushSends(*registration);
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			if (!m_completions.empty()) {
+				completion = m_completions.front();
+				m_completions.pop_front();
+				m_numCompletions++;
+				return true;
+			}
+			if (timedOut || m_ring < 0) {
+				return false;
+			}
+			if (!m_flushes.empty()) {
+				// Scheduled after this thread took the last ones, nobody else would flush them
+				continue;
+			}
+			m_sleepers++;
+		}
+
+		uint32 toSubmit = 0;
+		{
+			std::lock_guard<std::mutex> lock(m_submitLock);
+			__atomic_store_n(m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+			toSubmit = m_sqLocalTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+		}
+
+		// Submits whatever was queued while handling the last completion and sleeps in one call
+		uint32 flags = IORING_ENTER_GETEVENTS;
+		if (timeoutMs != INFINITE_WAIT) {
+			flags |= IORING_ENTER_EXT_ARG;
+		}
+		int32 result = enter(toSubmit, 1, flags, (timeoutMs != INFINITE_WAIT) ? &argument : nullptr, (timeoutMs != INFINITE_WAIT) ? sizeof(argument) : 0);
+		int32 error = errno;
+
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_sleepers--;
+		}
+
+		if (result < 0) {
+			if (error == ETIME) {
+				timedOut = true;
+			}
+			else if (error != EINTR && error != EBUSY) {
+				return false;
+			}
+		}
+	}
+}
+
+void URingCompletionPort::post(uintptr key) {
+	Completion completion;
+	completion.key = key;
+	completion.buffer = nullptr;
+	completion.numBytes = 0;
+	completion.status = CompletionStatus::SUCCESS;
+	completion.error = 0;
+	queueCompletion(completion);
+}
+
+std::shared_ptr<URingCompletionPort::Registration> URingCompletionPort::findSocket(SOCKET socket) {
+	std::lock_guard<std::mutex> lock(m_lock);
+	auto iter = m_sockets.find(socket);
+	if (iter == m_sockets.end()) {
+		return nullptr;
+	}
+	return iter->second;
+}
+
+std::shared_ptr<URingCompletionPort::Registration> URingCompletionPort::findRegistration(uint64 id) {
+	std::lock_guard<std::mutex> lock(m_lock);
+	auto iter = m_registrations.find(id);
+	if (iter == m_registrations.end()) {
+		return nullptr;
+	}
+	return iter->second;
+}
+
+void URingCompletionPort::retire(const Registration& registration) {
+	// A closed socket's registration has to outlive the requests still referencing it
+	if (registration.closing && !registration.receiveArmed && !registration.acceptArmed && registration.sendsInFlight == 0) {
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_registrations.erase(registration.id);
+	}
+}
+
+io_uring_sqe* URingCompletionPort::acquireSqe() {
+	// Caller holds m_submitLock
+	while (m_sqLocalTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_sqEntries) {
+		__atomic_store_n(m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+		enter(m_sqEntries, 0, 0, nullptr, 0);
+	}
+
+	uint32 index = m_sqLocalTail & m_sqMask;
+	io_uring_sqe* sqe = &m_sqes[index];
+	memset(sqe, 0, sizeof(io_uring_sqe));
+	m_sqArray[index] = index;
+	m_sqLocalTail++;
+
+	return sqe;
+}
+
+void URingCompletionPort::submit(bool deferrable) {
+	if (deferrable && g_servingPort == this) {
+		// Goes out with the next wait as long as nobody is asleep in the kernel already. Another
+		// serving thread may be the one to wait next while this one blocks, and it only submits if
+		// it hasn't gone to sleep yet. Checked after the SQE was queued, and a waiter counts itself
+		// as sleeping before it reads the tail, so either it sees the SQE or this sees it.
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (m_sleepers == 0) {
+			return;
+		}
+	}
+
+	uint32 toSubmit = 0;
+	{
+		std::lock_guard<std::mutex> lock(m_submitLock);
+		__atomic_store_n(m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+		toSubmit = m_sqLocalTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+	}
+
+	if (toSubmit > 0) {
+		enter(toSubmit, 0, 0, nullptr, 0);
+	}
+}
+
+int32 URingCompletionPort::enter(uint32 toSubmit, uint32 minComplete, uint32 flags, void* argument, size_t argumentSize) {
+	m_numSyscalls++;
+	return static_cast<int32>(syscall(__NR_io_uring_enter, m_ring, toSubmit, minComplete, flags, argument, argumentSize));
+}
+
+void URingCompletionPort::armReceive(Registration& registration) {
+	{
+		std::lock_guard<std::mutex> lock(m_submitLock);
+		io_uring_sqe* sqe = acquireSqe();
+		sqe->opcode = (registration.datagram) ? IORING_OP_RECVMSG : IORING_OP_RECV;
+		sqe->fd = (registration.fixedFile >= 0) ? registration.fixedFile : registration.socket;
+		sqe->flags = IOSQE_BUFFER_SELECT | ((registration.fixedFile >= 0) ? IOSQE_FIXED_FILE : 0);
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->buf_group = BUFFER_GROUP;
+		if (registration.datagram) {
+			sqe->addr = reinterpret_cast<uint64>(&registration.receiveMessage);
+			sqe->len = 1;
+		}
+		sqe->user_data = (registration.id << 3) | TAG_RECEIVE;
+	}
+	registration.receiveArmed = true;
+
+	submit(true);
+}
+
+void URingCompletionPort::armAccept(Registration& registration) {
+	{
+		std::lock_guard<std::mutex> lock(m_submitLock);
+		io_uring_sqe* sqe = acquireSqe();
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->fd = (registration.fixedFile >= 0) ? registration.fixedFile : registration.socket;
+		sqe->flags = (registration.fixedFile >= 0) ? IOSQE_FIXED_FILE : 0;
+		sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+		sqe->accept_flags = SOCK_CLOEXEC;
+		sqe->user_data = (registration.id << 3) | TAG_ACCEPT;
+	}
+	registration.acceptArmed = true;
+
+	submit(true);
+}
+
+URingCompletionPort::SendOperation* URingCompletionPort::createDatagramSend(const Registration& registration, const Packet& packet) {
+	SendOperation* operation = new SendOperation();
+	operation->registrationID = registration.id;
+	operation->datagram = true;
+	operation->firstVector = 0;
+	operation->packets.push_back(packet);
+
+	iovec vector;
+	vector.iov_base = const_cast<uint8*>(packet.getMessageData());
+	vector.iov_len = packet.getMessageSize();
+	operation->vectors.push_back(vector);
+
+	memcpy(&operation->address, packet.getAddress().getSocketAddress(), sizeof(operation->address));
+	memset(&operation->message, 0, sizeof(operation->message));
+	operation->message.msg_name = &operation->address;
+	operation->message.msg_namelen = sizeof(operation->address);
+
+	return operation;
+}
+
+void URingCompletionPort::scheduleFlush(Registration& registration) {
+	// Caller holds the registration's lock
+	if (registration.sending || registration.flushScheduled) {
+		return;
+	}
+
+	if (g_servingPort == this) {
+		// Anything else sent before the next wait joins the same write, unless a waiter is asleep
+		// already and nobody would get to it
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (m_sleepers == 0) {
+			registration.flushScheduled = true;
+			m_flushes.push_back(registration.id);
+			return;
+		}
+	}
+	flushSends(registration);
+}
+
+void URingCompletionPort::flushSends(Registration& registration) {
+	// Caller holds the registration's lock
+	registration.flushScheduled = false;
+	if (registration.closing || registration.sending || registration.queuedSends.empty()) {
+		return;
+	}
+
+	SendOperation* operation = new SendOperation();
+	operation->registrationID = registration.id;
+	operation->datagram = false;
+	operation->firstVector = 0;
+
+	// Stream sends include the frame header the packet keeps in front of the message
+	const uint32 count = std::min(static_cast<uint32>(registration.queuedSends.size()), MAX_COALESCED_SENDS);
+	operation->packets.reserve(count);
+	operation->vectors.reserve(count);
+	for (uint32 i = 0; i < count; i++) {
+		operation->packets.push_back(std::move(registration.queuedSends.front()));
+		registration.queuedSends.pop_front();
+
+		const Packet& packet = operation->packets.back();
+		iovec vector;
+		vector.iov_base = const_cast<uint8*>(packet.getFrameData());
+		vector.iov_len = packet.getFrameSize();
+		operation->vectors.push_back(vector);
+
+		registration.queuedBytes -= packet.getFrameSize();
+		registration.sendingDepth.bytes += packet.getFrameSize();
+	}
+	registration.sendingDepth.messages = count;
+
+	memset(&operation->message, 0, sizeof(operation->message));
+
+	registration.sending = true;
+	submitSend(registration, operation);
+}
+
+void URingCompletionPort::submitSend(Registration& registration, SendOperation* operation) {
+	registration.sendsInFlight++;
+
+	operation->message.msg_iov = &operation->vectors[operation->firstVector];
+	operation->message.msg_iovlen = operation->vectors.size() - operation->firstVector;
+
+	{
+		std::lock_guard<std::mutex> lock(m_submitLock);
+		io_uring_sqe* sqe = acquireSqe();
+		sqe->fd = (registration.fixedFile >= 0) ? registration.fixedFile : registration.socket;
+		sqe->flags = (registration.fixedFile >= 0) ? IOSQE_FIXED_FILE : 0;
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->addr = reinterpret_cast<uint64>(&operation->message);
+		sqe->len = 1;
+		sqe->msg_flags = operation->datagram ? MSG_NOSIGNAL : (MSG_NOSIGNAL | MSG_WAITALL);
+		sqe->user_data = reinterpret_cast<uint64>(operation) | TAG_SEND;
+	}
+}
+
+void URingCompletionPort::cancel(Registration& registration, Tag tag) {
+	std::lock_guard<std::mutex> lock(m_submitLock);
+	io_uring_sqe* sqe = acquireSqe();
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = (registration.id << 3) | tag;
+	sqe->user_data = TAG_CANCEL;
+}
+
+void URingCompletionPort::reap() {
+	std::lock_guard<std::mutex> lock(m_reapLock);
+
+	uint32 head = *m_cqHead;
+	uint32 tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+	while (head != tail) {
+		const io_uring_cqe& cqe = m_cqes[head & m_cqMask];
+		uint64 userData = cqe.user_data;
+		int32 result = cqe.res;
+		uint32 flags = cqe.flags;
+
+		head++;
+		__atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+
+		// Handled in ring order so a stream's data is never reordered
+		switch (userData & TAG_MASK) {
+		case TAG_RECEIVE:
+			handleReceive(userData >> 3, result, flags);
+			break;
+		case TAG_ACCEPT:
+			handleAccept(userData >> 3, result, flags);
+			break;
+		case TAG_SEND:
+			handleSend(reinterpret_cast<SendOperation*>(userData & ~TAG_MASK), result);
+			break;
+		default:
+			// Wake ups and cancellations carry nothing
+			break;
+		}
+
+		if (head == tail) {
+			tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+		}
+	}
+}
+
+void URingCompletionPort::handleReceive(uint64 id, int32 result, uint32 flags) {
+	int32 bufferID = -1;
+	if (flags & IORING_CQE_F_BUFFER) {
+		bufferID = static_cast<int32>(flags >> IORING_CQE_BUFFER_SHIFT);
+		std::lock_guard<std::mutex> lock(m_bufferLock);
+		m_freeBuffers--;
+	}
+
+	std::shared_ptr<Registration> registration = findRegistration(id);
+	if (registration == nullptr) {
+		if (bufferID >= 0) {
+			recycle(bufferID);
+		}
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(registration->lock);
+	if (!(flags & IORING_CQE_F_MORE)) {
+		registration->receiveArmed = false;
+	}
+
+	if (registration->closing || result == -ECANCELED) {
+		if (bufferID >= 0) {
+			recycle(bufferID);
+		}
+		retire(*registration);
+		return;
+	}
+
+	if (result == -ENOBUFS) {
+		// The ring ran dry, pick up again once buffers come back
+		if (!registration->receiveArmed && !registration->postedReceives.empty()) {
+			std::lock_guard<std::mutex> lock(m_bufferLock);
+			m_starved.push_back(registration->id);
+		}
+		return;
+	}
+
+	if (!registration->datagram && result <= 0) {
+		// End of stream or a broken connection, nothing more will arrive
+		registration->receiveFinished = true;
+	}
+
+	ReadyResult ready;
+	ready.result = result;
+	ready.bufferID = bufferID;
+
+	if (!registration->postedReceives.empty()) {
+		OverlappedBuffer* buffer = registration->postedReceives.front();
+		registration->postedReceives.pop_front();
+		deliverReceive(*registration, *buffer, ready);
+	}
+	else {
+		registration->readyReceives.push_back(ready);
+	}
+
+	if (!registration->receiveArmed && !registration->receiveFinished && !registration->postedReceives.empty()) {
+		armReceive(*registration);
+	}
+}
+
+void URingCompletionPort::handleAccept(uint64 id, int32 result, uint32 flags) {
+	std::shared_ptr<Registration> registration = findRegistration(id);
+	if (registration == nullptr) {
+		if (result >= 0) {
+			::close(result);
+		}
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(registration->lock);
+	if (!(flags & IORING_CQE_F_MORE)) {
+		registration->acceptArmed = false;
+	}
+
+	if (registration->closing || result == -ECANCELED) {
+		if (result >= 0) {
+			::close(result);
+		}
+		retire(*registration);
+		return;
+	}
+
+	if (!registration->postedAccepts.empty()) {
+		OverlappedBuffer* buffer = registration->postedAccepts.front();
+		registration->postedAccepts.pop_front();
+
+		Completion completion;
+		completion.key = registration->key;
+		completion.buffer = buffer;
+		completion.numBytes = 0;
+		completion.status = CompletionStatus::SUCCESS;
+		completion.error = 0;
+		if (result >= 0) {
+			buffer->m_acceptSocket = result;
+		}
+		else {
+			completion.status = CompletionStatus::FAILED;
+			completion.error = -result;
+		}
+		queueCompletion(completion);
+	}
+	else if (result >= 0) {
+		registration->readyAccepts.push_back(result);
+	}
+
+	if (!registration->acceptArmed && !registration->postedAccepts.empty()) {
+		armAccept(*registration);
+	}
+}
+
+void URingCompletionPort::handleSend(SendOperation* operation, int32 result) {
+	std::shared_ptr<Registration> registration = findRegistration(operation->registrationID);
+	if (registration == nullptr) {
+		delete operation;
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(registration->lock);
+	registration->sendsInFlight--;
+
+	const bool datagram = operation->datagram;
+	if (!datagram && !registration->closing && result > 0) {
+		// Skip whatever went out, a short write sends the rest before anything queued behind it
+		uint32 remaining = static_cast<uint32>(result);
+		std::vector<iovec>& vectors = operation->vectors;
+		while (operation->firstVector < vectors.size() && remaining >= vectors[operation->firstVector].iov_len) {
+			remaining -= vectors[operation->firstVector].iov_len;
+			operation->firstVector++;
+		}
+
+		if (operation->firstVector < vectors.size()) {
+			iovec& vector = vectors[operation->firstVector];
+			vector.iov_base = static_cast<uint8*>(vector.iov_base) + remaining;
+			vector.iov_len -= remaining;
+			submitSend(*registration, operation);
+			submit(true);
+			return;
+		}
+	}
+	delete operation;
+
+	if (!datagram) {
+		registration->sending = false;
+		registration->sendingDepth = SendQueueDepth{ 0, 0 };
+		flushSends(*registration);
+		submit(true);
+	}
+
+	retire(*registration);
+}
+
+void URingCompletionPort::deliverReceive(Registration& registration, OverlappedBuffer& buffer, const ReadyResult& ready) {
+	Completion completion;
+	completion.key = registration.key;
+	completion.buffer = &buffer;
+	completion.numBytes = 0;
+	completion.status = CompletionStatus::SUCCESS;
+	completion.error = 0;
+
+	if (ready.result < 0) {
+		completion.error = -ready.result;
+		if (completion.error == ECONNRESET || completion.error == EPIPE || completion.error == ETIMEDOUT) {
+			completion.status = CompletionStatus::DISCONNECTED;
+		}
+		else {
+			completion.status = CompletionStatus::FAILED;
+		}
+		if (ready.bufferID >= 0) {
+			recycle(ready.bufferID);
+		}
+	}
+	else if (ready.bufferID >= 0) {
+		char* data = getBufferData(ready.bufferID);
+		uint32 size = static_cast<uint32>(ready.result);
+
+		if (registration.datagram) {
+			// recvmsg results carry a header and the sender's address ahead of the payload
+			const io_uring_recvmsg_out* header = reinterpret_cast<const io_uring_recvmsg_out*>(data);
+			const char* name = data + sizeof(io_uring_recvmsg_out);
+			if (header->namelen >= sizeof(sockaddr_in)) {
+				memcpy(&buffer.m_senderAddress, name, sizeof(sockaddr_in));
+				buffer.m_senderAddressSize = sizeof(sockaddr_in);
+			}
+			data += sizeof(io_uring_recvmsg_out) + registration.receiveMessage.msg_namelen + registration.receiveMessage.msg_controllen;
+			size = header->payloadlen;
+		}
+
+		completion.numBytes = std::min(size, OVERLAPPED_BUFFER_SIZE);
+		buffer.m_data = data;
+		buffer.m_providedBuffer = ready.bufferID;
+		registration.lentBuffers.push_back(&buffer);
+	}
+	else {
+		completion.numBytes = static_cast<uint32>(ready.result);
+	}
+
+	queueCompletion(completion);
+}
+
+void URingCompletionPort::reclaim(Registration& registration, OverlappedBuffer& buffer) {
+	if (buffer.m_providedBuffer >= 0) {
+		recycle(buffer.m_providedBuffer);
+		buffer.m_providedBuffer = -1;
+		buffer.m_data = buffer.m_buffer;
+
+		auto iter = std::find(registration.lentBuffers.begin(), registration.lentBuffers.end(), &buffer);
+		if (iter != registration.lentBuffers.end()) {
+			*iter = registration.lentBuffers.back();
+			registration.lentBuffers.pop_back();
+		}
+	}
+}
+
+void URingCompletionPort::recycle(int32 bufferID) {
+	std::lock_guard<std::mutex> lock(m_bufferLock);
+
+	// Entries overlay the ring header, indexed directly since the header's flexible array member
+	// does not get the same layout when compiled as C++
+	io_uring_buf* entry = reinterpret_cast<io_uring_buf*>(m_bufferRing) + (m_bufferTail & (BUFFER_COUNT - 1));
+	entry->addr = reinterpret_cast<uint64>(getBufferData(bufferID));
+	entry->len = BUFFER_SIZE;
+	entry->bid = static_cast<uint16>(bufferID);
+
+	m_bufferTail++;
+	__atomic_store_n(&m_bufferRing->tail, m_bufferTail, __ATOMIC_RELEASE);
+	m_freeBuffers++;
+}
+
+void URingCompletionPort::queueCompletion(const Completion& completion) {
+	bool sleeping = false;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_completions.push_back(completion);
+		sleeping = m_sleepers > 0;
+	}
+
+	if (sleeping) {
+		// A no-op completion is enough to get a sleeping waiter out of the kernel
+		{
+			std::lock_guard<std::mutex> lock(m_submitLock);
+			io_uring_sqe* sqe = acquireSqe();
+			sqe->opcode = IORING_OP_NOP;
+			sqe->user_data = TAG_WAKE;
+		}
+		submit(false);
+	}
+}
+
+#endif
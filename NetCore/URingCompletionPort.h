@@ -0,0 +1,182 @@
+#pragma once
+
+#ifdef __linux__
+
+#include "CompletionPort.h"
+#include "OverlappedBuffer.h"
+#include "Packet.h"
+#include "Platform.h"
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <sys/uio.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+// io_uring engine. Receives and accepts are multishot requests armed once per socket, received
+// data lands in a provided buffer ring shared by every socket on the port and a completion lends
+// its ring slot to the OverlappedBuffer until the next receive is issued on it. Results that
+// arrive before a buffer is posted are held, so re-arming after handling a packet usually costs
+// no syscall at all. Sends keep a reference to the packet's buffer in SQEs that the thread serving
+// the port submits together with its next wait; sends from other threads are submitted right away.
+// Stream sends made while handling a completion are gathered into one vectored write per socket.
+class URingCompletionPort : public CompletionPort {
+private:
+	enum Tag : uint64 {
+		TAG_RECEIVE = 1,
+		TAG_ACCEPT = 2,
+		TAG_SEND = 3,
+		TAG_WAKE = 4,
+		TAG_CANCEL = 5
+	};
+
+	struct ReadyResult {
+		int32 result;
+		int32 bufferID;
+	};
+
+	struct SendOperation {
+		uint64 registrationID;
+		bool datagram;
+		std::vector<Packet> packets;	// Keep the shared buffers alive until the send completes
+		std::vector<iovec> vectors;
+		uint32 firstVector;				// Everything before it has gone out
+		sockaddr_in address;
+		msghdr message;
+	};
+
+	struct Registration {
+		uint64 id;
+		SOCKET socket;
+		int32 fixedFile;
+		uintptr key;
+		bool datagram;
+		bool closing;
+
+		std::mutex lock;
+
+		// Multishot receive
+		bool receiveArmed;
+		bool receiveFinished;
+		msghdr receiveMessage;
+		std::deque<OverlappedBuffer*> postedReceives;
+		std::deque<ReadyResult> readyReceives;
+		std::vector<OverlappedBuffer*> lentBuffers;
+
+		// Multishot accept
+		bool acceptArmed;
+		std::deque<OverlappedBuffer*> postedAccepts;
+		std::deque<int32> readyAccepts;
+
+		// Stream sends go out one at a time to keep them in order, whatever queues up in the
+		// meantime is coalesced into the next one
+		bool sending;
+		bool flushScheduled;
+		uint32 sendsInFlight;
+		std::deque<Packet> queuedSends;
+		uint32 queuedBytes;
+		SendQueueDepth sendingDepth;	// What the stream send in flight carries
+	};
+
+	static constexpr uint32 RING_ENTRIES = 256;
+	static constexpr uint32 BUFFER_COUNT = 4096;
+	static constexpr uint32 BUFFER_SIZE = 1024;
+	static constexpr uint16 BUFFER_GROUP = 0;
+	static constexpr uint32 FIXED_FILE_COUNT = 4096;
+	static constexpr uint32 MAX_COALESCED_SENDS = 64;
+
+	int32 m_ring;
+
+	void* m_ringMemory;
+	size_t m_ringMemorySize;
+	io_uring_sqe* m_sqes;
+	size_t m_sqesSize;
+
+	uint32* m_sqHead;
+	uint32* m_sqTail;
+	uint32* m_sqArray;
+	uint32 m_sqMask;
+	uint32 m_sqEntries;
+	uint32 m_sqLocalTail;
+
+	uint32* m_cqHead;
+	uint32* m_cqTail;
+	io_uring_cqe* m_cqes;
+	uint32 m_cqMask;
+
+	io_uring_buf_ring* m_bufferRing;
+	char* m_bufferMemory;
+	uint16 m_bufferTail;
+	int32 m_freeBuffers;
+	std::vector<uint64> m_starved;	// Registrations waiting for the buffer ring to refill
+
+	bool m_fixedFiles;
+	std::vector<int32> m_freeFixedFiles;
+
+	std::mutex m_submitLock;
+	std::mutex m_reapLock;
+	std::mutex m_bufferLock;
+
+	std::mutex m_lock;
+	std::unordered_map<SOCKET, std::shared_ptr<Registration>> m_sockets;
+	std::unordered_map<uint64, std::shared_ptr<Registration>> m_registrations;
+	std::deque<Completion> m_completions;
+	std::vector<uint64> m_flushes;	// Registrations with stream sends to issue before the next wait
+	uint64 m_nextRegistrationID;
+	uint32 m_sleepers;
+
+	void release();
+
+	std::shared_ptr<Registration> findSocket(SOCKET socket);
+	std::shared_ptr<Registration> findRegistration(uint64 id);
+	void retire(const Registration& registration);
+
+	io_uring_sqe* acquireSqe();
+	void submit(bool deferrable);
+	int32 enter(uint32 toSubmit, uint32 minComplete, uint32 flags, void* argument, size_t argumentSize);
+
+	void armReceive(Registration& registration);
+	void armAccept(Registration& registration);
+	SendOperation* createDatagramSend(const Registration& registration, const Packet& packet);
+	void scheduleFlush(Registration& registration);
+	void flushSends(Registration& registration);
+	void submitSend(Registration& registration, SendOperation* operation);
+	void cancel(Registration& registration, Tag tag);
+
+	void reap();
+	void handleReceive(uint64 id, int32 result, uint32 flags);
+	void handleAccept(uint64 id, int32 result, uint32 flags);
+	void handleSend(SendOperation* operation, int32 result);
+
+	void deliverReceive(Registration& registration, OverlappedBuffer& buffer, const ReadyResult& ready);
+	void reclaim(Registration& registration, OverlappedBuffer& buffer);
+	void recycle(int32 bufferID);
+	char* getBufferData(int32 bufferID) { return m_bufferMemory + static_cast<size_t>(bufferID) * BUFFER_SIZE; }
+
+	void queueCompletion(const Completion& completion);
+public:
+	URingCompletionPort();
+	virtual ~URingCompletionPort();
+
+	virtual void associate(Socket& socket, uintptr key) override;
+	virtual void dissociate(Socket& socket) override;
+
+	virtual void receiveFrom(Socket& socket, OverlappedBuffer& buffer) override;
+	virtual void receive(Socket& socket, OverlappedBuffer& buffer) override;
+	virtual void accept(Socket& listener, OverlappedBuffer& buffer) override;
+
+	virtual bool send(Socket& socket, const Packet& packet) override;
+	virtual bool send(Socket& socket, const Packet* packets, uint32 count) override;
+	virtual SendQueueDepth getSendQueueDepth(Socket& socket) override;
+	virtual uint32 dropQueuedSends(Socket& socket, SendFilter filter, void* context, uint32 maxCount) override;
+
+	virtual bool wait(Completion& completion, uint32 timeoutMs = INFINITE_WAIT) override;
+	virtual void post(uintptr key) override;
+};
+
+#endif
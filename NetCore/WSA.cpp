@@ -1,21 +1,32 @@
 #include "WSA.h"
 
-#include <Windows.h>
+#include "Platform.h"
 
 #include <stdexcept>
 
+#ifndef _WIN32
+#include <csignal>
+#endif
+
 WSA* WSA::s_instance = nullptr;
 
 WSA::WSA() {
+#ifdef _WIN32
 	// Initialize Winsock
 	WSADATA wsaData;
 	int result = WSAStartup(MAKEWORD(2, 2), &wsaData);
 	if (result != 0) {
 		throw std::runtime_error("Could not initialize Winsock.");
 	}
+#else
+	// Writing to a socket the peer already closed should fail the send, not kill the process
+	signal(SIGPIPE, SIG_IGN);
+#endif
 }
 
 
 WSA::~WSA() {
+#ifdef _WIN32
 	WSACleanup();
+#endif
 }
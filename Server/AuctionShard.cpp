@@ -0,0 +1,536 @@
+#include "AuctionShard.h"
+
+#include "Server.h"
+#include "Item.h"
+#include "Log.h"
+#include "Clock.h"
+
+#include <chrono>
+
+AuctionShard::AuctionShard(Server* server, uint32 index, uint32 numShards, uint32 ringSize, uint64 conflationTime) :
+	m_server(server)
+	, m_index(index)
+	, m_numShards(numShards)
+	, m_nextItemID((index == 0) ? numShards : index)
+	, m_commands(ringSize)
+	, m_events(ringSize)
+	, m_matching(false)
+	, m_publishing(false)
+	, m_wheel(getMonotonicTime() / TICK)
+	, m_numBatches(0)
+	, m_numPublishBatches(0)
+	, m_conflationTime(conflationTime)
+	, m_nextConflationFlush(0)
+	, m_numConflatedHighest(0)
+	, m_numConflatedSent(0)
+	, m_conflationDelay(0)
+	, m_maxConflationDelay(0)
+{}
+
+AuctionShard::~AuctionShard() {
+	stop();
+
+	// Auctions still running when the server stopped, they resume from connections.dat
+	for (auto& pair : m_items) {
+		delete pair.second;
+	}
+	m_items.clear();
+
+	Command command;
+	while (m_commands.pop(command)) {
+		if (command.type == CommandType::START) {
+			delete command.item;
+		}
+	}
+	Event event;
+	while (m_events.pop(event)) {
+		if (event.type == EventType::ENDED) {
+			delete event.item;
+		}
+	}
+}
+
+uint32 AuctionShard::allocateItemID() {
+	return m_nextItemID.fetch_add(m_numShards);
+}
+
+void AuctionShard::reserveItemIDs(uint32 highestID) {
+	uint32 next = highestID - (highestID % m_numShards) + m_index;
+	if (next <= highestID) {
+		next += m_numShards;
+	}
+
+	uint32 current = m_nextItemID;
+	while (next > current && !m_nextItemID.compare_exchange_weak(current, next)) {}
+}
+
+void AuctionShard::startAuction(Item* item, uint64 auctionTime) {
+	Command command = {};
+	command.type = CommandType::START;
+	command.item = item;
+	command.auctionTime = auctionTime;
+	m_commands.push(command);
+}
+
+void AuctionShard::offerAuction(Item* item, uint32 reqNum, const IPV4Address& address) {
+	Command command = {};
+	command.type = CommandType::START;
+	command.item = item;
+	command.auctionTime = AUCTION_TIME;
+	command.reqNum = reqNum;
+	command.address = address;
+	command.confirm = true;
+	m_commands.push(command);
+}
+
+void AuctionShard::restoreAuction(Item* item, uint64 auctionTime) {
+	insert(item, auctionTime);
+}
+
+void AuctionShard::bid(uint32 itemID, float32 amount, ClientID bidder) {
+	Command command = {};
+	command.type = CommandType::BID;
+	command.itemID = itemID;
+	command.amount = amount;
+	command.client = bidder;
+	m_commands.push(command);
+}
+
+void AuctionShard::confirmOffer(uint32 itemID, uint32 reqNum, const IPV4Address& address) {
+	Command command = {};
+	command.type = CommandType::CONFIRM_OFFER;
+	command.itemID = itemID;
+	command.reqNum = reqNum;
+	command.address = address;
+	m_commands.push(command);
+}
+
+void AuctionShard::watch(uint32 itemID, ClientID client, bool watching) {
+	Command command = {};
+	command.type = watching ? CommandType::WATCH : CommandType::UNWATCH;
+	command.itemID = itemID;
+	command.client = client;
+	m_commands.push(command);
+}
+
+void AuctionShard::launch() {
+	m_matching = true;
+	m_publishing = true;
+	m_matchThread = std::thread(&AuctionShard::match, this);
+	m_publishThread = std::thread(&AuctionShard::publish, this);
+}
+
+void AuctionShard::stop() {
+	// Matching first, so nothing is published after the publishing stage is gone
+	m_matching = false;
+	m_commands.wake();
+	if (m_matchThread.joinable()) {
+		m_matchThread.join();
+	}
+
+	m_publishing = false;
+	m_events.wake();
+	if (m_publishThread.joinable()) {
+		m_publishThread.join();
+	}
+}
+
+void AuctionShard::match() {
+	while (m_matching) {
+		const bool matched = matchBatch();
+
+		expire();
+
+		if (!matched) {
+			// Woken up by the next command or in time to advance the timers
+			m_commands.wait(std::chrono::microseconds(TICK / 10));
+		}
+	}
+
+	// Stopping, commands already queued were accepted and some were confirmed, so they still count.
+	// Nothing pushes new ones by now.
+	while (matchBatch()) {}
+}
+
+bool AuctionShard::matchBatch() {
+	bool matched = false;
+
+	Command command;
+	while (m_commands.pop(command)) {
+		matched = true;
+		switch (command.type) {
+		case CommandType::START:
+			start(command);
+			break;
+		case CommandType::BID:
+			bid(command);
+			break;
+		case CommandType::CONFIRM_OFFER:
+			confirmOffer(command);
+			break;
+		case CommandType::WATCH:
+		case CommandType::UNWATCH:
+			watch(command);
+			break;
+		}
+	}
+	if (matched) {
+		m_numBatches++;
+	}
+	return matched;
+}
+
+void AuctionShard::insert(Item* item, uint64 auctionTime) {
+	// Backdated by however long it already ran before a restart, wall clock time only for saving
+	item->setAuctionStartTime(getSystemTime() + auctionTime - AUCTION_TIME);
+
+	{
+		std::lock_guard<std::mutex> lock(m_itemLock);
+		m_items[item->getItemID()] = item;
+		addClientItem(m_sellerItems, item->getSeller(), item->getItemID());
+		item->addWatcher(item->getSeller());
+		if (item->getHighestBidder() != INVALID_CLIENT_ID) {
+			// Restored with its bids
+			addClientItem(m_leadingItems, item->getHighestBidder(), item->getItemID());
+			item->addWatcher(item->getHighestBidder());
+		}
+	}
+
+	// The remaining time becomes a monotonic deadline so clock steps can't end or stall auctions,
+	// rounded up so an auction never ends early
+	WheelTimer& timer = item->getExpiryTimer();
+	timer.context = item;
+	m_wheel.schedule(timer, (getMonotonicTime() + auctionTime + TICK - 1) / TICK);
+}
+
+void AuctionShard::start(const Command& command) {
+	Item* item = command.item;
+	insert(item, command.auctionTime);
+
+	log("[INFO] Starting auction for item number %u with a min bid of %.2f", item->getItemID(), item->getMinimum());
+
+	Event event = {};
+	event.type = EventType::NEW_ITEM;
+	event.item = item;
+	event.amount = item->getCurrentHighest();
+	event.client = item->getHighestBidder();
+	event.reqNum = command.reqNum;
+	event.address = command.address;
+	event.confirm = command.confirm;
+	m_events.push(event);
+}
+
+void AuctionShard::bid(const Command& command) {
+	auto iter = m_items.find(command.itemID);
+	if (iter == m_items.end()) {
+		log("[INFO] Item %u not up for auction, ignoring bid", command.itemID);
+		return;
+	}
+
+	Item* item = iter->second;
+	if (command.client != item->getSeller() && !item->isWatcher(command.client)) {
+		// Interested whether or not the bid holds up
+		std::lock_guard<std::mutex> lock(m_itemLock);
+		item->addWatcher(command.client);
+	}
+
+	if (command.amount <= item->getCurrentHighest()) {
+		log("[INFO] New bid of %.2f below current bid for item %u, ignoring bid", command.amount, command.itemID);
+		return;
+	}
+	if (item->getSeller() == command.client) {
+		log("[INFO] Client attempting to bid on own item %u, ignoring bid", command.itemID);
+		return;
+	}
+
+	const ClientID previous = item->getHighestBidder();
+	{
+		std::lock_guard<std::mutex> lock(m_itemLock);
+		item->setCurrentHighest(command.amount);
+		item->setHighestBidder(command.client);
+		if (previous != command.client) {
+			removeClientItem(m_leadingItems, previous, item->getItemID());
+			addClientItem(m_leadingItems, command.client, item->getItemID());
+		}
+	}
+	if (previous != command.client) {
+		m_server->m_clients.getState(command.client).leadingBids++;
+		if (previous != INVALID_CLIENT_ID) {
+			m_server->m_clients.getState(previous).leadingBids--;
+		}
+	}
+
+	Event event = {};
+	event.type = EventType::HIGHEST;
+	event.item = item;
+	event.amount = command.amount;
+	event.client = command.client;
+	m_events.push(event);
+}
+
+void AuctionShard::confirmOffer(const Command& command) {
+	auto iter = m_items.find(command.itemID);
+
+	Event event = {};
+	event.type = (iter != m_items.end()) ? EventType::OFFER_CONF : EventType::OFFER_DENIED;
+	event.item = (iter != m_items.end()) ? iter->second : nullptr;
+	event.reqNum = command.reqNum;
+	event.address = command.address;
+	m_events.push(event);
+}
+
+void AuctionShard::watch(const Command& command) {
+	auto iter = m_items.find(command.itemID);
+	if (iter == m_items.end()) {
+		log("[INFO] Item %u not up for auction, ignoring watch", command.itemID);
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_itemLock);
+	if (command.type == CommandType::WATCH) {
+		iter->second->addWatcher(command.client);
+	}
+	else {
+		iter->second->removeWatcher(command.client);
+	}
+}
+
+void AuctionShard::expire() {
+	m_wheel.advance(getMonotonicTime() / TICK, m_expired);
+	if (m_expired.empty()) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_itemLock);
+		for (WheelTimer* timer : m_expired) {
+			const Item* item = reinterpret_cast<Item*>(timer->context);
+			m_items.erase(item->getItemID());
+			removeClientItem(m_sellerItems, item->getSeller(), item->getItemID());
+			removeClientItem(m_leadingItems, item->getHighestBidder(), item->getItemID());
+
+			m_server->m_clients.getState(item->getSeller()).openOffers--;
+			if (item->getHighestBidder() != INVALID_CLIENT_ID) {
+				m_server->m_clients.getState(item->getHighestBidder()).leadingBids--;
+			}
+		}
+	}
+
+	for (WheelTimer* timer : m_expired) {
+		publishEvent(EventType::ENDED, reinterpret_cast<Item*>(timer->context));
+	}
+	m_expired.clear();
+}
+
+void AuctionShard::publishEvent(EventType type, Item* item) {
+	Event event = {};
+	event.type = type;
+	event.item = item;
+	m_events.push(event);
+}
+
+void AuctionShard::publish() {
+	std::vector<Item*> ended;
+
+	while (m_publishing) {
+		const bool published = publishBatch(ended);
+
+		if (!m_pendingHighest.empty() && getMonotonicTime() >= m_nextConflationFlush) {
+			flushHighest(nullptr);
+		}
+
+		if (!published) {
+			m_events.wait(std::chrono::microseconds(TICK / 10));
+			continue;
+		}
+		m_numPublishBatches++;
+
+		// Ended items were already taken off the shard, so a snapshot didn't see them either
+		for (Item* item : ended) {
+			delete item;
+		}
+		ended.clear();
+	}
+
+	// Stopping, matching is done so this is the last of the events. Offers get journaled and ended
+	// auctions still tell their winners.
+	while (publishBatch(ended)) {
+		m_numPublishBatches++;
+	}
+	for (Item* item : ended) {
+		delete item;
+	}
+
+	// Clients still get the last prices
+	flushHighest(nullptr);
+}
+
+bool AuctionShard::publishBatch(std::vector<Item*>& ended) {
+	bool published = false;
+
+	Event event;
+	while (m_events.pop(event)) {
+		published = true;
+
+		switch (event.type) {
+		case EventType::NEW_ITEM:
+			m_server->journalStart(*event.item, event.amount, event.client);
+			if (event.confirm) {
+				m_server->sendOfferConf(event.reqNum, event.item->getItemID(), event.item->getDescription(), event.item->getMinimum(), event.address);
+			}
+			m_server->sendNewItem(*event.item);
+			break;
+		case EventType::HIGHEST:
+			m_server->journalBid(event.item->getItemID(), event.amount, event.client);
+			if (m_conflationTime > 0) {
+				conflateHighest(event);
+			}
+			else {
+				m_server->sendHighest(*event.item, event.amount);
+			}
+			break;
+		case EventType::ENDED: {
+			const Item& item = *event.item;
+			m_server->journalEnd(item.getItemID());
+
+			// The last price goes out before the auction is over
+			flushHighest(&item);
+
+			// SEND TCP PACKETS
+			m_server->sendBidOver(item);
+
+			// Check if anyone bid on the item
+			if (item.getCurrentHighest() != item.getMinimum()) {
+				m_server->sendWin(item);
+				m_server->sendSoldTo(item);
+			}
+			else {
+				m_server->sendNotSold(item);
+			}
+
+			log("[INFO] Auction ended for item number %u with a price of %.2f", item.getItemID(), item.getCurrentHighest());
+			ended.push_back(event.item);
+			break;
+		}
+		case EventType::OFFER_CONF:
+			// Send confirmation
+			m_server->sendOfferConf(event.reqNum, event.item->getItemID(), event.item->getDescription(), event.item->getMinimum(), event.address);
+			break;
+		case EventType::OFFER_DENIED:
+			// REALLY REALLY BAD I hope this never happens
+			m_server->sendOfferDenied(event.reqNum, "Invalid request number", event.address);
+			break;
+		}
+	}
+	return published;
+}
+
+void AuctionShard::conflateHighest(const Event& event) {
+	const uint64 now = getMonotonicTime();
+	if (m_pendingHighest.empty()) {
+		m_nextConflationFlush = now + m_conflationTime;
+	}
+
+	auto iter = m_pendingHighest.find(event.item->getItemID());
+	if (iter == m_pendingHighest.end()) {
+		m_pendingHighest[event.item->getItemID()] = PendingHighest{ event.item, event.amount, now };
+	}
+	else {
+		// Held back since the first one, only the price changes
+		iter->second.amount = event.amount;
+		m_numConflatedHighest++;
+	}
+}
+
+void AuctionShard::sendPendingHighest(const PendingHighest& pending, uint64 now) {
+	m_server->sendHighest(*pending.item, pending.amount);
+
+	const uint64 delay = now - pending.queuedTime;
+	m_numConflatedSent++;
+	m_conflationDelay += delay;
+	if (delay > m_maxConflationDelay) {
+		m_maxConflationDelay = delay;
+	}
+}
+
+void AuctionShard::flushHighest(const Item* item) {
+	if (m_pendingHighest.empty()) {
+		return;
+	}
+
+	const uint64 now = getMonotonicTime();
+	if (item != nullptr) {
+		auto iter = m_pendingHighest.find(item->getItemID());
+		if (iter != m_pendingHighest.end()) {
+			sendPendingHighest(iter->second, now);
+			m_pendingHighest.erase(iter);
+		}
+		return;
+	}
+
+	for (auto& pair : m_pendingHighest) {
+		sendPendingHighest(pair.second, now);
+	}
+	m_pendingHighest.clear();
+}
+
+void AuctionShard::addClientItem(ClientItems& index, ClientID client, uint32 itemID) {
+	index[client].push_back(itemID);
+}
+
+void AuctionShard::removeClientItem(ClientItems& index, ClientID client, uint32 itemID) {
+	auto iter = index.find(client);
+	if (iter == index.end()) {
+		return;
+	}
+
+	// Order doesn't matter, swap the last one in
+	std::vector<uint32>& items = iter->second;
+	for (uint32 i = 0; i < items.size(); i++) {
+		if (items[i] == itemID) {
+			items[i] = items.back();
+			items.pop_back();
+			break;
+		}
+	}
+	if (items.empty()) {
+		index.erase(iter);
+	}
+}
+
+void AuctionShard::forEachWatcher(const Item& item, const std::function<void(ClientID)>& visit) const {
+	std::lock_guard<std::mutex> lock(m_itemLock);
+	for (ClientID client : item.getWatchers()) {
+		visit(client);
+	}
+}
+
+void AuctionShard::getClientItems(ClientID client, std::vector<uint32>& selling, std::vector<uint32>& leading) const {
+	std::lock_guard<std::mutex> lock(m_itemLock);
+
+	auto sellerIter = m_sellerItems.find(client);
+	if (sellerIter != m_sellerItems.end()) {
+		selling.insert(selling.end(), sellerIter->second.begin(), sellerIter->second.end());
+	}
+	auto leadingIter = m_leadingItems.find(client);
+	if (leadingIter != m_leadingItems.end()) {
+		leading.insert(leading.end(), leadingIter->second.begin(), leadingIter->second.end());
+	}
+}
+
+AuctionShard::Statistics AuctionShard::getStatistics() const {
+	Statistics statistics;
+	statistics.commands = m_commands.getConsumed();
+	statistics.batches = m_numBatches;
+	statistics.events = m_events.getConsumed();
+	statistics.publishBatches = m_numPublishBatches;
+	statistics.fullWaits = m_commands.getNumFullWaits() + m_events.getNumFullWaits();
+	statistics.conflatedHighest = m_numConflatedHighest;
+	statistics.conflatedSent = m_numConflatedSent;
+	statistics.conflationDelay = m_conflationDelay;
+	statistics.maxConflationDelay = m_maxConflationDelay;
+
+	std::lock_guard<std::mutex> lock(m_itemLock);
+	statistics.openItems = static_cast<uint32>(m_items.size());
+	return statistics;
+}
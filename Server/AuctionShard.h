@@ -0,0 +1,192 @@
+#pragma once
+
+#include "Types.h"
+#include "IPV4Address.h"
+#include "ClientRegistry.h"
+#include "TimingWheel.h"
+#include "SequenceRing.h"
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class Server;
+class Item;
+
+// A slice of the auctions, an item lives on shard itemID % shard count. Each shard is a two stage
+// pipeline. Commands from any thread are sequenced through a ring into the matching stage, the
+// only thread that changes the shard's items and runs their timers, so competing bids are applied
+// in the order they were sequenced without any lock. What the matching stage decides goes through
+// a second ring to the publishing stage, which sends the notifications and saves, so a slow
+// broadcast or disk never holds up matching.
+class AuctionShard {
+public:
+	enum class CommandType : uint8 {
+		START,			// Takes ownership of item
+		BID,
+		CONFIRM_OFFER,	// Repeated OFFER, confirmed again if the item is still up
+		WATCH,
+		UNWATCH
+	};
+
+	struct Command {
+		CommandType type;
+		Item* item;
+		uint64 auctionTime;
+		uint32 itemID;
+		float32 amount;
+		ClientID client;
+		uint32 reqNum;
+		IPV4Address address;
+		bool confirm;		// START confirms the offer to address once the auction is journaled
+	};
+
+	enum class EventType : uint8 {
+		NEW_ITEM,
+		HIGHEST,
+		ENDED,			// Takes ownership of item
+		OFFER_CONF,
+		OFFER_DENIED
+	};
+
+	struct Event {
+		EventType type;
+		Item* item;
+		float32 amount;		// The price the HIGHEST announces, the item may have moved on since
+		ClientID client;	// Who bid it
+		uint32 reqNum;
+		IPV4Address address;
+		bool confirm;		// NEW_ITEM confirms the offer to address
+	};
+
+	struct Statistics {
+		uint64 commands;
+		uint64 batches;		// Times the matching stage found commands waiting
+		uint64 events;
+		uint64 publishBatches;
+		uint64 fullWaits;	// Times a producer found a ring full
+		uint32 openItems;
+		uint64 conflatedHighest;	// HIGHEST replaced by a newer one before it went out
+		uint64 conflatedSent;		// HIGHEST held back and sent at the end of a conflation tick
+		uint64 conflationDelay;		// Total and longest time those were held back, in 100 nanosecond ticks
+		uint64 maxConflationDelay;
+	};
+private:
+	static constexpr uint64 TICK = 100000;	// 10 milliseconds, in 100 nanosecond ticks
+
+	// Newest price of an item waiting for the end of the conflation tick
+	struct PendingHighest {
+		Item* item;
+		float32 amount;
+		uint64 queuedTime;
+	};
+
+	Server* m_server;
+	uint32 m_index;
+	uint32 m_numShards;
+
+	// IDs handed out to new items, all equal to the shard's index modulo the shard count
+	std::atomic<uint32> m_nextItemID;
+
+	SequenceRing<Command> m_commands;
+	SequenceRing<Event> m_events;
+
+	std::atomic<bool> m_matching;
+	std::atomic<bool> m_publishing;
+	std::thread m_matchThread;
+	std::thread m_publishThread;
+
+	// Only taken by the matching stage while it changes the items, readers elsewhere like saving
+	// and resyncing take it to see them in a consistent state
+	mutable std::mutex m_itemLock;
+	std::unordered_map<uint32, Item*> m_items;
+
+	// Open item IDs by seller and by highest bidder, kept with the items
+	typedef std::unordered_map<ClientID, std::vector<uint32>> ClientItems;
+	ClientItems m_sellerItems;
+	ClientItems m_leadingItems;
+
+	TimingWheel m_wheel;
+	std::vector<WheelTimer*> m_expired;
+
+	std::atomic<uint64> m_numBatches;
+	std::atomic<uint64> m_numPublishBatches;
+
+	// Publishing stage only. With a conflation time, HIGHEST is sent at most once per item per tick.
+	uint64 m_conflationTime;
+	uint64 m_nextConflationFlush;
+	std::unordered_map<uint32, PendingHighest> m_pendingHighest;
+	std::atomic<uint64> m_numConflatedHighest;
+	std::atomic<uint64> m_numConflatedSent;
+	std::atomic<uint64> m_conflationDelay;
+	std::atomic<uint64> m_maxConflationDelay;
+
+	void match();
+	// Handles every command queued, false if there were none
+	bool matchBatch();
+	// Takes the item into the shard and its timer, nothing is announced
+	void insert(Item* item, uint64 auctionTime);
+	void start(const Command& command);
+	void bid(const Command& command);
+	void confirmOffer(const Command& command);
+	void watch(const Command& command);
+	void expire();
+	void publishEvent(EventType type, Item* item);
+
+	static void addClientItem(ClientItems& index, ClientID client, uint32 itemID);
+	static void removeClientItem(ClientItems& index, ClientID client, uint32 itemID);
+
+	void publish();
+	// Publishes every event queued and collects the items that ended, false if there were none
+	bool publishBatch(std::vector<Item*>& ended);
+	void conflateHighest(const Event& event);
+	void sendPendingHighest(const PendingHighest& pending, uint64 now);
+	// Sends every pending HIGHEST, or only the item's if one is given
+	void flushHighest(const Item* item);
+public:
+	// A conflation time of zero sends every HIGHEST right away
+	AuctionShard(Server* server, uint32 index, uint32 numShards, uint32 ringSize, uint64 conflationTime);
+	virtual ~AuctionShard();
+
+	// Safe from any thread
+	uint32 allocateItemID();
+	// Keeps new IDs clear of ones handed out before a restart
+	void reserveItemIDs(uint32 highestID);
+
+	void startAuction(Item* item, uint64 auctionTime);
+	// A new offer, confirmed once its auction is journaled
+	void offerAuction(Item* item, uint32 reqNum, const IPV4Address& address);
+	// Puts an auction saved before a restart straight back, without announcing or journaling it.
+	// Only before launch, the calling thread stands in for the matching stage.
+	void restoreAuction(Item* item, uint64 auctionTime);
+	void bid(uint32 itemID, float32 amount, ClientID bidder);
+	void confirmOffer(uint32 itemID, uint32 reqNum, const IPV4Address& address);
+	void watch(uint32 itemID, ClientID client, bool watching);
+
+	void launch();
+	// Whatever is still in the rings is handled first, matching before publishing. Nothing may push
+	// commands by then.
+	void stop();
+
+	// Calls visit for every open item with the item lock held
+	template<typename Visitor>
+	void forEachItem(Visitor visit) const {
+		std::lock_guard<std::mutex> lock(m_itemLock);
+		for (auto& pair : m_items) {
+			visit(*pair.second);
+		}
+	}
+
+	// Calls visit for every client watching the item with the item lock held. The item has to be
+	// one of this shard's, it can have ended as long as it hasn't been deleted yet.
+	void forEachWatcher(const Item& item, const std::function<void(ClientID)>& visit) const;
+
+	// Appends the client's open items on this shard
+	void getClientItems(ClientID client, std::vector<uint32>& selling, std::vector<uint32>& leading) const;
+
+	Statistics getStatistics() const;
+	uint32 getIndex() const { return m_index; }
+};
@@ -0,0 +1,39 @@
+#include "ClientRegistry.h"
+
+void ClientRegistry::reserve(uint32 numClients) {
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_ids.reserve(numClients);
+	m_addresses.reserve(numClients);
+}
+
+ClientID ClientRegistry::intern(const IPV4Address& address) {
+	std::lock_guard<std::mutex> lock(m_lock);
+
+	auto iter = m_ids.find(address.getEndpointKey());
+	if (iter != m_ids.end()) {
+		return iter->second;
+	}
+
+	m_addresses.push_back(address);
+	m_states.emplace_back();
+	const ClientID id = static_cast<ClientID>(m_addresses.size());
+	m_ids.emplace(address.getEndpointKey(), id);
+	return id;
+}
+
+ClientID ClientRegistry::find(const EndpointKey& key) const {
+	std::lock_guard<std::mutex> lock(m_lock);
+
+	auto iter = m_ids.find(key);
+	return (iter != m_ids.end()) ? iter->second : INVALID_CLIENT_ID;
+}
+
+IPV4Address ClientRegistry::getAddress(ClientID id) const {
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_addresses.at(id - 1);
+}
+
+ClientState& ClientRegistry::getState(ClientID id) {
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_states.at(id - 1);
+}
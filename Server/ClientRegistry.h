@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Types.h"
+#include "IPV4Address.h"
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Handle for a client, stays the same for as long as the server runs
+typedef uint32 ClientID;
+
+static constexpr ClientID INVALID_CLIENT_ID = 0;
+
+// What the auction shards keep track of per client, so checks that span every item don't have to
+// ask each shard
+struct ClientState {
+	std::atomic<int32> openOffers;		// Items offered and not yet ended, counted from the moment they are accepted
+	std::atomic<int32> leadingBids;		// Open items the client is the highest bidder on
+
+	ClientState() : openOffers(0), leadingBids(0) {}
+};
+
+// Hands out a ClientID per client address so connections and items refer to clients by a small
+// integer. IDs are never reused, a client that deregisters and comes back gets the same one.
+// Safe to use from any thread, the lock is never held while taking another one.
+class ClientRegistry {
+private:
+	mutable std::mutex m_lock;
+	std::unordered_map<EndpointKey, ClientID, EndpointKeyHash> m_ids;
+	std::vector<IPV4Address> m_addresses;	// Indexed by ID - 1
+	std::deque<ClientState> m_states;		// Same, a deque so references survive it growing
+public:
+	// Room for that many clients in total, for loading a lot of them at once
+	void reserve(uint32 numClients);
+
+	ClientID intern(const IPV4Address& address);
+	// INVALID_CLIENT_ID if the address was never interned
+	ClientID find(const EndpointKey& key) const;
+
+	// Address the client was first seen at, for logging and persistence
+	IPV4Address getAddress(ClientID id) const;
+	ClientState& getState(ClientID id);
+};
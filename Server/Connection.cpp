@@ -1,21 +1,27 @@
 #include "Connection.h"
 
 #include "TCPSocket.h"
+#include "CompletionPort.h"
 #include "Log.h"
+#include "Messages.h"
 
 Connection::Connection() :
 	m_state(ConnectionState::DISCONNECTED)
+	, m_clientID(INVALID_CLIENT_ID)
 	, m_tcpSocket(nullptr)
 	, m_offerReqNumber(0)
+	, m_stale(false)
 {}
 
-Connection::Connection(const std::string& name, const IPV4Address& address) :
+Connection::Connection(ClientID clientID, const std::string& name, const IPV4Address& address) :
 	m_state(ConnectionState::DISCONNECTED)
+	, m_clientID(clientID)
 	, m_tcpSocket(nullptr)
 	, m_uniqueName(name)
 	, m_address(address)
 	, m_offerReqNumber(0)
 	, m_lastItemOfferedID(0)
+	, m_stale(false)
 {}
 
 
@@ -23,22 +29,32 @@ Connection::~Connection() {
 	delete m_tcpSocket;
 }
 
-void Connection::connect(TCPSocket&& socket, HANDLE ioCompletionPort) {
+void Connection::connect(TCPSocket&& socket, CompletionPort& completionPort) {
+	// The socket of an earlier connection is closed by now
+	delete m_tcpSocket;
 	m_tcpSocket = new TCPSocket(std::move(socket));
 	m_state = ConnectionState::CONNECTED;
+	m_frameReader.reset();
+	m_stale = false;
 
-	CreateIoCompletionPort(m_tcpSocket->getWinSockHandle(), ioCompletionPort, (ULONG_PTR)this, 0);
+	completionPort.associate(*m_tcpSocket, reinterpret_cast<uintptr>(this));
 
 	m_tcpSocket->receiveOverlapped(m_overlappedBuffer);
 }
 
 void Connection::shutdown() {
 	if (m_state != ConnectionState::DISCONNECTED) {
-		m_tcpSocket->shutdown();
+		try {
+			m_tcpSocket->shutdown();
+		}
+		catch (int32) {
+			// Already reset by the client, closing is all that's left
+		}
 		m_tcpSocket->close();
 		m_state = ConnectionState::DISCONNECTED;
 		m_offerReqNumber = 0;
 		m_lastItemOfferedID = 0;
+		m_stale = false;
 	}
 }
 
@@ -48,4 +64,35 @@ void Connection::send(const Packet& packet) {
 
 void Connection::receiveOverlapped() {
 	m_tcpSocket->receiveOverlapped(m_overlappedBuffer);
-}
\ No newline at end of file
+}
+SendQueueDepth Connection::getSendQueueDepth() const {
+	CompletionPort* port = (m_state == ConnectionState::CONNECTED) ? m_tcpSocket->getCompletionPort() : nullptr;
+	if (port == nullptr) {
+		return SendQueueDepth{ 0, 0 };
+	}
+	return port->getSendQueueDepth(*m_tcpSocket);
+}
+
+static bool isQueuedHighest(const Packet& packet, void* context) {
+	const uint32* itemNum = reinterpret_cast<const uint32*>(context);
+	if (static_cast<MessageType>(packet.getMessageData()[0]) != MessageType::MSG_HIGHEST) {
+		return false;
+	}
+	return itemNum == nullptr || reinterpret_cast<const HighestMessage*>(packet.getMessageData())->itemNum == *itemNum;
+}
+
+uint32 Connection::dropQueuedHighest(uint32 itemNum, uint32 maxCount) {
+	CompletionPort* port = (m_state == ConnectionState::CONNECTED) ? m_tcpSocket->getCompletionPort() : nullptr;
+	if (port == nullptr) {
+		return 0;
+	}
+	return port->dropQueuedSends(*m_tcpSocket, isQueuedHighest, &itemNum, maxCount);
+}
+
+uint32 Connection::dropQueuedHighest() {
+	CompletionPort* port = (m_state == ConnectionState::CONNECTED) ? m_tcpSocket->getCompletionPort() : nullptr;
+	if (port == nullptr) {
+		return 0;
+	}
+	return port->dropQueuedSends(*m_tcpSocket, isQueuedHighest, nullptr, 0xFFFFFFFF);
+}
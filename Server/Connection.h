@@ -2,11 +2,13 @@
 
 #include "ThreadPool.h"
 #include "OverlappedBuffer.h"
+#include "FrameReader.h"
 #include "IPV4Address.h"
 #include "Packet.h"
+#include "CompletionPort.h"
+#include "ClientRegistry.h"
 
 #include <string>
-#include <Windows.h>
 
 class TCPSocket;
 
@@ -19,23 +21,30 @@ public:
 private:
 	ConnectionState m_state;
 
+	ClientID m_clientID;
 	IPV4Address m_address;
 	std::string m_uniqueName;
 
 	TCPSocket* m_tcpSocket;
 	OverlappedBuffer m_overlappedBuffer;
+	FrameReader m_frameReader;
 
 	uint32 m_offerReqNumber;
 	uint32 m_lastItemOfferedID;
+
+	// Fell too far behind to be sent every HIGHEST, gets the current state once it catches up
+	bool m_stale;
 public:
 	Connection();
-	Connection(const std::string& name, const IPV4Address& address);
+	Connection(ClientID clientID, const std::string& name, const IPV4Address& address);
 	virtual ~Connection();
 
-	void connect(TCPSocket&& socket, HANDLE ioCompletionPort);
+	void connect(TCPSocket&& socket, CompletionPort& completionPort);
 	void shutdown();
 
 	OverlappedBuffer& getOverlappedBuffer() { return m_overlappedBuffer; }
+	FrameReader& getFrameReader() { return m_frameReader; }
+	ClientID getClientID() const { return m_clientID; }
 	const IPV4Address& getAddress() const { return m_address; }
 	std::string getUniqueName() const { return m_uniqueName; }
 	void setUniqueName(const char* name) { m_uniqueName = std::string(name); }
@@ -49,7 +58,16 @@ public:
 	void setLastItemOfferedID(uint32 itemOfferedID) { m_lastItemOfferedID = itemOfferedID; }
 	uint32 getLastItemOfferedID() const { return m_lastItemOfferedID; }
 
+	void setStale(bool stale) { m_stale = stale; }
+	bool isStale() const { return m_stale; }
+
+	// Queued on the connection's completion port and written out by it, never blocks the caller
 	void send(const Packet& packet);
+	SendQueueDepth getSendQueueDepth() const;
+	// Drops queued HIGHEST messages that haven't started going out, for a single item or for all
+	// of them, oldest first. Returns how many were dropped.
+	uint32 dropQueuedHighest(uint32 itemNum, uint32 maxCount);
+	uint32 dropQueuedHighest();
 	void receiveOverlapped();
 };
 
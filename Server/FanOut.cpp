@@ -0,0 +1,89 @@
+#include "FanOut.h"
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+FanOut::FanOut(uint32 chunkSize) :
+	m_chunkSize(std::max(chunkSize, 1u))
+	, m_numBroadcasts(0)
+	, m_numRecipients(0)
+	, m_numParallelBroadcasts(0)
+	, m_numHelpedChunks(0)
+{}
+
+void FanOut::runChunks(Job& job, bool helping) {
+	// recipients is only touched once a chunk is claimed, a late helper finds none left and the
+	// broadcasting thread may have returned already
+	uint32 numDone = 0;
+	for (uint32 chunk = job.nextChunk++; chunk < job.numChunks; chunk = job.nextChunk++) {
+		const uint32 end = std::min((chunk + 1) * job.chunkSize, job.numRecipients);
+		for (uint32 i = chunk * job.chunkSize; i < end; i++) {
+			job.func(*(*job.recipients)[i], job.context);
+		}
+		numDone++;
+	}
+
+	if (numDone > 0) {
+		// Counted before the broadcasting thread can see the last chunk done, the owner may be gone after
+		if (helping) {
+			job.owner->m_numHelpedChunks += numDone;
+		}
+
+		std::lock_guard<std::mutex> lock(job.lock);
+		job.doneChunks += numDone;
+		if (job.doneChunks == job.numChunks) {
+			job.finished.notify_all();
+		}
+	}
+}
+
+void FanOut::helpRoutine(void* parameter) {
+	std::shared_ptr<Job>* job = reinterpret_cast<std::shared_ptr<Job>*>(parameter);
+
+	// Too late if the broadcasting thread already took every chunk, the job is then only freed here
+	runChunks(**job, true);
+	delete job;
+}
+
+void FanOut::run(std::vector<Connection*>& recipients, RecipientFunc func, void* context) {
+	m_numBroadcasts++;
+	m_numRecipients += recipients.size();
+
+	const uint32 numRecipients = static_cast<uint32>(recipients.size());
+	if (numRecipients <= m_chunkSize) {
+		// Not worth waking anyone up for
+		for (Connection* connection : recipients) {
+			func(*connection, context);
+		}
+		return;
+	}
+	m_numParallelBroadcasts++;
+
+	std::shared_ptr<Job> job = std::make_shared<Job>();
+	job->owner = this;
+	job->recipients = &recipients;
+	job->numRecipients = numRecipients;
+	job->func = func;
+	job->context = context;
+	job->chunkSize = m_chunkSize;
+	job->numChunks = (numRecipients + m_chunkSize - 1) / m_chunkSize;
+	job->nextChunk = 0;
+	job->doneChunks = 0;
+
+	// One chunk is left for this thread
+	const uint32 numHelpers = std::min(job->numChunks - 1, ThreadPool::get()->getNumWorkers());
+	for (uint32 i = 0; i < numHelpers; i++) {
+		ThreadPool::get()->submit(helpRoutine, new std::shared_ptr<Job>(job));
+	}
+
+	runChunks(*job, false);
+
+	// Chunks a helper took are still being worked on
+	std::unique_lock<std::mutex> lock(job->lock);
+	job->finished.wait(lock, [&job]() { return job->doneChunks == job->numChunks; });
+}
+
+FanOutStatistics FanOut::getStatistics() const {
+	return FanOutStatistics{ m_numBroadcasts, m_numRecipients, m_numParallelBroadcasts, m_numHelpedChunks };
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Types.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class Connection;
+
+typedef void (*RecipientFunc)(Connection& connection, void* context);
+
+struct FanOutStatistics {
+	uint64 broadcasts;
+	uint64 recipients;
+	uint64 parallelBroadcasts;	// Big enough to be split between threads
+	uint64 helpedChunks;		// Chunks a pool worker did instead of the broadcasting thread
+};
+
+// Hands one already serialized message to many connections. The recipients are cut in chunks and
+// pool workers are asked to help, while the broadcasting thread works through the chunks too, so
+// a broadcast finishes even when every worker is busy or blocked. run() returns once every
+// recipient was handled, so the caller can keep the connections alive by holding its lock.
+class FanOut {
+private:
+	// Shared with the helper tasks, which may only get to run after the broadcast is over
+	struct Job {
+		FanOut* owner;
+		std::vector<Connection*>* recipients;	// Owned by the broadcasting thread, only valid while a chunk is unclaimed or in progress
+		uint32 numRecipients;
+		RecipientFunc func;
+		void* context;
+		uint32 chunkSize;
+		uint32 numChunks;
+
+		std::atomic<uint32> nextChunk;
+		std::mutex lock;
+		std::condition_variable finished;
+		uint32 doneChunks;	// Guarded by lock
+	};
+
+	uint32 m_chunkSize;
+
+	std::atomic<uint64> m_numBroadcasts;
+	std::atomic<uint64> m_numRecipients;
+	std::atomic<uint64> m_numParallelBroadcasts;
+	std::atomic<uint64> m_numHelpedChunks;
+
+	static void helpRoutine(void* parameter);
+	static void runChunks(Job& job, bool helping);
+public:
+	explicit FanOut(uint32 chunkSize);
+
+	void run(std::vector<Connection*>& recipients, RecipientFunc func, void* context);
+
+	FanOutStatistics getStatistics() const;
+};
@@ -1,26 +1,39 @@
 #include "Item.h"
 
+#include <algorithm>
 
-uint32 Item::s_nextId = 1;
 
-Item::Item(const std::string& description, float32 minimum, const std::string& seller) :
-	m_description(description)
-	, m_minimum(minimum)
-	, m_currentHighest(minimum)
-	, m_seller(seller)
-	, m_auctionStartTime(0)
-{
-	m_itemID = s_nextId++;
-}
-
-Item::Item(const std::string& description, float32 minimum, const std::string& seller, uint32 itemID) :
+Item::Item(const std::string& description, float32 minimum, ClientID seller, uint32 itemID) :
 	m_description(description)
 	, m_minimum(minimum)
 	, m_currentHighest(minimum)
 	, m_seller(seller)
+	, m_highestBidder(INVALID_CLIENT_ID)
 	, m_auctionStartTime(0)
 	, m_itemID(itemID)
 {}
 
 
 Item::~Item() {}
+
+bool Item::addWatcher(ClientID client) {
+	auto iter = std::lower_bound(m_watchers.begin(), m_watchers.end(), client);
+	if (iter != m_watchers.end() && *iter == client) {
+		return false;
+	}
+	m_watchers.insert(iter, client);
+	return true;
+}
+
+bool Item::isWatcher(ClientID client) const {
+	return std::binary_search(m_watchers.begin(), m_watchers.end(), client);
+}
+
+bool Item::removeWatcher(ClientID client) {
+	auto iter = std::lower_bound(m_watchers.begin(), m_watchers.end(), client);
+	if (iter == m_watchers.end() || *iter != client) {
+		return false;
+	}
+	m_watchers.erase(iter);
+	return true;
+}
@@ -2,7 +2,11 @@
 
 #include "Types.h"
 #include <string>
-#include "IPV4Address.h"
+#include <vector>
+#include "ClientRegistry.h"
+#include "TimingWheel.h"
+
+static constexpr uint64 AUCTION_TIME = 3000000000ull;	// 5 minutes, in 100 nanosecond ticks
 
 class Item {
 private:
@@ -12,30 +16,37 @@ private:
 	float32 m_minimum;
 	float32 m_currentHighest;
 
-	std::string m_seller;
-	std::string m_highestBidder;
+	ClientID m_seller;
+	ClientID m_highestBidder;	// INVALID_CLIENT_ID until someone bids
 
 	uint64 m_auctionStartTime;
+	WheelTimer m_expiryTimer;
 
-	static uint32 s_nextId;
+	// Clients sent the item's HIGHEST, sorted
+	std::vector<ClientID> m_watchers;
 public:
-	Item(const std::string& description, float32 minimum, const std::string& seller, uint32 itemID);
-	Item(const std::string& description, float32 minimum, const std::string& seller);
+	// IDs come from the auction shard the item is going to
+	Item(const std::string& description, float32 minimum, ClientID seller, uint32 itemID);
 	virtual ~Item();
 
 	uint32 getItemID() const { return m_itemID; }
 	std::string getDescription() const { return m_description; }
 	float32 getMinimum() const { return m_minimum; }
 	float32 getCurrentHighest() const { return m_currentHighest; }
-	std::string getSeller() const { return m_seller; }
-	std::string getHighestBidder() const { return m_highestBidder; }
+	ClientID getSeller() const { return m_seller; }
+	ClientID getHighestBidder() const { return m_highestBidder; }
 
 	void setCurrentHighest(float32 newBid) { m_currentHighest = newBid; }
-	void setHighestBidder(const std::string& highestBidder) { m_highestBidder = highestBidder; }
+	void setHighestBidder(ClientID highestBidder) { m_highestBidder = highestBidder; }
 
 	void setAuctionStartTime(uint64 time) { m_auctionStartTime = time; }
 	uint64 getAuctionStartTime() const { return m_auctionStartTime; }
+	WheelTimer& getExpiryTimer() { return m_expiryTimer; }
 
-	static void setNextID(uint32 id) { s_nextId = id; }
+	// Both return false if nothing changed
+	bool addWatcher(ClientID client);
+	bool removeWatcher(ClientID client);
+	bool isWatcher(ClientID client) const;
+	const std::vector<ClientID>& getWatchers() const { return m_watchers; }
 };
 
@@ -10,21 +10,119 @@
 #include "Log.h"
 #include "Error.h"
 
-#include <Windows.h>
+#include "Platform.h"
+
+#ifndef _WIN32
+#include <csignal>
+#include <cstdlib>
+#include <thread>
+#endif
 
 std::mutex g_lock;
 
 Server* g_Server = nullptr;
 
-void init(const std::string& ip);
+void init(const std::string& ip, const ServerOptions& options);
 void shutdown();
 
+#ifdef _WIN32
 BOOL WINAPI closeRoutine(_In_ DWORD ctrlType) {
 	shutdown();
 	return true;
 }
+#else
+void closeRoutine(sigset_t signals) {
+	int32 signal = 0;
+	sigwait(&signals, &signal);
+	shutdown();
+	std::exit(0);
+}
+#endif
+
+// "durable" or "immediate"
+ConfirmPolicy parseConfirmPolicy(const std::string& policy) {
+	return (policy == "durable") ? ConfirmPolicy::DURABLE : ConfirmPolicy::IMMEDIATE;
+}
+
+int main(int argc, char** argv) {
+	ServerOptions options;
+	for (int32 i = 1; i < argc; i++) {
+		std::string arg(argv[i]);
+		if (arg == "--io-uring") {
+			options.ioEngine = IOEngine::IO_URING;
+		}
+		else if (arg.compare(0, 14, "--udp-buffers=") == 0) {
+			options.udpReceiveBuffers = static_cast<uint32>(std::stoul(arg.substr(14)));
+		}
+		else if (arg.compare(0, 13, "--udp-shards=") == 0) {
+			options.udpShards = static_cast<uint32>(std::stoul(arg.substr(13)));
+		}
+		else if (arg.compare(0, 14, "--udp-threads=") == 0) {
+			options.udpServiceThreads = static_cast<uint32>(std::stoul(arg.substr(14)));
+		}
+		else if (arg.compare(0, 20, "--udp-socket-buffer=") == 0) {
+			options.udpSocketBufferSize = static_cast<uint32>(std::stoul(arg.substr(20)));
+		}
+		else if (arg.compare(0, 22, "--send-queue-messages=") == 0) {
+			options.sendQueueMessages = static_cast<uint32>(std::stoul(arg.substr(22)));
+		}
+		else if (arg.compare(0, 19, "--send-queue-bytes=") == 0) {
+			options.sendQueueBytes = static_cast<uint32>(std::stoul(arg.substr(19)));
+		}
+		else if (arg.compare(0, 17, "--auction-shards=") == 0) {
+			options.auctionShards = static_cast<uint32>(std::stoul(arg.substr(17)));
+		}
+		else if (arg.compare(0, 20, "--auction-ring-size=") == 0) {
+			options.auctionRingSize = static_cast<uint32>(std::stoul(arg.substr(20)));
+		}
+		else if (arg.compare(0, 16, "--fan-out-chunk=") == 0) {
+			options.fanOutChunkSize = static_cast<uint32>(std::stoul(arg.substr(16)));
+		}
+		else if (arg.compare(0, 19, "--conflate-highest=") == 0) {
+			options.highestConflationTime = static_cast<uint32>(std::stoul(arg.substr(19)));
+		}
+		else if (arg == "--highest-to-all") {
+			options.highestToWatchers = false;
+		}
+		else if (arg == "--journal-sync=none") {
+			options.journalSync = JournalSyncPolicy::NONE;
+		}
+		else if (arg == "--journal-sync=commit") {
+			options.journalSync = JournalSyncPolicy::COMMIT;
+		}
+		else if (arg == "--journal-sync=interval") {
+			options.journalSync = JournalSyncPolicy::INTERVAL;
+		}
+		else if (arg.compare(0, 24, "--journal-sync-interval=") == 0) {
+			options.journalSyncInterval = static_cast<uint32>(std::stoul(arg.substr(24)));
+		}
+		else if (arg.compare(0, 23, "--journal-compact-size=") == 0) {
+			options.journalCompactSize = static_cast<uint32>(std::stoul(arg.substr(23)));
+		}
+		else if (arg.compare(0, 16, "--persist-queue=") == 0) {
+			options.persistQueueSize = static_cast<uint32>(std::stoul(arg.substr(16)));
+		}
+		else if (arg.compare(0, 21, "--confirm-registered=") == 0) {
+			options.registeredConfirm = parseConfirmPolicy(arg.substr(21));
+		}
+		else if (arg.compare(0, 16, "--confirm-dereg=") == 0) {
+			options.deregConfirm = parseConfirmPolicy(arg.substr(16));
+		}
+		else if (arg.compare(0, 16, "--confirm-offer=") == 0) {
+			options.offerConfirm = parseConfirmPolicy(arg.substr(16));
+		}
+		else if (arg == "--slow-consumer=drop") {
+			options.slowConsumerPolicy = SlowConsumerPolicy::DROP_OLDEST_HIGHEST;
+		}
+		else if (arg == "--slow-consumer=disconnect") {
+			options.slowConsumerPolicy = SlowConsumerPolicy::DISCONNECT;
+		}
+		else if (arg == "--slow-consumer=resync") {
+			options.slowConsumerPolicy = SlowConsumerPolicy::RESYNC;
+		}
+	}
 
-int main() {
+#ifdef _WIN32
 	// Set callback when console is closed
 	SetConsoleCtrlHandler(closeRoutine, true);
 
@@ -35,36 +133,54 @@ int main() {
 		GetConsoleMode(inputHandle, &mode);
 		SetConsoleMode(inputHandle, mode & (~ENABLE_QUICK_EDIT_MODE));
 	}
+#else
+	// Block termination signals before any other thread exists so they all inherit the mask,
+	// then shut down from a regular thread once one arrives
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+	std::thread(closeRoutine, signals).detach();
+#endif
 
 	std::cout << "Local ip: ";
 	std::string ip;
 	std::cin >> ip;
 
 	log("[INFO] Initializing server...");
-	init(ip);
+	init(ip, options);
 
 	std::string cmd;
 	do {
 		std::cin >> cmd;
-	} while (cmd != std::string("shutdown"));
+		if (cmd == std::string("stats")) {
+			std::lock_guard<std::mutex> lock(g_lock);
+			if (g_Server != nullptr) {
+				g_Server->logStatistics();
+			}
+		}
+	} while (cmd != std::string("shutdown") && std::cin);
 
 	shutdown();
 
 	return 0;
 }
 
-void init(const std::string& ip) {
+void init(const std::string& ip, const ServerOptions& options) {
 	std::lock_guard<std::mutex> lock(g_lock);
 
 	initErrorCodeStringMap();
 	ThreadPool::init();
 	WSA::init();
 
-	g_Server = new Server(IPV4Address(ip, DEFAULT_PORT));
+	g_Server = new Server(IPV4Address(ip, DEFAULT_PORT), options);
 	g_Server->loadConnections();
+	g_Server->startPersistenceThread();
 	g_Server->startUDPServiceThread();
 	g_Server->startTCPServiceThread();
 	g_Server->startConnectionServiceThread();
+	g_Server->startAuctionShards();
 }
 
 void shutdown() {
@@ -76,5 +192,6 @@ void shutdown() {
 		ThreadPool::destroy();
 		WSA::destroy();
 		delete g_Server;
+		g_Server = nullptr;
 	}
 }
\ No newline at end of file
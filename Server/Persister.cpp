@@ -0,0 +1,256 @@
+#include "Persister.h"
+
+#include "Server.h"
+#include "Journal.h"
+#include "Log.h"
+#include "Clock.h"
+
+#include <algorithm>
+#include <chrono>
+
+Persister::Persister(Server* server, Journal& journal, const std::string& snapshotPath, uint32 queueSize, uint64 compactSize) :
+	m_server(server)
+	, m_journal(journal)
+	, m_snapshotPath(snapshotPath)
+	, m_compactSize(compactSize)
+	, m_entries(queueSize)
+	, m_running(false)
+	, m_lastOffset(0)
+	, m_checkpointing(false)
+	, m_checkpointSize(compactSize)
+	, m_checkpointTime(0)
+	, m_checkpointWritten(false)
+	, m_checkpointSaved(false)
+	, m_numBatches(0)
+	, m_numConfirmations(0)
+	, m_lag(0)
+	, m_maxLag(0)
+	, m_numCheckpoints(0)
+	, m_checkpointDuration(0)
+	, m_maxCheckpointDuration(0)
+{}
+
+Persister::~Persister() {
+	stop();
+
+	Entry entry;
+	while (m_entries.pop(entry)) {
+		delete entry.record;
+	}
+}
+
+void Persister::persist(uint8 type, JournalRecord* record) {
+	Entry entry = {};
+	entry.type = type;
+	entry.record = record;
+	entry.queuedTime = getSystemTime();
+	m_entries.push(entry);
+}
+
+void Persister::confirm(const Packet& confirmation) {
+	Entry entry = {};
+	entry.confirmation = confirmation;
+	entry.queuedTime = getSystemTime();
+	m_entries.push(entry);
+}
+
+void Persister::launch() {
+	m_running = true;
+	m_thread = std::thread(&Persister::run, this);
+}
+
+void Persister::stop() {
+	m_running = false;
+	m_entries.wake();
+	if (m_thread.joinable()) {
+		m_thread.join();
+	}
+}
+
+void Persister::run() {
+	while (m_running) {
+		if (!persistBatch()) {
+			// Idle, the tail of the journal still gets synced within the interval
+			if (!m_journal.syncWritten(false)) {
+				log("[ERROR] Failed to sync the journal, changes are no longer saved");
+			}
+			releaseConfirmations();
+			if (m_confirmations.empty()) {
+				m_entries.wait(std::chrono::milliseconds(10));
+			}
+			else {
+				// Held back until the next sync
+				m_entries.wait(std::chrono::milliseconds(1));
+			}
+		}
+
+		if (m_checkpointing) {
+			if (m_checkpointWritten) {
+				endCheckpoint();
+			}
+		}
+		else if (m_journal.getSize() >= m_checkpointSize) {
+			beginCheckpoint();
+		}
+	}
+
+	// Stopping, what was queued before still goes out
+	while (persistBatch()) {}
+	if (m_checkpointing) {
+		endCheckpoint();
+	}
+	if (!m_journal.syncWritten(true)) {
+		log("[ERROR] Failed to sync the journal, changes are no longer saved");
+	}
+	releaseConfirmations();
+}
+
+bool Persister::persistBatch() {
+	uint64 offset = 0;
+	uint32 numEntries = 0;
+	uint64 queuedTime = 0;	// Total over the batch, for the lag
+	uint64 oldest = 0;
+
+	// Bounded so confirmations queued behind a steady stream of changes still go out
+	const uint64 end = m_entries.getPushed();
+	Entry entry;
+	while (m_entries.getConsumed() < end && m_entries.pop(entry)) {
+		if (numEntries == 0) {
+			oldest = entry.queuedTime;
+		}
+		numEntries++;
+		queuedTime += entry.queuedTime;
+
+		if (entry.record != nullptr) {
+			offset = m_journal.append(entry.type, *entry.record);
+			m_lastOffset = offset;
+			if (m_checkpointing) {
+				m_deferred.push_back(std::make_pair(entry.type, entry.record));
+			}
+			else {
+				apply(entry.type, *entry.record);
+				delete entry.record;
+			}
+		}
+		else {
+			m_confirmations.push_back(std::make_pair(m_lastOffset, entry.confirmation));
+		}
+	}
+	if (numEntries == 0) {
+		return false;
+	}
+
+	if (offset > 0 && !m_journal.commit(offset)) {
+		log("[ERROR] Failed to write the journal, changes are no longer saved");
+	}
+
+	const uint64 now = getSystemTime();
+	m_numBatches++;
+	m_lag += now * numEntries - queuedTime;
+	const uint64 lag = now - oldest;
+	if (lag > m_maxLag) {
+		m_maxLag = lag;
+	}
+
+	releaseConfirmations();
+	return true;
+}
+
+void Persister::releaseConfirmations() {
+	if (m_confirmations.empty()) {
+		return;
+	}
+
+	// Sent even if writing failed, the change itself was made and the failure is logged
+	const uint64 durable = m_journal.hasFailed() ? UINT64_MAX : m_journal.getDurable();
+	auto iter = m_confirmations.begin();
+	for (; iter != m_confirmations.end() && iter->first <= durable; ++iter) {
+		m_server->sendConfirmation(iter->second);
+		m_numConfirmations++;
+	}
+	m_confirmations.erase(m_confirmations.begin(), iter);
+}
+
+void Persister::apply(uint8 type, const JournalRecord& record) {
+	JournalReader reader(record.getData(), record.getSize());
+	m_image.apply(static_cast<RecordType>(type), reader);
+}
+
+void Persister::beginCheckpoint() {
+	m_checkpointTime = getSystemTime();
+
+	// Marks where the snapshot ends, should it be saved and the server stop before the journal
+	// starts over
+	JournalRecord marker;
+	marker.writeUInt64(m_checkpointTime);
+	if (!m_journal.commit(m_journal.append(static_cast<uint8>(RecordType::CHECKPOINT), marker))) {
+		log("[ERROR] Failed to write the journal, changes are no longer saved");
+	}
+
+	// Everything journaled so far is in the image, and it stays as it is until the checkpoint ends
+	m_journal.beginCheckpoint();
+	m_checkpointing = true;
+	m_checkpointWritten = false;
+	m_checkpointThread = std::thread(&Persister::writeCheckpoint, this);
+}
+
+void Persister::writeCheckpoint() {
+	m_checkpointSaved = m_image.write(m_snapshotPath, m_checkpointTime);
+	m_checkpointWritten = true;
+	m_entries.wake();
+}
+
+bool Persister::endCheckpoint() {
+	m_checkpointThread.join();
+
+	bool saved = m_checkpointSaved;
+	if (!saved) {
+		m_journal.cancelCheckpoint();
+		log("[ERROR] Failed to save connections to file");
+	}
+	else if (!m_journal.endCheckpoint(m_checkpointTime)) {
+		// The snapshot is in place and the journal still has everything, replaying it again is harmless
+		saved = false;
+		log("[ERROR] Failed to start the journal over after saving connections");
+	}
+
+	// The image catches up on what was journaled in the meantime
+	for (const auto& pair : m_deferred) {
+		apply(pair.first, *pair.second);
+		delete pair.second;
+	}
+	m_deferred.clear();
+	m_checkpointing = false;
+	m_checkpointSize = saved ? m_compactSize : m_journal.getSize() + m_compactSize;
+
+	const uint64 duration = getSystemTime() - m_checkpointTime;
+	m_numCheckpoints++;
+	m_checkpointDuration += duration;
+	if (duration > m_maxCheckpointDuration) {
+		m_maxCheckpointDuration = duration;
+	}
+	return saved;
+}
+
+bool Persister::checkpoint() {
+	if (m_checkpointing) {
+		endCheckpoint();
+	}
+
+	beginCheckpoint();
+	return endCheckpoint();
+}
+
+PersisterStatistics Persister::getStatistics() const {
+	PersisterStatistics statistics;
+	statistics.queued = m_entries.getPushed();
+	statistics.waiting = statistics.queued - std::min(m_entries.getConsumed(), statistics.queued);
+	statistics.batches = m_numBatches;
+	statistics.confirmations = m_numConfirmations;
+	statistics.lag = m_lag;
+	statistics.maxLag = m_maxLag;
+	statistics.checkpoints = m_numCheckpoints;
+	statistics.checkpointTime = m_checkpointDuration;
+	statistics.maxCheckpointTime = m_maxCheckpointDuration;
+	return statistics;
+}
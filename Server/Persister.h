@@ -0,0 +1,114 @@
+#pragma once
+
+#include "Types.h"
+#include "Packet.h"
+#include "SequenceRing.h"
+#include "StateImage.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class Server;
+class Journal;
+class JournalRecord;
+
+// When a confirmation of a change goes out
+enum class ConfirmPolicy : uint8 {
+	IMMEDIATE,	// Right away, a crash may lose a change the client was told about
+	DURABLE		// Once the change is on disk as far as the journal's sync policy asks
+};
+
+struct PersisterStatistics {
+	uint64 queued;			// Records and confirmations handed over
+	uint64 waiting;			// Of those, not picked up yet
+	uint64 batches;
+	uint64 confirmations;	// Held back until what was queued before them was durable
+	uint64 lag;				// Total and longest time from being queued to being written, in 100 nanosecond ticks
+	uint64 maxLag;
+	uint64 checkpoints;
+	uint64 checkpointTime;	// Total and longest time from a checkpoint beginning to the journal starting over, in 100 nanosecond ticks
+	uint64 maxCheckpointTime;
+};
+
+// Journals changes on a thread of its own, so the threads handling requests and publishing
+// auction events never wait on the disk. Whatever was queued while the last batch was going out
+// is appended and committed together. A confirmation queued here is sent once everything queued
+// before it is durable, so it goes after the record of the change it confirms.
+//
+// Every record journaled is also applied to an image of the saved state, which is what a
+// checkpoint writes out. While one is being written on its own thread the image is left as it was
+// when the checkpoint began and records are only held back, then applied once it is on disk. Bids
+// keep flowing the whole time and none of the server's locks are taken.
+class Persister {
+private:
+	struct Entry {
+		uint8 type;
+		JournalRecord* record;	// Owned, none for a confirmation
+		Packet confirmation;
+		uint64 queuedTime;
+	};
+
+	Server* m_server;
+	Journal& m_journal;
+	std::string m_snapshotPath;
+	uint64 m_compactSize;
+
+	SequenceRing<Entry> m_entries;
+	std::atomic<bool> m_running;
+	std::thread m_thread;
+
+	// Persisting thread only
+	std::vector<std::pair<uint64, Packet>> m_confirmations;	// With the journal offset that has to be durable first
+	uint64 m_lastOffset;	// Of the last record appended
+	StateImage m_image;
+	bool m_checkpointing;
+	uint64 m_checkpointSize;	// Journal size that begins the next one, further off after one failed
+	uint64 m_checkpointTime;
+	std::vector<std::pair<uint8, JournalRecord*>> m_deferred;	// Journaled while the image was being written
+
+	std::thread m_checkpointThread;
+	std::atomic<bool> m_checkpointWritten;
+	bool m_checkpointSaved;
+
+	std::atomic<uint64> m_numBatches;
+	std::atomic<uint64> m_numConfirmations;
+	std::atomic<uint64> m_lag;
+	std::atomic<uint64> m_maxLag;
+	std::atomic<uint64> m_numCheckpoints;
+	std::atomic<uint64> m_checkpointDuration;
+	std::atomic<uint64> m_maxCheckpointDuration;
+
+	void run();
+	// Appends, commits and confirms whatever is waiting, false if nothing was
+	bool persistBatch();
+	// Sends the confirmations whose records are durable, or all of them once the journal failed
+	void releaseConfirmations();
+	void apply(uint8 type, const JournalRecord& record);
+
+	void beginCheckpoint();
+	void writeCheckpoint();
+	bool endCheckpoint();
+public:
+	Persister(Server* server, Journal& journal, const std::string& snapshotPath, uint32 queueSize, uint64 compactSize);
+	virtual ~Persister();
+
+	// Takes ownership of the record
+	void persist(uint8 type, JournalRecord* record);
+	void confirm(const Packet& confirmation);
+
+	void launch();
+	// Everything queued so far is persisted and confirmed first
+	void stop();
+
+	// Only while the persisting thread isn't running: filled in while loading, fully up to date
+	// once stopped
+	StateImage& getImage() { return m_image; }
+	// Writes a snapshot of the image and starts the journal over, while the persisting thread
+	// isn't running
+	bool checkpoint();
+
+	PersisterStatistics getStatistics() const;
+};
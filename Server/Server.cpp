@@ -4,64 +4,274 @@
 #include "UDPSocket.h"
 #include "TCPSocket.h"
 #include "Error.h"
+#include "Clock.h"
 #include "Item.h"
+#include "PacketPool.h"
+#include "File.h"
 
-#include <Mswsock.h>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <mutex>
+#include <algorithm>
+#include <chrono>
+#include <tuple>
+#include <vector>
 
-void udpServiceRoutine(PTP_CALLBACK_INSTANCE instance, PVOID parameter, PTP_WORK work);
-void tcpServiceRoutine(PTP_CALLBACK_INSTANCE instance, PVOID parameter, PTP_WORK work);
-void connectionServiceRoutine(PTP_CALLBACK_INSTANCE instance, PVOID parameter, PTP_WORK work);
+void udpServiceRoutine(void* parameter);
+void tcpServiceRoutine(void* parameter);
+void bindConnectionRoutine(void* parameter);
+void connectionServiceRoutine(void* parameter);
 
-std::mutex g_auctionLock;
+// Keeps offers and deregisters from interleaving, the auctions themselves belong to their shards.
+// Taken before m_connectionLock whenever both are needed.
+std::recursive_mutex g_auctionLock;
 
-Server::Server(const IPV4Address& bindAddress) : 
-	m_serverBindAddress(bindAddress)
-	, m_serverUDPSocket(true)
-	, m_serverTCPSocket(true)
+static constexpr char SNAPSHOT_PATH[] = "connections.dat";
+static constexpr char JOURNAL_PATH[] = "connections.journal";
+
+// Socket of the UDP shard the current thread serves, replies go out through it
+static thread_local UDPSocket* g_shardUDPSocket = nullptr;
+
+Server::Server(const IPV4Address& bindAddress, const ServerOptions& options) : 
+	m_nextAuctionShard(0)
 	, m_running(true)
+	, m_serverBindAddress(bindAddress)
+	, m_serverTCPSocket(true)
+	, m_numAccepts(0)
+	, m_totalAcceptWait(0)
+	, m_maxAcceptWait(0)
+	, m_numHandledMessages(0)
+	, m_sendQueueMessages(std::max(options.sendQueueMessages, 1u))
+	, m_sendQueueBytes(std::max(options.sendQueueBytes, Packet::PACKET_SIZE))
+	, m_slowConsumerPolicy(options.slowConsumerPolicy)
+	, m_numDroppedHighest(0)
+	, m_numResyncs(0)
+	, m_numSlowDisconnects(0)
+	, m_journal(JOURNAL_PATH, options.journalSync, options.journalSyncInterval * 10000ull)
+	, m_persister(this, m_journal, SNAPSHOT_PATH, std::max(options.persistQueueSize, 2u), options.journalCompactSize)
+	, m_registeredConfirm(options.registeredConfirm)
+	, m_deregConfirm(options.deregConfirm)
+	, m_offerConfirm(options.offerConfirm)
+	, m_fanOut(options.fanOutChunkSize)
+	, m_highestToWatchers(options.highestToWatchers)
 {
-	m_udpServiceIOPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
-	m_tcpServiceIOPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
-	m_connectionServiceIOPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
+	const uint32 hardwareThreads = std::max(std::thread::hardware_concurrency(), 1u);
+
+	uint32 numShards = (options.udpShards == 0) ? hardwareThreads : options.udpShards;
+#ifdef _WIN32
+	if (numShards > 1) {
+		log("[INFO] SO_REUSEPORT is not available on this platform, using a single UDP socket");
+		numShards = 1;
+	}
+#endif
+
+	m_numUDPBuffers = std::max(options.udpReceiveBuffers, 1u);
+	m_udpSocketBufferSize = options.udpSocketBufferSize;
+
+	m_numUDPServiceThreads = options.udpServiceThreads;
+	if (m_numUDPServiceThreads == 0) {
+		m_numUDPServiceThreads = std::max(hardwareThreads / numShards, 1u);
+	}
+
+	for (uint32 i = 0; i < numShards; i++) {
+		UDPShard* shard = new UDPShard();
+		shard->server = this;
+		shard->port = CompletionPort::create(options.ioEngine);
+		shard->buffers = new OverlappedBuffer[m_numUDPBuffers];
+		m_udpShards.push_back(shard);
+	}
+
+	m_numTCPBuffers = std::max(options.tcpPendingAccepts, 1u);
+	m_serverTCPBuffers = new OverlappedBuffer[m_numTCPBuffers];
+
+	m_tcpServiceIOPort = CompletionPort::create(options.ioEngine);
+	m_connectionServiceIOPort = CompletionPort::create(options.ioEngine);
+
+	const uint32 numAuctionShards = (options.auctionShards == 0) ? hardwareThreads : options.auctionShards;
+	for (uint32 i = 0; i < numAuctionShards; i++) {
+		m_auctionShards.push_back(new AuctionShard(this, i, numAuctionShards, std::max(options.auctionRingSize, 2u), options.highestConflationTime * 10000ull));
+	}
 }
 
-Server::~Server() {}
+Server::~Server() {
+	// Sockets detach from their ports when closed, so close them while the ports still exist
+	m_connections.clear();
+	m_serverTCPSocket.close();
+
+	for (AuctionShard* shard : m_auctionShards) {
+		delete shard;
+	}
+	m_auctionShards.clear();
+
+	for (UDPShard* shard : m_udpShards) {
+		shard->socket.close();
+		delete shard->port;
+		delete[] shard->buffers;
+		delete shard;
+	}
+	m_udpShards.clear();
+
+	delete m_tcpServiceIOPort;
+	delete m_connectionServiceIOPort;
+
+	delete[] m_serverTCPBuffers;
+}
 
 void Server::shutdown() {
 	m_running = false;
-	m_serverUDPSocket.close();
+
+	// No more requests come in once the service loops are gone, so nothing is pushed to a shard or
+	// the persister after it stops. The UDP sockets stay open for the replies still to come.
 	m_serverTCPSocket.close();
+
+	for (UDPShard* shard : m_udpShards) {
+		for (uint32 i = 0; i < m_numUDPServiceThreads; i++) {
+			shard->port->post(0);
+		}
+	}
+	m_tcpServiceIOPort->post(0);
+	m_connectionServiceIOPort->post(0);
+	ThreadPool::get()->joinLongRunning();
+
+	// The shards handle every command and event still queued before they stop, so offers already
+	// confirmed get in and ended auctions are announced. Nothing changes the auctions past this
+	// point, so what gets saved below is final.
+	for (AuctionShard* shard : m_auctionShards) {
+		shard->stop();
+	}
+
+	// Changes still queued are journaled and confirmed before the final snapshot
+	m_persister.stop();
+	for (UDPShard* shard : m_udpShards) {
+		shard->socket.close();
+	}
 	saveConnections();
-	m_connections.clear();
+	{
+		std::lock_guard<std::recursive_mutex> auctionLock(g_auctionLock);
+		std::lock_guard<std::mutex> lock(m_connectionLock);
+		m_connections.clear();
+		m_namedClients.clear();
+	}
+}
+
+static void logPortStatistics(const char* name, const CompletionPort& port) {
+	CompletionPortStatistics statistics = port.getStatistics();
+	float64 perMessage = (statistics.completions + statistics.sends > 0) ? static_cast<float64>(statistics.syscalls) / (statistics.completions + statistics.sends) : 0.0;
+	log("[INFO] %s port: %llu syscalls, %llu completions, %llu sends, %.3f syscalls per message", name, static_cast<unsigned long long>(statistics.syscalls), static_cast<unsigned long long>(statistics.completions), static_cast<unsigned long long>(statistics.sends), perMessage);
+}
+
+void Server::logStatistics() {
+	for (uint32 i = 0; i < m_udpShards.size(); i++) {
+		std::string name = (m_udpShards.size() > 1) ? "UDP shard " + std::to_string(i) : std::string("UDP");
+		logPortStatistics(name.c_str(), *m_udpShards[i]->port);
+	}
+	logPortStatistics("TCP", *m_tcpServiceIOPort);
+
+	const uint64 numAccepts = m_numAccepts;
+	const float64 averageWait = (numAccepts > 0) ? static_cast<float64>(m_totalAcceptWait) / numAccepts / 10000.0 : 0.0;
+	log("[INFO] Accepts: %llu, %.3f ms average wait, %.3f ms max wait", static_cast<unsigned long long>(numAccepts), averageWait, m_maxAcceptWait / 10000.0);
+	logPortStatistics("Connection", *m_connectionServiceIOPort);
+
+	const PacketPoolStatistics packets = PacketPool::get().getStatistics();
+	const uint64 numHandled = m_numHandledMessages;
+	const float64 perMessage = (numHandled > 0) ? static_cast<float64>(packets.allocations) / numHandled : 0.0;
+	log("[INFO] Packet buffers: %llu acquired, %llu heap allocations, %.3f allocations per handled message", static_cast<unsigned long long>(packets.acquired), static_cast<unsigned long long>(packets.allocations), perMessage);
+
+	const ThreadPoolStatistics pool = ThreadPool::get()->getStatistics();
+	log("[INFO] Thread pool: %u workers, %llu tasks, %llu stolen, %llu sleeps", ThreadPool::get()->getNumWorkers(), static_cast<unsigned long long>(pool.executed), static_cast<unsigned long long>(pool.stolen), static_cast<unsigned long long>(pool.sleeps));
+
+	for (AuctionShard* shard : m_auctionShards) {
+		const AuctionShard::Statistics auctions = shard->getStatistics();
+		const float64 perBatch = (auctions.batches > 0) ? static_cast<float64>(auctions.commands) / auctions.batches : 0.0;
+		const float64 perPublish = (auctions.publishBatches > 0) ? static_cast<float64>(auctions.events) / auctions.publishBatches : 0.0;
+		log("[INFO] Auction shard %u: %u open items, %llu commands at %.2f per batch, %llu events at %.2f per batch, %llu full ring waits", shard->getIndex(), auctions.openItems, static_cast<unsigned long long>(auctions.commands), perBatch, static_cast<unsigned long long>(auctions.events), perPublish, static_cast<unsigned long long>(auctions.fullWaits));
+		if (auctions.conflatedSent > 0 || auctions.conflatedHighest > 0) {
+			// Delays in milliseconds
+			const float64 averageDelay = (auctions.conflatedSent > 0) ? auctions.conflationDelay / 10000.0 / auctions.conflatedSent : 0.0;
+			log("[INFO] Auction shard %u: %llu HIGHEST conflated away, %llu held back for %.2f ms on average and %.2f ms at most", shard->getIndex(), static_cast<unsigned long long>(auctions.conflatedHighest), static_cast<unsigned long long>(auctions.conflatedSent), averageDelay, auctions.maxConflationDelay / 10000.0);
+		}
+	}
+
+	const FanOutStatistics fanOut = m_fanOut.getStatistics();
+	log("[INFO] Fan out: %llu broadcasts to %llu recipients, %llu split between threads, %llu chunks done by workers", static_cast<unsigned long long>(fanOut.broadcasts), static_cast<unsigned long long>(fanOut.recipients), static_cast<unsigned long long>(fanOut.parallelBroadcasts), static_cast<unsigned long long>(fanOut.helpedChunks));
+
+	const JournalStatistics journal = m_journal.getStatistics();
+	log("[INFO] Journal: %llu records in %llu commits, %llu syncs, %llu compactions, %llu bytes", static_cast<unsigned long long>(journal.records), static_cast<unsigned long long>(journal.commits), static_cast<unsigned long long>(journal.syncs), static_cast<unsigned long long>(journal.compactions), static_cast<unsigned long long>(journal.size));
+
+	// Lag in milliseconds, from being queued to being durable
+	const PersisterStatistics persister = m_persister.getStatistics();
+	const float64 averageLag = (persister.queued > persister.waiting) ? persister.lag / 10000.0 / (persister.queued - persister.waiting) : 0.0;
+	log("[INFO] Persistence: %llu queued in %llu batches, %llu waiting, %.2f ms lag on average and %.2f ms at most, %llu confirmations held back, durable up to %llu of %llu", static_cast<unsigned long long>(persister.queued), static_cast<unsigned long long>(persister.batches), static_cast<unsigned long long>(persister.waiting), averageLag, persister.maxLag / 10000.0, static_cast<unsigned long long>(persister.confirmations), static_cast<unsigned long long>(journal.durable), static_cast<unsigned long long>(journal.appended));
+	log("[INFO] Checkpoints: %llu written, %.2f ms on average and %.2f ms at most", static_cast<unsigned long long>(persister.checkpoints), (persister.checkpoints > 0) ? persister.checkpointTime / 10000.0 / persister.checkpoints : 0.0, persister.maxCheckpointTime / 10000.0);
+
+	log("[INFO] Slow consumers: %llu HIGHEST dropped, %llu resyncs, %llu disconnected", static_cast<unsigned long long>(m_numDroppedHighest), static_cast<unsigned long long>(m_numResyncs), static_cast<unsigned long long>(m_numSlowDisconnects));
 
-	PostQueuedCompletionStatus(m_udpServiceIOPort, 0, 0, nullptr);
-	PostQueuedCompletionStatus(m_tcpServiceIOPort, 0, 0, nullptr);
-	PostQueuedCompletionStatus(m_connectionServiceIOPort, 0, 0, nullptr);
+	// Send queue depth of every connection that has anything waiting
+	std::lock_guard<std::mutex> lock(m_connectionLock);
+	for (auto& pair : m_connections) {
+		const Connection& connection = pair.second;
+		const SendQueueDepth depth = connection.getSendQueueDepth();
+		if (depth.messages > 0 || connection.isStale()) {
+			log("[INFO] Send queue of %s: %u messages, %u bytes%s", connection.getUniqueName().c_str(), depth.messages, depth.bytes, connection.isStale() ? ", stale" : "");
+		}
+	}
 }
 
 void Server::startUDPServiceThread() {
-	m_serverUDPSocket.bind(m_serverBindAddress);
-	
-	CreateIoCompletionPort(m_serverUDPSocket.getWinSockHandle(), m_udpServiceIOPort, 1, 0);
+	for (UDPShard* shard : m_udpShards) {
+#ifndef _WIN32
+		if (m_udpShards.size() > 1) {
+			shard->socket.setReusePort(true);
+		}
+#endif
+		shard->socket.bind(m_serverBindAddress);
+		shard->socket.setReceiveBufferSize(m_udpSocketBufferSize);
+
+		shard->port->associate(shard->socket, 1);
+
+		for (uint32 i = 0; i < m_numUDPBuffers; i++) {
+			shard->socket.receiveOverlapped(shard->buffers[i]);
+		}
+		for (uint32 i = 0; i < m_numUDPServiceThreads; i++) {
+			ThreadPool::get()->submitLongRunning(udpServiceRoutine, shard);
+		}
+	}
+}
 
-	m_serverUDPSocket.receiveOverlapped(m_serverUDPBuffer);
-	ThreadPool::get()->submit(udpServiceRoutine, this);
+UDPSocket& Server::getUDPSocket() {
+	if (g_shardUDPSocket != nullptr) {
+		return *g_shardUDPSocket;
+	}
+	return m_udpShards.front()->socket;
 }
 
 void Server::startTCPServiceThread() {
 	m_serverTCPSocket.bind(m_serverBindAddress);
 	m_serverTCPSocket.listen();
 
-	CreateIoCompletionPort(m_serverTCPSocket.getWinSockHandle(), m_tcpServiceIOPort, 1, 0);
-	
-	ThreadPool::get()->submit(tcpServiceRoutine, this);
+	m_tcpServiceIOPort->associate(m_serverTCPSocket, 1);
+
+	// Posted here rather than by the routine, which could start after a shutdown closed the listener
+	for (uint32 i = 0; i < m_numTCPBuffers; i++) {
+		m_serverTCPSocket.acceptOverlapped(m_serverTCPBuffers[i]);
+	}
+
+	ThreadPool::get()->submitLongRunning(tcpServiceRoutine, this);
 }
 
 void Server::startConnectionServiceThread() {
-	ThreadPool::get()->submit(connectionServiceRoutine, this);
+	ThreadPool::get()->submitLongRunning(connectionServiceRoutine, this);
+}
+
+void Server::startAuctionShards() {
+	for (AuctionShard* shard : m_auctionShards) {
+		shard->launch();
+	}
+}
+
+void Server::startPersistenceThread() {
+	m_persister.launch();
 }
 
 void Server::sendRegistered(uint32 reqNum, const std::string& name, const std::string& ip, const std::string& port, const IPV4Address& address) {
@@ -74,8 +284,7 @@ void Server::sendRegistered(uint32 reqNum, const std::string& name, const std::s
 	Packet registeredPacket = serializeMessage(registeredMsg);
 	registeredPacket.setAddress(address);
 
-	m_serverUDPSocket.send(registeredPacket);
-	log(LogType::LOG_SEND, registeredMsg.type, registeredPacket.getAddress());
+	confirm(registeredPacket);
 }
 
 void Server::sendUnregistered(uint32 reqNum, const std::string& reason, const IPV4Address& address) {
@@ -86,7 +295,7 @@ void Server::sendUnregistered(uint32 reqNum, const std::string& reason, const IP
 	Packet packet = serializeMessage(unregisteredMsg);
 	packet.setAddress(address);
 
-	m_serverUDPSocket.send(packet);
+	getUDPSocket().send(packet);
 	log(LogType::LOG_SEND, unregisteredMsg.type, packet.getAddress());
 }
 
@@ -97,8 +306,7 @@ void Server::sendDeregConf(uint32 reqNum, const IPV4Address& address) {
 	Packet deregConfPacket = serializeMessage(deregConfMsg);
 	deregConfPacket.setAddress(address);
 
-	m_serverUDPSocket.send(deregConfPacket);
-	log(LogType::LOG_SEND, deregConfMsg.type, deregConfPacket.getAddress());
+	confirm(deregConfPacket);
 }
 
 void Server::sendDeregDenied(uint32 reqNum, const std::string& reason, const IPV4Address& address) {
@@ -109,7 +317,7 @@ void Server::sendDeregDenied(uint32 reqNum, const std::string& reason, const IPV
 	Packet deregDeniedPacket = serializeMessage(deregDeniedMsg);
 	deregDeniedPacket.setAddress(address);
 
-	m_serverUDPSocket.send(deregDeniedPacket);
+	getUDPSocket().send(deregDeniedPacket);
 	log(LogType::LOG_SEND, deregDeniedMsg.type, deregDeniedPacket.getAddress());
 }
 
@@ -123,8 +331,7 @@ void Server::sendOfferConf(uint32 reqNum, uint32 itemNum, const std::string& des
 	Packet offerConfPacket = serializeMessage(offerConfMsg);
 	offerConfPacket.setAddress(address);
 
-	m_serverUDPSocket.send(offerConfPacket);
-	log(LogType::LOG_SEND, offerConfMsg.type, offerConfPacket.getAddress());
+	confirm(offerConfPacket);
 }
 
 void Server::sendOfferDenied(uint32 reqNum, const std::string& reason, const IPV4Address& address) {
@@ -135,7 +342,7 @@ void Server::sendOfferDenied(uint32 reqNum, const std::string& reason, const IPV
 	Packet offerDeniedPacket = serializeMessage(offerDeniedMsg);
 	offerDeniedPacket.setAddress(address);
 
-	m_serverUDPSocket.send(offerDeniedPacket);
+	getUDPSocket().send(offerDeniedPacket);
 	log(LogType::LOG_SEND, offerDeniedMsg.type, offerDeniedPacket.getAddress());
 }
 
@@ -148,34 +355,36 @@ void Server::sendNewItem(const Item& item) {
 
 	Packet packet = serializeMessage(newItemMsg);
 
-	// Send to everyone registered
-	for (auto& pair : m_connections) {
-		Connection& connection = pair.second;
-		if (connection.isConnected()) {
-			packet.setAddress(connection.getAddress());
-			
-			m_serverUDPSocket.send(packet);
-			log(LogType::LOG_SEND, newItemMsg.type, packet.getAddress());
+	// Send to everyone registered, batched so announcing to many clients takes few syscalls
+	std::vector<Packet> packets;
+	{
+		std::lock_guard<std::mutex> lock(m_connectionLock);
+		packets.reserve(m_connections.size());
+		for (auto& pair : m_connections) {
+			Connection& connection = pair.second;
+			if (connection.isConnected()) {
+				packet.setAddress(connection.getAddress());
+				packets.push_back(packet);
+			}
 		}
 	}
+
+	if (!packets.empty()) {
+		getUDPSocket().send(packets.data(), static_cast<uint32>(packets.size()));
+	}
+	for (const Packet& sentPacket : packets) {
+		log(LogType::LOG_SEND, newItemMsg.type, sentPacket.getAddress());
+	}
 }
 
-void Server::sendHighest(const Item& item) {
+void Server::sendHighest(const Item& item, float32 amount) {
 	HighestMessage highMsg;
 	highMsg.itemNum = item.getItemID();
-	highMsg.amount = item.getCurrentHighest();
+	highMsg.amount = amount;
 	memcpy(highMsg.description, item.getDescription().c_str(), item.getDescription().size() + 1);
 
-	Packet packet = serializeMessage(highMsg);
-
-	// Send to everyone registered
-	for (auto& pair : m_connections) {
-		Connection& connection = pair.second;
-		if (connection.isConnected()) {
-			connection.send(packet);
-			log(LogType::LOG_SEND, highMsg.type, connection.getAddress());
-		}
-	}
+	// Send to everyone watching
+	broadcast(serializeMessage(highMsg), m_highestToWatchers ? &item : nullptr);
 }
 
 void Server::sendWin(const Item& item) {
@@ -184,6 +393,8 @@ void Server::sendWin(const Item& item) {
 	winMsg.amount = item.getCurrentHighest();
 	winMsg.port[0] = '\0';
 
+	std::lock_guard<std::mutex> lock(m_connectionLock);
+
 	// Get seller connection
 	auto iter = m_connections.find(item.getSeller());
 	if (iter != m_connections.end()) {
@@ -201,8 +412,9 @@ void Server::sendWin(const Item& item) {
 		Connection& winner = iter2->second;
 		if (winner.isConnected()) {
 			Packet packet = serializeMessage(winMsg);
-			winner.send(packet);
-			log(LogType::LOG_SEND, winMsg.type, winner.getAddress());
+			if (sendToConnection(winner, packet)) {
+				log(LogType::LOG_SEND, winMsg.type, winner.getAddress());
+			}
 		}
 	}
 }
@@ -212,16 +424,8 @@ void Server::sendBidOver(const Item& item) {
 	bidOverMsg.itemNum = item.getItemID();
 	bidOverMsg.amount = item.getCurrentHighest();
 
-	Packet packet = serializeMessage(bidOverMsg);
-
 	// Send to everyone registered
-	for (auto& pair : m_connections) {
-		Connection& connection = pair.second;
-		if (connection.isConnected()) {
-			connection.send(packet);
-			log(LogType::LOG_SEND, bidOverMsg.type, connection.getAddress());
-		}
-	}
+	broadcast(serializeMessage(bidOverMsg));
 }
 
 void Server::sendSoldTo(const Item& item) {
@@ -230,6 +434,8 @@ void Server::sendSoldTo(const Item& item) {
 	soldToMsg.amount = item.getCurrentHighest();
 	soldToMsg.port[0] = '\0';
 
+	std::lock_guard<std::mutex> lock(m_connectionLock);
+
 	// Get winner connection
 	auto iter = m_connections.find(item.getHighestBidder());
 	if (iter != m_connections.end()) {
@@ -247,8 +453,9 @@ void Server::sendSoldTo(const Item& item) {
 		Connection& seller = iter2->second;
 		if (seller.isConnected()) {
 			Packet packet = serializeMessage(soldToMsg);
-			seller.send(packet);
-			log(LogType::LOG_SEND, soldToMsg.type, seller.getAddress());
+			if (sendToConnection(seller, packet)) {
+				log(LogType::LOG_SEND, soldToMsg.type, seller.getAddress());
+			}
 		}
 	}
 }
@@ -258,137 +465,200 @@ void Server::sendNotSold(const Item& item) {
 	notSoldMsg.itemNum = item.getItemID();
 	memcpy(notSoldMsg.reason, "No valid bids", 14);
 
+	std::lock_guard<std::mutex> lock(m_connectionLock);
+
 	// Find seller
 	auto iter = m_connections.find(item.getSeller());
 	if (iter != m_connections.end()) {
 		Connection& seller = iter->second;
 		if (seller.isConnected()) {
 			Packet packet = serializeMessage(notSoldMsg);
-			seller.send(packet);
-			log(LogType::LOG_SEND, notSoldMsg.type, seller.getAddress());
+			if (sendToConnection(seller, packet)) {
+				log(LogType::LOG_SEND, notSoldMsg.type, seller.getAddress());
+			}
 		}
 	}
 }
 
-void Server::startAuction(const Item& item, uint64 auctionTime) {
-	std::lock_guard<std::mutex> lock(g_auctionLock);
-
-	Item* newItem = new Item(item);
-	m_offeredItems[item.getItemID()] = newItem;
+bool Server::sendToConnection(Connection& connection, const Packet& packet) {
+	// Caller holds m_connectionLock
+	const MessageType type = static_cast<MessageType>(packet.getMessageData()[0]);
+	const bool highest = (type == MessageType::MSG_HIGHEST);
 
-	log("[INFO] Starting auction for item number %u with a min bid of %.2f", item.getItemID(), item.getMinimum());
-	sendNewItem(item);
+	if (connection.isStale()) {
+		const SendQueueDepth depth = connection.getSendQueueDepth();
+		if (depth.messages <= m_sendQueueMessages / 2 && depth.bytes <= m_sendQueueBytes / 2) {
+			// Caught up, the current state includes this message if it was a HIGHEST
+			resyncConnection(connection);
+		}
+		if (highest) {
+			return false;
+		}
+	}
 
-	std::pair<Server*, Item*>* pair = new std::pair<Server*, Item*>(this, newItem);
+	const SendQueueDepth depth = connection.getSendQueueDepth();
+	if (depth.messages < m_sendQueueMessages && depth.bytes + packet.getFrameSize() <= m_sendQueueBytes) {
+		connection.send(packet);
+		return true;
+	}
 
-	FILETIME fileTime;
-	GetSystemTimeAsFileTime(&fileTime);
-	ULARGE_INTEGER* time = reinterpret_cast<ULARGE_INTEGER*>(&fileTime);
-	newItem->setAuctionStartTime(time->QuadPart);
+	if (highest) {
+		const uint32 itemNum = reinterpret_cast<const HighestMessage*>(packet.getMessageData())->itemNum;
 
-	ThreadPool::get()->submitTimer([](PTP_CALLBACK_INSTANCE instance, PVOID arg, PTP_TIMER timer) {
-		std::pair<Server*, Item*>* inPair = reinterpret_cast<std::pair<Server*, Item*>*>(arg);
-		Server* server = inPair->first;
-		Item* finishedItem = inPair->second;
+		switch (m_slowConsumerPolicy) {
+		case SlowConsumerPolicy::DROP_OLDEST_HIGHEST:
+			// The new HIGHEST supersedes the old one anyway
+			if (connection.dropQueuedHighest(itemNum, 1) > 0) {
+				m_numDroppedHighest++;
+				connection.send(packet);
+				return true;
+			}
+			break;
+		case SlowConsumerPolicy::RESYNC:
+			// Nothing queued for the client is current anymore
+			m_numDroppedHighest += connection.dropQueuedHighest() + 1;
+			connection.setStale(true);
+			return false;
+		default:
+			break;
+		}
+	}
 
-		inPair->first->endAuction(*finishedItem);
-		log("[INFO] Auction ended for item number %u with a price of %.2f", finishedItem->getItemID(), finishedItem->getCurrentHighest());
+	// Nothing left to make room with
+	log("[ERROR] Client %s is not keeping up with its messages, disconnecting", connection.getUniqueName().c_str());
+	m_numSlowDisconnects++;
+	connection.shutdown();
+	return false;
+}
 
-		delete finishedItem;
-		delete inPair;
-		CloseThreadpoolTimer(timer);
-	}, pair, auctionTime);
+struct Broadcast {
+	Server* server;
+	const Packet* packet;
+	MessageType type;
+};
 
-	saveConnections();
-}
+void Server::broadcast(const Packet& packet, const Item* watched) {
+	Broadcast context{ this, &packet, static_cast<MessageType>(packet.getMessageData()[0]) };
 
-void Server::bid(uint32 itemID, float32 newBid, const std::string& bidder) {
-	std::lock_guard<std::mutex> lock(g_auctionLock);
+	// Held until every recipient has the packet queued, so none of them can be removed meanwhile
+	std::lock_guard<std::mutex> lock(m_connectionLock);
 
-	auto iter = m_offeredItems.find(itemID);
-	if (iter != m_offeredItems.end()) {
-		Item* item = iter->second;
-		if (newBid > item->getCurrentHighest()) {
-			if (item->getSeller() != bidder) {
-				item->setCurrentHighest(newBid);
-				item->setHighestBidder(bidder);
-				sendHighest(*item);
+	std::vector<Connection*> recipients;
+	if (watched != nullptr) {
+		getAuctionShard(watched->getItemID()).forEachWatcher(*watched, [this, &recipients](ClientID client) {
+			auto iter = m_connections.find(client);
+			if (iter != m_connections.end() && iter->second.isConnected()) {
+				recipients.push_back(&iter->second);
 			}
-			else {
-				log("[INFO] Client attempting to bid on own item %u, ignoring bid", itemID);
-			}
-		}
-		else {
-			log("[INFO] New bid of %.2f below current bid for item %u, ignoring bid", newBid, itemID);
-		}
+		});
 	}
 	else {
-		log("[INFO] Item %u not up for auction, ignoring bid", itemID);
+		recipients.reserve(m_connections.size());
+		for (auto& pair : m_connections) {
+			if (pair.second.isConnected()) {
+				recipients.push_back(&pair.second);
+			}
+		}
 	}
+
+	m_fanOut.run(recipients, broadcastToConnection, &context);
 }
 
-void Server::endAuction(const Item& item) {
-	std::lock_guard<std::mutex> lock(g_auctionLock);
+void Server::broadcastToConnection(Connection& connection, void* context) {
+	// Each connection is handed to a single thread, the rest of the state touched here is atomic
+	const Broadcast& broadcast = *reinterpret_cast<const Broadcast*>(context);
+	if (broadcast.server->sendToConnection(connection, *broadcast.packet)) {
+		log(LogType::LOG_SEND, broadcast.type, connection.getAddress());
+	}
+}
 
-	m_offeredItems.erase(item.getItemID());
-	saveConnections();
+void Server::resyncConnection(Connection& connection) {
+	// Caller holds m_connectionLock
+	for (AuctionShard* shard : m_auctionShards) {
+		shard->forEachItem([this, &connection](const Item& item) {
+			if (item.getCurrentHighest() == item.getMinimum()) {
+				// No bids yet, there was never a HIGHEST to miss
+				return;
+			}
+			if (m_highestToWatchers && !item.isWatcher(connection.getClientID())) {
+				return;
+			}
 
-	// SEND TCP PACKETS
-	sendBidOver(item);
+			HighestMessage highMsg;
+			highMsg.itemNum = item.getItemID();
+			highMsg.amount = item.getCurrentHighest();
+			memcpy(highMsg.description, item.getDescription().c_str(), item.getDescription().size() + 1);
 
-	// Check if anyone bid on the item
-	if (item.getCurrentHighest() != item.getMinimum()) {
-		sendWin(item);
-		sendSoldTo(item);
-	}
-	else {
-		sendNotSold(item);
+			connection.send(serializeMessage(highMsg));
+			log(LogType::LOG_SEND, highMsg.type, connection.getAddress());
+		});
 	}
+
+	connection.setStale(false);
+	m_numResyncs++;
 }
 
-bool Server::isSeller(const std::string& seller) {
-	std::lock_guard<std::mutex> lock(g_auctionLock);
+void Server::startAuction(Item* item, uint64 auctionTime) {
+	getAuctionShard(item->getItemID()).startAuction(item, auctionTime);
+}
 
-	for (auto& pair : m_offeredItems) {
-		Item* item = pair.second;
-		if (item->getSeller() == seller) {
-			return true;
-		}
-	}
+void Server::bid(uint32 itemID, float32 newBid, ClientID bidder) {
+	getAuctionShard(itemID).bid(itemID, newBid, bidder);
+}
 
-	return false;
+bool Server::isSeller(ClientID seller) {
+	return m_clients.getState(seller).openOffers > 0;
 }
 
-bool Server::isHighestBidder(const std::string& bidder) {
-	std::lock_guard<std::mutex> lock(g_auctionLock);
+bool Server::isHighestBidder(ClientID bidder) {
+	return m_clients.getState(bidder).leadingBids > 0;
+}
 
-	for (auto& pair : m_offeredItems) {
-		Item* item = pair.second;
-		if (item->getHighestBidder() == bidder) {
-			return true;
-		}
+int32 Server::getNumOffers(ClientID seller) {
+	return m_clients.getState(seller).openOffers;
+}
+
+void Server::getActiveAuctions(ClientID client, std::vector<uint32>& selling, std::vector<uint32>& leading) {
+	for (AuctionShard* shard : m_auctionShards) {
+		shard->getClientItems(client, selling, leading);
 	}
+}
+
 
+bool Server::queueClientPacket(Packet& packet) {
+	std::lock_guard<std::mutex> lock(m_clientPacketsLock);
+
+	ClientPackets& pending = m_clientPackets[packet.getAddress().getEndpointKey()];
+	if (pending.handling) {
+		// The worker handling this client picks it up once it is done, keeping the client's packets in order
+		pending.packets.push_back(std::move(packet));
+		return true;
+	}
+	pending.handling = true;
 	return false;
 }
 
-int32 Server::getNumOffers(const std::string& seller) {
-	std::lock_guard<std::mutex> lock(g_auctionLock);
+void Server::handleClientPackets(Packet& packet) {
+	const EndpointKey client = packet.getAddress().getEndpointKey();
 
-	int32 count = 0;
-	for (auto& pair : m_offeredItems) {
-		Item* item = pair.second;
-		if (item->getSeller() == seller) {
-			count++;
+	for (;;) {
+		handlePacket(packet);
+
+		std::lock_guard<std::mutex> lock(m_clientPacketsLock);
+		auto iter = m_clientPackets.find(client);
+		if (iter->second.packets.empty()) {
+			m_clientPackets.erase(iter);
+			return;
 		}
+		packet = std::move(iter->second.packets.front());
+		iter->second.packets.pop_front();
 	}
-
-	return count;
 }
 
 void Server::handlePacket(const Packet& packet) {
 	MessageType type = static_cast<MessageType>(packet.getMessageData()[0]);
 	log(LogType::LOG_RECEIVE, type, packet.getAddress());
+	m_numHandledMessages++;
 
 	switch (type) {
 	case MessageType::MSG_REGISTER:
@@ -403,6 +673,12 @@ void Server::handlePacket(const Packet& packet) {
 	case MessageType::MSG_BID:
 		handleBidPacket(packet);
 		break;
+	case MessageType::MSG_WATCH:
+		handleWatchPacket(packet, true);
+		break;
+	case MessageType::MSG_UNWATCH:
+		handleWatchPacket(packet, false);
+		break;
 	}
 
 }
@@ -411,27 +687,43 @@ void Server::handleRegisterPacket(const Packet& packet) {
 	RegisterMessage msg = deserializeMessage<RegisterMessage>(packet);
 
 	std::string name(msg.name);
-	// Check if same name
-	for (auto& pair : m_connections) {
-		Connection& connection = pair.second;
-		if (name == connection.getUniqueName() && connection.getAddress().getSocketAddressAsString() != packet.getAddress().getSocketAddressAsString()) {
-			sendUnregistered(msg.reqNum, "Name already exists", packet.getAddress());
-			return;
+	const EndpointKey client = packet.getAddress().getEndpointKey();
+	bool nameTaken = false;
+	{
+		std::lock_guard<std::mutex> lock(m_connectionLock);
+
+		// Check if same name, the denial is sent once the lock is released
+		const ClientID existing = m_clients.find(client);
+		auto nameIter = m_namedClients.find(name);
+		nameTaken = (nameIter != m_namedClients.end() && nameIter->second != existing);
+
+		if (!nameTaken) {
+			// Attempt to register
+			auto iter = m_connections.find(existing);
+			if (iter == m_connections.end()) {
+				log("[INFO] Registering client %s (%s)", msg.name, packet.getAddress().getSocketAddressAsString().c_str());
+				const ClientID id = m_clients.intern(packet.getAddress());
+				m_connections[id] = Connection(id, name, packet.getAddress());
+				m_namedClients[name] = id;
+			}
+			else {
+				log("[INFO] Client %s (%s) already registered", msg.name, packet.getAddress().getSocketAddressAsString().c_str());
+				if (iter->second.getUniqueName() != name) {
+					// Renamed, the old name is free again
+					m_namedClients.erase(iter->second.getUniqueName());
+					m_namedClients[name] = existing;
+				}
+				iter->second.setUniqueName(msg.name);
+				iter->second.setAddress(packet.getAddress());
+			}
 		}
 	}
 
-	// Attempt to register
-	auto iter = m_connections.find(packet.getAddress().getSocketAddressAsString());
-	if (iter == m_connections.end()) {
-		log("[INFO] Registering client %s (%s)", msg.name, packet.getAddress().getSocketAddressAsString().c_str());
-		m_connections[packet.getAddress().getSocketAddressAsString()] = Connection(std::string(msg.name), packet.getAddress());
-	}
-	else {
-		log("[INFO] Client %s (%s) already registered", msg.name, packet.getAddress().getSocketAddressAsString().c_str());
-		iter->second.setUniqueName(msg.name);
-		iter->second.setAddress(packet.getAddress());
+	if (nameTaken) {
+		sendUnregistered(msg.reqNum, "Name already exists", packet.getAddress());
+		return;
 	}
-	saveConnections();
+	journalRegister(name, packet.getAddress());
 
 	sendRegistered(msg.reqNum, std::string(msg.name), std::string(msg.iPAddress), std::string(msg.port), packet.getAddress());
 }
@@ -439,26 +731,35 @@ void Server::handleRegisterPacket(const Packet& packet) {
 void Server::handleDeregisterPacket(const Packet& packet) {
 	DeregisterMessage msg = deserializeMessage<DeregisterMessage>(packet);
 
+	// Held throughout so the client can't start selling or bidding between the checks and the removal
+	std::unique_lock<std::recursive_mutex> auctionLock(g_auctionLock);
+	std::unique_lock<std::mutex> connectionLock(m_connectionLock);
+
 	// DEREGISTER HIM!
-	auto it = m_connections.find(packet.getAddress().getSocketAddressAsString());
+	auto it = m_connections.find(m_clients.find(packet.getAddress().getEndpointKey()));
 	if (it != m_connections.end())
 	{
-		if (isSeller(it->second.getAddress().getSocketAddressAsString())) {
-			sendDeregDenied(msg.reqNum, "Pending offer", packet.getAddress());
-			return;
-		}
-		if (isHighestBidder(it->second.getAddress().getSocketAddressAsString())) {
-			sendDeregDenied(msg.reqNum, "Highest bidder", packet.getAddress());
+		if (isSeller(it->first) || isHighestBidder(it->first)) {
+			std::vector<uint32> selling;
+			std::vector<uint32> leading;
+			getActiveAuctions(it->first, selling, leading);
+			log("[INFO] Deregister denied for %s, selling %u items and leading on %u items", it->second.getUniqueName().c_str(), static_cast<uint32>(selling.size()), static_cast<uint32>(leading.size()));
+
+			// An offer that hasn't reached its shard yet still counts as pending
+			sendDeregDenied(msg.reqNum, isSeller(it->first) ? "Pending offer" : "Highest bidder", packet.getAddress());
 			return;
 		}
 
 		// User was found in the registered table, remove him
-		sendDeregConf(msg.reqNum, packet.getAddress());
-
 		(*it).second.shutdown();
+		m_namedClients.erase(it->second.getUniqueName());
 		m_connections.erase(it);
+		connectionLock.unlock();
+		auctionLock.unlock();
 
-		saveConnections();
+		// Confirmed after the change is queued, so a durable confirmation waits for it
+		journalDeregister(packet.getAddress());
+		sendDeregConf(msg.reqNum, packet.getAddress());
 	}
 	else
 	{
@@ -469,42 +770,53 @@ void Server::handleDeregisterPacket(const Packet& packet) {
 
 void Server::handleOfferPacket(const Packet& packet) {
 	OfferMessage msg = deserializeMessage<OfferMessage>(packet);
-	
-	auto iter = m_connections.find(packet.getAddress().getSocketAddressAsString());
-	const bool connected = (iter != m_connections.end()) ? (*iter).second.isConnected() : false;
+
+	// Keeps the connection from being removed and offers from being accepted past the limit or
+	// alongside a deregister while the offer is handled
+	std::lock_guard<std::recursive_mutex> auctionLock(g_auctionLock);
+
+	Connection* registered = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(m_connectionLock);
+		auto iter = m_connections.find(m_clients.find(packet.getAddress().getEndpointKey()));
+		if (iter != m_connections.end()) {
+			registered = &(*iter).second;
+		}
+	}
+	const bool connected = (registered != nullptr) ? registered->isConnected() : false;
 
 	if (connected) {
-		Connection& connection = (*iter).second;
+		Connection& connection = *registered;
 
-		if (getNumOffers(packet.getAddress().getSocketAddressAsString()) >= 3) {
+		if (getNumOffers(connection.getClientID()) >= 3) {
 			sendOfferDenied(msg.reqNum, "Too many offers (max 3)", packet.getAddress());
 			return;
 		}
 
 		if (msg.reqNum > connection.getOfferReqNumber()) {
-			// Client offering new item
-			Item item(std::string(msg.description), msg.minimum, connection.getAddress().getSocketAddressAsString());
+			// Client offering new item, counted against the seller until its auction ends
+			AuctionShard& shard = *m_auctionShards[m_nextAuctionShard++ % m_auctionShards.size()];
+			Item* item = new Item(std::string(msg.description), msg.minimum, connection.getClientID(), shard.allocateItemID());
+			m_clients.getState(connection.getClientID()).openOffers++;
 
-			connection.setLastItemOfferedID(item.getItemID());
+			connection.setLastItemOfferedID(item->getItemID());
 			connection.setOfferReqNumber(msg.reqNum);
 
-			// Send confirmation
-			sendOfferConf(msg.reqNum, item.getItemID(), std::string(msg.description), msg.minimum, packet.getAddress());
-
-			startAuction(item);
-		}
-		else {
-			// Client resend same item
-			auto iter = m_offeredItems.find(connection.getLastItemOfferedID());
-			if (iter != m_offeredItems.end()) {
-				// Send confirmation
-				sendOfferConf(msg.reqNum, connection.getLastItemOfferedID(), std::string(msg.description), msg.minimum, packet.getAddress());
+			if (m_offerConfirm == ConfirmPolicy::DURABLE) {
+				// Confirmed by the shard once the auction is journaled
+				shard.offerAuction(item, msg.reqNum, packet.getAddress());
 			}
 			else {
-				// REALLY REALLY BAD I hope this never happens
-				sendOfferDenied(msg.reqNum, "Invalid request number", packet.getAddress());
+				// Send confirmation
+				sendOfferConf(msg.reqNum, item->getItemID(), std::string(msg.description), msg.minimum, packet.getAddress());
+
+				startAuction(item);
 			}
 		}
+		else {
+			// Client resend same item, only the item's shard knows if it is still up
+			getAuctionShard(connection.getLastItemOfferedID()).confirmOffer(connection.getLastItemOfferedID(), msg.reqNum, packet.getAddress());
+		}
 	}
 	else {
 		// Client not registered
@@ -514,204 +826,306 @@ void Server::handleOfferPacket(const Packet& packet) {
 
 void Server::handleBidPacket(const Packet& packet) {
 	BidMessage bidMsg = deserializeMessage<BidMessage>(packet);
-	bid(bidMsg.itemNum, bidMsg.amount, packet.getAddress().getSocketAddressAsString());
+	// Only known clients get an ID, interning any sender would let spoofed addresses grow the registry
+	const ClientID bidder = m_clients.find(packet.getAddress().getEndpointKey());
+	if (bidder == INVALID_CLIENT_ID) {
+		log("[INFO] Bid from unregistered client %s, ignoring bid", packet.getAddress().getSocketAddressAsString().c_str());
+		return;
+	}
+	bid(bidMsg.itemNum, bidMsg.amount, bidder);
 }
 
-void udpServiceRoutine(PTP_CALLBACK_INSTANCE instance, PVOID parameter, PTP_WORK work) {
-	UNREFERENCED_PARAMETER(work);
-	CallbackMayRunLong(instance);
+void Server::handleWatchPacket(const Packet& packet, bool watching) {
+	// Same layout for both
+	WatchMessage watchMsg = deserializeMessage<WatchMessage>(packet);
+	const ClientID client = m_clients.find(packet.getAddress().getEndpointKey());
+	if (client == INVALID_CLIENT_ID) {
+		log("[INFO] Watch from unregistered client %s, ignoring", packet.getAddress().getSocketAddressAsString().c_str());
+		return;
+	}
+	getAuctionShard(watchMsg.itemNum).watch(watchMsg.itemNum, client, watching);
+}
 
-	Server* server = reinterpret_cast<Server*>(parameter);
+void udpServiceRoutine(void* parameter) {
+	Server::UDPShard* shard = reinterpret_cast<Server::UDPShard*>(parameter);
+	Server* server = shard->server;
 
-	DWORD numBytes = 0;
-	ULONG_PTR key = 0;
-	LPOVERLAPPED overlapped = nullptr;
+	Completion completion;
+	g_shardUDPSocket = &shard->socket;
 
 	log("[INFO] Started listening on UDP port %s", server->m_serverBindAddress.getSocketPortAsString().c_str());
 	while (server->m_running) {
-		bool status = GetQueuedCompletionStatus(server->m_udpServiceIOPort, &numBytes, &key, &overlapped, INFINITE);
-		if (!status) {
+		std::unique_lock<std::mutex> receiveLock(shard->receiveLock);
+
+		if (!shard->port->wait(completion)) {
 			// Most likely shutting down
 			break;
 		}
-		if (key == 0) {
+		if (completion.key == 0) {
 			// Shutdown requested
 			break;
 		}
+		if (completion.status == CompletionStatus::ABORTED) {
+			// Socket closed
+			break;
+		}
 
-		// Convert OverlappedBuffer to Packet for ease of use
-		OverlappedBuffer& buffer = server->m_serverUDPBuffer;
-		Packet packet(buffer.getData(), numBytes);
-		packet.setAddress(buffer.getAddress());
+		OverlappedBuffer& buffer = *completion.buffer;
 
-		server->handlePacket(packet);
+		const bool received = (completion.status == CompletionStatus::SUCCESS);
+		Packet packet;
+		if (received) {
+			// Convert OverlappedBuffer to Packet for ease of use, the copy lets the buffer go
+			// straight back to the socket while the packet is handled
+			packet = Packet(buffer.getData(), completion.numBytes);
+			packet.setAddress(buffer.getAddress());
+		}
+		else {
+			// Datagram sockets also report ICMP errors for earlier sends, those should not stop the service
+			log("[ERROR] %s", getWSAErrorString(completion.error).c_str());
+		}
 
 		try {
-			server->m_serverUDPSocket.receiveOverlapped(buffer);
+			shard->socket.receiveOverlapped(buffer);
 		}
 		catch (int32 error) {
 			log("[ERROR] %s", getWSAErrorString(error).c_str());
 			break;
 		}
+
+		const bool handleNow = received && !server->queueClientPacket(packet);
+		receiveLock.unlock();
+
+		if (handleNow) {
+			server->handleClientPackets(packet);
+		}
 	}
 	log("[INFO] UDP service routine shutdown");
 }
 
-void tcpServiceRoutine(PTP_CALLBACK_INSTANCE instance, PVOID parameter, PTP_WORK work) {
-	UNREFERENCED_PARAMETER(work);
-	CallbackMayRunLong(instance);
-
+void tcpServiceRoutine(void* parameter) {
 	Server* server = reinterpret_cast<Server*>(parameter);
 
-	DWORD numBytes = 0;
-	ULONG_PTR key = 0;
-	LPOVERLAPPED overlapped = nullptr;
-	TCPSocket acceptedSocket = server->m_serverTCPSocket.acceptOverlapped(server->m_serverTCPBuffer);
+	Completion completion;
 
 	log("[INFO] Started listening on TCP port %s", server->m_serverBindAddress.getSocketPortAsString().c_str());
 	while (server->m_running) {
-		bool result = GetQueuedCompletionStatus(server->m_tcpServiceIOPort, &numBytes, &key, &overlapped, INFINITE);
-		if (!result) {
-			DWORD error = GetLastError();
-
-			if (error == ERROR_ABANDONED_WAIT_0) {
-				break;
-			}
-			if (error == ERROR_OPERATION_ABORTED) {
-				// shutdown
-				break;
-			}
-
-			std::cout << "[ERROR] " << getWindowsErrorString(error);
+		if (!server->m_tcpServiceIOPort->wait(completion)) {
 			break;
 		}
-		if (key == 0) {
+		if (completion.key == 0) {
 			// shutdown
 			break;
 		}
+		if (completion.status == CompletionStatus::ABORTED) {
+			// shutdown
+			break;
+		}
+		if (completion.status != CompletionStatus::SUCCESS) {
+			std::cout << "[ERROR] " << getWSAErrorString(completion.error) << std::endl;
+			break;
+		}
 		//std::cout << "Accepted connection..." << std::endl;
 
-		SOCKET socketHandle = server->m_serverTCPSocket.getWinSockSocket();
-		int32 resultOpt = setsockopt(acceptedSocket.getWinSockSocket(), SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT, reinterpret_cast<char*>(&socketHandle), sizeof(socketHandle));
-		if (resultOpt == SOCKET_ERROR) {
-			int32 error = WSAGetLastError();
-			std::cout << getWSAErrorString(error) << std::endl;
-		}
+		try {
+			TCPSocket acceptedSocket = server->m_serverTCPSocket.completeAccept(*completion.buffer);
+			const uint64 establishedTime = getSystemTime() - static_cast<uint64>(acceptedSocket.getConnectedTime()) * 10000;
 
-		IPV4Address peerAddress = acceptedSocket.getPeerAddress();
-		//std::cout << peerAddress.getSocketAddressAsString() << std::endl;
-		auto connectionIter = server->m_connections.find(peerAddress.getSocketAddressAsString());
-		if (connectionIter != server->m_connections.end()) {
-			connectionIter->second.connect(std::move(acceptedSocket), server->m_connectionServiceIOPort);
+			// Binding to the connection happens on the pool so the accept goes straight back out
+			Server::AcceptedSocket* accepted = new Server::AcceptedSocket(server, std::move(acceptedSocket), establishedTime);
+			ThreadPool::get()->submit(bindConnectionRoutine, accepted);
+		}
+		catch (int32 error) {
+			std::cout << getWSAErrorString(error) << std::endl;
 		}
 
-		acceptedSocket = server->m_serverTCPSocket.acceptOverlapped(server->m_serverTCPBuffer);
+		server->m_serverTCPSocket.acceptOverlapped(*completion.buffer);
 	}
 
 	log("[INFO] TCP service routine shutdown");
 }
 
-void connectionServiceRoutine(PTP_CALLBACK_INSTANCE instance, PVOID parameter, PTP_WORK work) {
-	UNREFERENCED_PARAMETER(work);
-	CallbackMayRunLong(instance);
+void bindConnectionRoutine(void* parameter) {
+	Server::AcceptedSocket* accepted = reinterpret_cast<Server::AcceptedSocket*>(parameter);
+	if (accepted->server->m_running) {
+		accepted->server->bindConnection(*accepted);
+	}
+	delete accepted;
+}
+
+void Server::bindConnection(AcceptedSocket& accepted) {
+	try {
+		IPV4Address peerAddress = accepted.socket.getPeerAddress();
+		//std::cout << peerAddress.getSocketAddressAsString() << std::endl;
+		{
+			std::lock_guard<std::mutex> lock(m_connectionLock);
+			auto connectionIter = m_connections.find(m_clients.find(peerAddress.getEndpointKey()));
+			if (connectionIter == m_connections.end()) {
+				return;
+			}
+			connectionIter->second.connect(std::move(accepted.socket), *m_connectionServiceIOPort);
+		}
+
+		const uint64 now = getSystemTime();
+		const uint64 wait = (now > accepted.establishedTime) ? now - accepted.establishedTime : 0;
+		m_numAccepts++;
+		m_totalAcceptWait += wait;
 
+		uint64 maxWait = m_maxAcceptWait;
+		while (wait > maxWait && !m_maxAcceptWait.compare_exchange_weak(maxWait, wait)) {}
+	}
+	catch (int32 error) {
+		std::cout << getWSAErrorString(error) << std::endl;
+	}
+}
+
+void connectionServiceRoutine(void* parameter) {
 	Server* server = reinterpret_cast<Server*>(parameter);
 	
-	DWORD numBytes = 0;
-	ULONG_PTR key = 0;
-	LPOVERLAPPED overlapped = nullptr;
+	Completion completion;
 
 	while (server->m_running) {
-		bool result = GetQueuedCompletionStatus(server->m_connectionServiceIOPort, &numBytes, &key, &overlapped, INFINITE);
-		Connection* connection = reinterpret_cast<Connection*>(key);
-		
-		if (!result) {
-			DWORD error = GetLastError();
-
-			if (error == ERROR_ABANDONED_WAIT_0) {
-				continue;
-			}
-			if (error == ERROR_OPERATION_ABORTED) {
-				// Connection shutdown by server
-				continue;
-			}
-			if (error == ERROR_NETNAME_DELETED) {
-				// Ungraceful shutdown (AKA crash on client)
-				// TODO delete connection data if not bidding
-				connection->shutdown();
-				continue;
-			}
-
-			std::cout << "[ERROR] " << getWindowsErrorString(error);
-			continue;
+		if (!server->m_connectionServiceIOPort->wait(completion)) {
+			break;
 		}
-		if (key == 0) {
+		Connection* connection = reinterpret_cast<Connection*>(completion.key);
+
+		if (completion.key == 0) {
 			// Server shutdown
 			break;
 		}
-		if (numBytes == 0) {
+		if (completion.status == CompletionStatus::ABORTED) {
+			// Connection shutdown by server
+			continue;
+		}
+		if (completion.status == CompletionStatus::DISCONNECTED) {
+			// Ungraceful shutdown (AKA crash on client)
+			// TODO delete connection data if not bidding
+			std::lock_guard<std::mutex> lock(server->m_connectionLock);
+			connection->shutdown();
+			continue;
+		}
+		if (completion.status != CompletionStatus::SUCCESS) {
+			std::cout << "[ERROR] " << getWSAErrorString(completion.error);
+			continue;
+		}
+		if (completion.numBytes == 0) {
 			// Connection shutdown by client
 			// TODO delete connection data if not bidding
+			std::lock_guard<std::mutex> lock(server->m_connectionLock);
 			connection->shutdown();
 			continue;
 		}
 
 
+		// A receive can hold several messages or only part of one
 		OverlappedBuffer& buffer = connection->getOverlappedBuffer();
-		Packet packet(buffer.getData(), numBytes);
-		packet.setAddress(connection->getAddress());
+		FrameReader& frameReader = connection->getFrameReader();
+		frameReader.feed(buffer.getData(), completion.numBytes);
 
-		// Handle packet
-		server->handlePacket(packet);
+		const uint8* message;
+		uint32 messageSize;
+		while (frameReader.next(message, messageSize)) {
+			Packet packet(message, messageSize);
+			packet.setAddress(connection->getAddress());
+
+			// Handle packet
+			server->handlePacket(packet);
+		}
+
+		if (frameReader.isCorrupt()) {
+			log("[ERROR] Received a malformed frame from %s, closing the connection", connection->getAddress().getSocketAddressAsString().c_str());
+			std::lock_guard<std::mutex> lock(server->m_connectionLock);
+			connection->shutdown();
+			continue;
+		}
 
 		connection->receiveOverlapped();
 	}
 	log("[INFO] Connection service routine shutdown");
 }
 
-void Server::saveConnections() {
-	std::ofstream output("connections.dat");
 
-	if (!output) {
-		log("[ERROR] Failed to save connections to file");
-		return;
-	}
+void Server::journalRegister(const std::string& name, const IPV4Address& address) {
+	JournalRecord* record = new JournalRecord();
+	record->writeString(address.getSocketAddressAsString());
+	record->writeString(address.getSocketPortAsString());
+	record->writeString(name);
+	m_persister.persist(static_cast<uint8>(RecordType::REGISTER), record);
+}
 
-	output << m_connections.size() << '\n';
+void Server::journalDeregister(const IPV4Address& address) {
+	JournalRecord* record = new JournalRecord();
+	record->writeString(address.getSocketAddressAsString());
+	m_persister.persist(static_cast<uint8>(RecordType::DEREGISTER), record);
+}
 
-	for (auto& pair : m_connections) {
-		Connection& connection = pair.second;
-		output << connection.getAddress().getSocketAddressAsString() << '\n';
-		output << connection.getAddress().getSocketPortAsString() << '\n';
-		output << connection.getUniqueName() << '\n';
-	}
+void Server::journalStart(const Item& item, float32 currentHighest, ClientID highestBidder) {
+	JournalRecord* record = new JournalRecord();
+	record->writeUInt32(item.getItemID());
+	record->writeString(item.getDescription());
+	record->writeFloat32(item.getMinimum());
+	record->writeFloat32(currentHighest);
+	record->writeString(clientToString(item.getSeller()));
+	record->writeString(clientToString(highestBidder));
+	record->writeUInt64(item.getAuctionStartTime());
+	m_persister.persist(static_cast<uint8>(RecordType::START), record);
+}
 
-	output << m_offeredItems.size() << '\n';
+void Server::journalBid(uint32 itemID, float32 amount, ClientID bidder) {
+	JournalRecord* record = new JournalRecord();
+	record->writeUInt32(itemID);
+	record->writeFloat32(amount);
+	record->writeString(clientToString(bidder));
+	m_persister.persist(static_cast<uint8>(RecordType::BID), record);
+}
 
-	for (auto& pair : m_offeredItems) {
-		Item* item = pair.second;
+void Server::journalEnd(uint32 itemID) {
+	JournalRecord* record = new JournalRecord();
+	record->writeUInt32(itemID);
+	m_persister.persist(static_cast<uint8>(RecordType::END), record);
+}
 
-		output << item->getItemID() << '\n';
-		output << item->getDescription() << '\n';
-		output << item->getMinimum() << '\n';
-		output << item->getCurrentHighest() << '\n';
-		output << item->getSeller() << '\n';
-		output << item->getHighestBidder() << '\n';
+void Server::confirm(const Packet& confirmation) {
+	ConfirmPolicy policy = ConfirmPolicy::IMMEDIATE;
+	switch (*reinterpret_cast<const MessageType*>(confirmation.getMessageData())) {
+	case MessageType::MSG_REGISTERED:
+		policy = m_registeredConfirm;
+		break;
+	case MessageType::MSG_DEREG_CONF:
+		policy = m_deregConfirm;
+		break;
+	case MessageType::MSG_OFFER_CONF:
+		policy = m_offerConfirm;
+		break;
+	default:
+		break;
+	}
 
-		FILETIME fileTime;
-		GetSystemTimeAsFileTime(&fileTime);
-		ULARGE_INTEGER* time = reinterpret_cast<ULARGE_INTEGER*>(&fileTime);
-		output << time->QuadPart - item->getAuctionStartTime() << '\n';
+	if (policy == ConfirmPolicy::DURABLE) {
+		m_persister.confirm(confirmation);
+	}
+	else {
+		sendConfirmation(confirmation);
 	}
+}
 
-	output.close();
+void Server::sendConfirmation(const Packet& confirmation) {
+	getUDPSocket().send(confirmation);
+	log(LogType::LOG_SEND, *reinterpret_cast<const MessageType*>(confirmation.getMessageData()), confirmation.getAddress());
 }
 
-void Server::loadConnections() {
-	std::ifstream input("connections.dat");
+void Server::saveConnections() {
+	m_persister.checkpoint();
+}
+
+std::string Server::clientToString(ClientID client) const {
+	return (client != INVALID_CLIENT_ID) ? m_clients.getAddress(client).getSocketAddressAsString() : std::string();
+}
 
+void Server::loadTextSnapshot(uint64 baseTime, StateImage& image) {
+	std::ifstream input(SNAPSHOT_PATH);
 	if (!input) {
-		// if file not found do nothing
 		return;
 	}
 
@@ -726,14 +1140,13 @@ void Server::loadConnections() {
 		input >> port;
 		input >> name;
 
-		m_connections[ip] = Connection(name, IPV4Address(ip, port));
+		const IPV4Address address(ip, port);
+		image.addConnection(address.getEndpointKey().address, reinterpret_cast<const sockaddr_in*>(address.getSocketAddress())->sin_port, name);
 	}
 
 	int32 numItems = 0;
 	input >> numItems;
 
-	uint32 highestID = 1;
-
 	for (int32 i = 0; i < numItems; i++) {
 		uint32 itemId = 0;
 		std::string description;
@@ -755,15 +1168,120 @@ void Server::loadConnections() {
 		std::getline(input, highestBidder);
 		input >> time;
 
-		Item item(description, minimum, seller, itemId);
-		item.setCurrentHighest(currentHighest);
-		item.setHighestBidder(highestBidder);
+		ImageItem item;
+		item.description = description;
+		item.minimum = minimum;
+		item.currentHighest = currentHighest;
+		item.seller = StateImage::parseAddress(seller);
+		item.highestBidder = StateImage::parseAddress(highestBidder);
+		item.hasBidder = !highestBidder.empty();
+		item.startTime = baseTime - time;
+		image.addItem(itemId, item);
+	}
+
+	input.close();
+}
+
+void Server::loadConnections() {
+	const uint64 now = getSystemTime();
+	StateImage& image = m_persister.getImage();
+
+	Snapshot snapshot;
+	const SnapshotStatus status = snapshot.open(SNAPSHOT_PATH);
+
+	// Auctions only run while the server does, so their time is measured up to the last change
+	// saved before it stopped. The snapshot counts from when it was taken. The old text format
+	// didn't say, it went with the journal's base time.
+	const bool journaled = m_journal.read();
+	uint64 lastTime = (status == SnapshotStatus::LOADED) ? snapshot.getBaseTime() : journaled ? m_journal.getBaseTime() : now;
+
+	switch (status) {
+	case SnapshotStatus::LOADED:
+		image.load(snapshot);
+		log("[INFO] Loaded %u connections and %u items from the snapshot in %.2f ms", snapshot.getNumConnections(), snapshot.getNumItems(), (getSystemTime() - now) / 10000.0);
+		break;
+	case SnapshotStatus::TEXT:
+		snapshot.close();
+		loadTextSnapshot(lastTime, image);
+		log("[INFO] Loaded %u connections and %u items from the old text format in %.2f ms, the next save replaces it", static_cast<uint32>(image.getConnections().size()), static_cast<uint32>(image.getItems().size()), (getSystemTime() - now) / 10000.0);
+		break;
+	case SnapshotStatus::CORRUPT:
+		// Kept aside rather than overwritten by the next save
+		snapshot.close();
+		File::replace(SNAPSHOT_PATH, std::string(SNAPSHOT_PATH) + ".damaged");
+		log("[ERROR] Snapshot is damaged, moved it aside and starting without it");
+		break;
+	case SnapshotStatus::MISSING:
+		break;
+	}
 
-		if (itemId > highestID) {
-			highestID = itemId;
+	// The journal starts before the snapshot if the server stopped between saving it and starting
+	// the journal over. Everything up to the snapshot's marker is in it already.
+	uint32 numRecords = 0;
+	if (journaled) {
+		numRecords = m_journal.replay([&image, &snapshot, status, &lastTime](uint8 type, uint64 time, JournalReader& reader) {
+			if (static_cast<RecordType>(type) == RecordType::CHECKPOINT) {
+				const uint64 snapshotTime = reader.readUInt64();
+				if (status == SnapshotStatus::LOADED && snapshotTime == snapshot.getBaseTime()) {
+					image.clear();
+					image.load(snapshot);
+				}
+			}
+			else if (!image.apply(static_cast<RecordType>(type), reader)) {
+				log("[ERROR] Unreadable journal record of type %u, skipping it", static_cast<uint32>(type));
+			}
+			lastTime = std::max(lastTime, time);
+		});
+		log("[INFO] Replayed %u journal records", numRecords);
+	}
+	snapshot.close();
+	if (!m_journal.open(now)) {
+		log("[ERROR] Failed to open the journal, changes won't be saved");
+	}
+
+	const uint32 numConnections = static_cast<uint32>(image.getConnections().size());
+	m_clients.reserve(numConnections);
+	m_connections.reserve(numConnections);
+	m_namedClients.reserve(numConnections);
+	for (const auto& pair : image.getConnections()) {
+		const IPV4Address address = Snapshot::toAddress(pair.first, pair.second.port);
+		const ClientID id = m_clients.intern(address);
+		// Built in place, a Connection is too big to construct twice for each of millions
+		m_connections.emplace(std::piecewise_construct, std::forward_as_tuple(id), std::forward_as_tuple(id, pair.second.name, address));
+		m_namedClients[pair.second.name] = id;
+	}
+
+	// Straight into the shards before they run, nothing to announce and nothing new to journal
+	const uint64 restoreStart = getSystemTime();
+	uint32 highestID = 1;
+	for (auto& pair : image.getItems()) {
+		ImageItem& record = pair.second;
+
+		Item* item = new Item(record.description, record.minimum, m_clients.intern(Snapshot::toAddress(record.seller, 0)), pair.first);
+		item->setCurrentHighest(record.currentHighest);
+		m_clients.getState(item->getSeller()).openOffers++;
+		if (record.hasBidder) {
+			item->setHighestBidder(m_clients.intern(Snapshot::toAddress(record.highestBidder, 0)));
+			m_clients.getState(item->getHighestBidder()).leadingBids++;
 		}
-		startAuction(item, 3000000000ull - time);
+
+		if (pair.first > highestID) {
+			highestID = pair.first;
+		}
+
+		// The image counts the time it was down out too, as the shard does
+		const uint64 elapsed = std::min<uint64>((lastTime > record.startTime) ? lastTime - record.startTime : 0, AUCTION_TIME);
+		record.startTime = now - elapsed;
+		getAuctionShard(pair.first).restoreAuction(item, AUCTION_TIME - elapsed);
 	}
 
-	input.close();
-}
\ No newline at end of file
+	for (AuctionShard* shard : m_auctionShards) {
+		shard->reserveItemIDs(highestID);
+	}
+	log("[INFO] Restored %u auctions in %.2f ms", static_cast<uint32>(image.getItems().size()), (getSystemTime() - restoreStart) / 10000.0);
+
+	// One snapshot for everything restored, so the next start has no journal to replay
+	if (status != SnapshotStatus::MISSING || numRecords > 0) {
+		saveConnections();
+	}
+}
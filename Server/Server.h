@@ -1,47 +1,175 @@
 #pragma once
 
 #include <unordered_map>
+#include <atomic>
+#include <deque>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "Types.h"
 
 #include "ThreadPool.h"
+#include "CompletionPort.h"
 #include "Connection.h"
 #include "IPV4Address.h"
 #include "UDPSocket.h"
 #include "TCPSocket.h"
 #include "OverlappedBuffer.h"
 #include "Item.h"
+#include "AuctionShard.h"
+#include "ClientRegistry.h"
+#include "FanOut.h"
+#include "Journal.h"
+#include "Snapshot.h"
+#include "StateImage.h"
+#include "Persister.h"
+
+// What happens when a connection's send queue is full
+enum class SlowConsumerPolicy : uint8 {
+	DROP_OLDEST_HIGHEST,	// Make room by dropping the oldest queued HIGHEST for the same item
+	DISCONNECT,
+	RESYNC					// Stop sending HIGHEST until the client catches up, then send the current bids
+};
+
+struct ServerOptions {
+	IOEngine ioEngine = IOEngine::DEFAULT;
+	uint32 udpReceiveBuffers = 16;	// Receives kept posted on each UDP socket
+	uint32 udpShards = 1;	// UDP sockets sharing the port through SO_REUSEPORT, zero for one per hardware thread
+	uint32 udpServiceThreads = 0;	// Per shard, zero to split the hardware threads between shards
+	uint32 udpSocketBufferSize = 4 * 1024 * 1024;	// Kernel side room for bursts, capped by the OS
+	uint32 tcpPendingAccepts = 64;	// Accepts kept posted on the listener for reconnect storms
+	uint32 sendQueueMessages = 1024;	// Per connection, sends past either limit go through the slow consumer policy
+	uint32 sendQueueBytes = 256 * 1024;
+	SlowConsumerPolicy slowConsumerPolicy = SlowConsumerPolicy::DROP_OLDEST_HIGHEST;	// Anything but HIGHEST disconnects when it doesn't fit
+	uint32 auctionShards = 1;	// Matching threads owning a slice of the auctions each, zero for one per hardware thread
+	uint32 auctionRingSize = 16384;	// Commands and events each shard can have waiting
+	uint32 fanOutChunkSize = 256;	// Recipients per thread when a broadcast is split between pool workers
+	bool highestToWatchers = true;	// HIGHEST only to the clients watching the item, otherwise to everyone
+	uint32 highestConflationTime = 0;	// Milliseconds a HIGHEST is held back so newer bids on the item replace it, zero to send each one
+	JournalSyncPolicy journalSync = JournalSyncPolicy::COMMIT;
+	uint32 journalSyncInterval = 100;	// Milliseconds between syncs with the interval policy
+	uint32 journalCompactSize = 4 * 1024 * 1024;	// Journal size in bytes that has it folded into a new snapshot
+	uint32 persistQueueSize = 16384;	// Changes and confirmations that can wait for the persistence thread
+	ConfirmPolicy registeredConfirm = ConfirmPolicy::DURABLE;
+	ConfirmPolicy deregConfirm = ConfirmPolicy::IMMEDIATE;
+	ConfirmPolicy offerConfirm = ConfirmPolicy::IMMEDIATE;
+};
 
 class Server {
 private:
-	friend void udpServiceRoutine(PTP_CALLBACK_INSTANCE instance, PVOID parameter, PTP_WORK work);
-	friend void tcpServiceRoutine(PTP_CALLBACK_INSTANCE instance, PVOID parameter, PTP_WORK work);
-	friend void connectionServiceRoutine(PTP_CALLBACK_INSTANCE instance, PVOID parameter, PTP_WORK work);
-
-	std::unordered_map<std::string, Connection> m_connections;
-	std::unordered_map<uint32, Item*> m_offeredItems;
+	// A UDP socket with its own completion port, posted buffers and workers. With several shards
+	// the sockets share the server port and the kernel spreads clients between them.
+	struct UDPShard {
+		Server* server;
+		UDPSocket socket;
+		CompletionPort* port;
+		OverlappedBuffer* buffers;
+
+		// Only one worker waits at a time so packets reach the client queues in the order they arrived
+		std::mutex receiveLock;
+
+		UDPShard() : socket(true) {}
+	};
+
+	// Accepted socket on its way to the bind stage
+	struct AcceptedSocket {
+		Server* server;
+		TCPSocket socket;
+		uint64 establishedTime;	// When the handshake completed, in 100 nanosecond ticks
+
+		AcceptedSocket(Server* owner, TCPSocket&& accepted, uint64 established) : server(owner), socket(std::move(accepted)), establishedTime(established) {}
+	};
+
+	friend void udpServiceRoutine(void* parameter);
+	friend void tcpServiceRoutine(void* parameter);
+	friend void bindConnectionRoutine(void* parameter);
+	friend void connectionServiceRoutine(void* parameter);
+	friend class AuctionShard;
+	friend class Persister;
+
+	// Packets from a client that arrived while another worker was still handling one of theirs
+	struct ClientPackets {
+		bool handling;
+		std::deque<Packet> packets;
+
+		ClientPackets() : handling(false) {}
+	};
+
+	// Clients are told apart by IP address, only logging and connections.dat spell it out as a string
+	ClientRegistry m_clients;
+
+	// Needed to insert into, iterate or look up connections. Removing one also requires
+	// g_auctionLock, so holding that is enough to keep a Connection reference valid.
+	std::mutex m_connectionLock;
+	std::unordered_map<ClientID, Connection> m_connections;
+	// Registered names, kept with m_connections under the same locks
+	std::unordered_map<std::string, ClientID> m_namedClients;
+
+	// Open auctions, split by item ID. New items go to the shards in turn.
+	std::vector<AuctionShard*> m_auctionShards;
+	std::atomic<uint32> m_nextAuctionShard;
+
+	// Shared by every shard, so a client whose datagrams land on different shards is still handled in order
+	std::mutex m_clientPacketsLock;
+	std::unordered_map<EndpointKey, ClientPackets, EndpointKeyHash> m_clientPackets;
 
 	bool m_running;
 
 	IPV4Address m_serverBindAddress;
 
-	OverlappedBuffer m_serverUDPBuffer;
-	OverlappedBuffer m_serverTCPBuffer;
+	std::vector<UDPShard*> m_udpShards;
+	uint32 m_numUDPBuffers;
+	uint32 m_numUDPServiceThreads;
+	uint32 m_udpSocketBufferSize;
 
-	UDPSocket m_serverUDPSocket;
+	OverlappedBuffer* m_serverTCPBuffers;
+	uint32 m_numTCPBuffers;
 	TCPSocket m_serverTCPSocket;
 
-	HANDLE m_udpServiceIOPort;
-	HANDLE m_tcpServiceIOPort;
-	HANDLE m_connectionServiceIOPort;
-
+	// Time from the handshake completing to the connection being bound, in 100 nanosecond ticks
+	std::atomic<uint64> m_numAccepts;
+	std::atomic<uint64> m_totalAcceptWait;
+	std::atomic<uint64> m_maxAcceptWait;
+
+	std::atomic<uint64> m_numHandledMessages;
+
+	uint32 m_sendQueueMessages;
+	uint32 m_sendQueueBytes;
+	SlowConsumerPolicy m_slowConsumerPolicy;
+	std::atomic<uint64> m_numDroppedHighest;
+	std::atomic<uint64> m_numResyncs;
+	std::atomic<uint64> m_numSlowDisconnects;
+
+	// Every change since connections.dat was written, folded back into it once it grows too big.
+	// Only the persister writes to it.
+	Journal m_journal;
+	Persister m_persister;
+	ConfirmPolicy m_registeredConfirm;
+	ConfirmPolicy m_deregConfirm;
+	ConfirmPolicy m_offerConfirm;
+
+	// Spreads TCP broadcasts over the pool workers
+	FanOut m_fanOut;
+	bool m_highestToWatchers;
+
+	CompletionPort* m_tcpServiceIOPort;
+	CompletionPort* m_connectionServiceIOPort;
+
+	UDPSocket& getUDPSocket();
+	void bindConnection(AcceptedSocket& accepted);
+
+	// Returns true if the packet was queued behind one from the same client still being handled,
+	// otherwise the caller is now handling that client and must call handleClientPackets
+	bool queueClientPacket(Packet& packet);
+	void handleClientPackets(Packet& packet);
 	void handlePacket(const Packet& packet);
 	void handleRegisterPacket(const Packet& packet);
 	void handleDeregisterPacket(const Packet& packet);
 	void handleOfferPacket(const Packet& packet);
 	void handleBidPacket(const Packet& packet);
+	void handleWatchPacket(const Packet& packet, bool watching);
 
 	void sendRegistered(uint32 reqNum, const std::string& name, const std::string& ip, const std::string& port, const IPV4Address& address);
 	void sendUnregistered(uint32 reqNum, const std::string& reason, const IPV4Address& address);
@@ -50,30 +178,68 @@ private:
 	void sendOfferConf(uint32 reqNum, uint32 itemNum, const std::string& description, float32 minimum, const IPV4Address& address);
 	void sendOfferDenied(uint32 reqNum, const std::string& reason, const IPV4Address& address);
 	void sendNewItem(const Item& item);
-	void sendHighest(const Item& item);
+	void sendHighest(const Item& item, float32 amount);
 	void sendWin(const Item& item);
 	void sendBidOver(const Item& item);
 	void sendSoldTo(const Item& item);
 	void sendNotSold(const Item& item);
 
+	// Queues the packet within the connection's send limits. Returns false if it was dropped or
+	// the connection was cut off by the slow consumer policy.
+	bool sendToConnection(Connection& connection, const Packet& packet);
+	void resyncConnection(Connection& connection);
+	// Sends the packet through m_fanOut to every connected client, or only to the ones watching the item
+	void broadcast(const Packet& packet, const Item* watched = nullptr);
+	static void broadcastToConnection(Connection& connection, void* context);
+
+	AuctionShard& getAuctionShard(uint32 itemID) { return *m_auctionShards[itemID % m_auctionShards.size()]; }
+
+	// Each queues the record for the persister. Records only ever describe a state, so replaying
+	// one that the snapshot already has changes nothing.
+	void journalRegister(const std::string& name, const IPV4Address& address);
+	void journalDeregister(const IPV4Address& address);
+	void journalStart(const Item& item, float32 currentHighest, ClientID highestBidder);
+	void journalBid(uint32 itemID, float32 amount, ClientID bidder);
+	void journalEnd(uint32 itemID);
+	// Sends the confirmation now or once everything queued before it is durable, as the policy
+	// for its message type says. Queue the change first.
+	void confirm(const Packet& confirmation);
+	void sendConfirmation(const Packet& confirmation);
+	// connections.dat as it was written before snapshots were binary
+	void loadTextSnapshot(uint64 baseTime, StateImage& image);
+
+	// Persisted as the address string, an empty one for no client
+	std::string clientToString(ClientID client) const;
+
 public:
-	Server(const IPV4Address& bindAddress);
+	Server(const IPV4Address& bindAddress, const ServerOptions& options = ServerOptions());
 	virtual ~Server();
 
 	void startUDPServiceThread();
 	void startTCPServiceThread();
 	void startConnectionServiceThread();
+	void startAuctionShards();
+	void startPersistenceThread();
 
 	void shutdown();
 
-	void startAuction(const Item& item, uint64 auctionTime = 3000000000ull);
-	void bid(uint32 itemID, float32 newBid, const std::string& bidder);
-	void endAuction(const Item& item);
-	bool isSeller(const std::string& seller);
-	bool isHighestBidder(const std::string& bidder);
-	int32 getNumOffers(const std::string& seller);
+	void logStatistics();
+
+	// Takes ownership of the item, the auction starts on the item's shard
+	void startAuction(Item* item, uint64 auctionTime = AUCTION_TIME);
+	void bid(uint32 itemID, float32 newBid, ClientID bidder);
+	bool isSeller(ClientID seller);
+	bool isHighestBidder(ClientID bidder);
+	int32 getNumOffers(ClientID seller);
+	// Open items the client is selling and items it is the highest bidder on, from every shard
+	void getActiveAuctions(ClientID client, std::vector<uint32>& selling, std::vector<uint32>& leading);
 
+	// Writes a new snapshot and starts the journal over, only while the persistence thread isn't
+	// running. It checkpoints on its own as the journal grows.
 	void saveConnections();
+	// Snapshot first, then everything the journal has on top of it, into the persister's image and
+	// from there into the live state. Before the auction shards are started, restored auctions go
+	// straight into them.
 	void loadConnections();
 };
 
@@ -0,0 +1,157 @@
+#include "Snapshot.h"
+
+#include "Checksum.h"
+#include "File.h"
+
+#include <cstddef>
+#include <cstring>
+
+static constexpr uint32 SNAPSHOT_MAGIC = 0x50414E53;	// "SNAP"
+static constexpr uint32 SNAPSHOT_VERSION = 1;
+
+struct SnapshotHeader {
+	uint32 magic;
+	uint32 version;
+	uint32 checksum;	// Covers everything after it
+	uint32 numConnections;
+	uint32 numItems;
+	uint32 stringsSize;
+	uint64 baseTime;
+};
+
+static_assert(sizeof(SnapshotHeader) == 32, "Snapshot records are written as they are laid out in memory");
+
+void SnapshotWriter::reserve(uint32 numConnections, uint32 numItems) {
+	m_connections.reserve(numConnections);
+	m_items.reserve(numItems);
+}
+
+void SnapshotWriter::addConnection(uint32 address, uint16 port, const std::string& name) {
+	SnapshotConnection connection = {};
+	connection.address = address;
+	connection.port = port;
+	connection.nameOffset = static_cast<uint32>(m_strings.size());
+	connection.nameSize = static_cast<uint32>(name.size());
+	m_connections.push_back(connection);
+	m_strings += name;
+}
+
+void SnapshotWriter::addItem(SnapshotItem item, const std::string& description) {
+	item.descriptionOffset = static_cast<uint32>(m_strings.size());
+	item.descriptionSize = static_cast<uint32>(description.size());
+	m_items.push_back(item);
+	m_strings += description;
+}
+
+bool SnapshotWriter::write(const std::string& path, uint64 baseTime) const {
+	const uint64 connectionsSize = m_connections.size() * sizeof(SnapshotConnection);
+	const uint64 itemsSize = m_items.size() * sizeof(SnapshotItem);
+
+	std::vector<uint8> contents(sizeof(SnapshotHeader) + connectionsSize + itemsSize + m_strings.size());
+	uint8* data = contents.data();
+	if (connectionsSize > 0) {
+		memcpy(data + sizeof(SnapshotHeader), m_connections.data(), connectionsSize);
+	}
+	if (itemsSize > 0) {
+		memcpy(data + sizeof(SnapshotHeader) + connectionsSize, m_items.data(), itemsSize);
+	}
+	if (!m_strings.empty()) {
+		memcpy(data + sizeof(SnapshotHeader) + connectionsSize + itemsSize, m_strings.data(), m_strings.size());
+	}
+
+	SnapshotHeader header = {};
+	header.magic = SNAPSHOT_MAGIC;
+	header.version = SNAPSHOT_VERSION;
+	header.numConnections = static_cast<uint32>(m_connections.size());
+	header.numItems = static_cast<uint32>(m_items.size());
+	header.stringsSize = static_cast<uint32>(m_strings.size());
+	header.baseTime = baseTime;
+	memcpy(data, &header, sizeof(header));
+
+	const uint32 checksumEnd = offsetof(SnapshotHeader, checksum) + sizeof(header.checksum);
+	header.checksum = crc32(data + checksumEnd, contents.size() - checksumEnd);
+	memcpy(data, &header, sizeof(header));
+
+	return File::writeAtomically(path, data, contents.size());
+}
+
+Snapshot::Snapshot() :
+	m_baseTime(0)
+	, m_numConnections(0)
+	, m_numItems(0)
+	, m_connections(nullptr)
+	, m_items(nullptr)
+	, m_strings(nullptr)
+	, m_stringsSize(0)
+{}
+
+SnapshotStatus Snapshot::open(const std::string& path) {
+	close();
+
+	if (!m_file.open(path)) {
+		return SnapshotStatus::MISSING;
+	}
+
+	const uint8* data = m_file.getData();
+	const uint64 size = m_file.getSize();
+	if (size < sizeof(SnapshotHeader)) {
+		// The text format starts with the number of connections, which is never four bytes of "SNAP"
+		return (size > 0) ? SnapshotStatus::TEXT : SnapshotStatus::MISSING;
+	}
+
+	SnapshotHeader header;
+	memcpy(&header, data, sizeof(header));
+	if (header.magic != SNAPSHOT_MAGIC) {
+		return SnapshotStatus::TEXT;
+	}
+	if (header.version != SNAPSHOT_VERSION) {
+		return SnapshotStatus::CORRUPT;
+	}
+
+	const uint64 connectionsSize = static_cast<uint64>(header.numConnections) * sizeof(SnapshotConnection);
+	const uint64 itemsSize = static_cast<uint64>(header.numItems) * sizeof(SnapshotItem);
+	if (size != sizeof(SnapshotHeader) + connectionsSize + itemsSize + header.stringsSize) {
+		return SnapshotStatus::CORRUPT;
+	}
+
+	const uint32 checksumEnd = offsetof(SnapshotHeader, checksum) + sizeof(header.checksum);
+	if (crc32(data + checksumEnd, size - checksumEnd) != header.checksum) {
+		return SnapshotStatus::CORRUPT;
+	}
+
+	// Every record is a multiple of 8 bytes and the mapping is page aligned, so they can be used in place
+	m_baseTime = header.baseTime;
+	m_numConnections = header.numConnections;
+	m_numItems = header.numItems;
+	m_connections = reinterpret_cast<const SnapshotConnection*>(data + sizeof(SnapshotHeader));
+	m_items = reinterpret_cast<const SnapshotItem*>(data + sizeof(SnapshotHeader) + connectionsSize);
+	m_strings = reinterpret_cast<const char*>(data + sizeof(SnapshotHeader) + connectionsSize + itemsSize);
+	m_stringsSize = header.stringsSize;
+	return SnapshotStatus::LOADED;
+}
+
+void Snapshot::close() {
+	m_file.close();
+	m_baseTime = 0;
+	m_numConnections = 0;
+	m_numItems = 0;
+	m_connections = nullptr;
+	m_items = nullptr;
+	m_strings = nullptr;
+	m_stringsSize = 0;
+}
+
+std::string Snapshot::getString(uint32 offset, uint32 size) const {
+	if (offset > m_stringsSize || m_stringsSize - offset < size) {
+		return std::string();
+	}
+	return std::string(m_strings + offset, size);
+}
+
+IPV4Address Snapshot::toAddress(uint32 address, uint16 port) {
+	sockaddr_in socketAddress = {};
+	socketAddress.sin_family = AF_INET;
+	socketAddress.sin_addr.s_addr = address;
+	socketAddress.sin_port = port;
+	return IPV4Address(socketAddress);
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "Types.h"
+#include "IPV4Address.h"
+#include "MappedFile.h"
+
+#include <string>
+#include <vector>
+
+// Fixed width records, used straight from the mapped file. Addresses are kept the way the sockets
+// have them, strings are slices of the string table at the end of the file.
+struct SnapshotConnection {
+	uint32 address;		// Network byte order
+	uint16 port;		// Network byte order
+	uint16 padding;
+	uint32 nameOffset;
+	uint32 nameSize;
+};
+
+struct SnapshotItem {
+	uint32 itemID;
+	uint32 descriptionOffset;
+	uint32 descriptionSize;
+	float32 minimum;
+	float32 currentHighest;
+	uint32 seller;			// Address in network byte order, all a client is known by
+	uint32 highestBidder;	// Only if hasBidder is set
+	uint32 hasBidder;
+	uint64 elapsed;			// How long the auction had run when the snapshot was taken, in 100 nanosecond ticks
+};
+
+static_assert(sizeof(SnapshotConnection) == 16, "Snapshot records are written as they are laid out in memory");
+static_assert(sizeof(SnapshotItem) == 40, "Snapshot records are written as they are laid out in memory");
+
+enum class SnapshotStatus : uint8 {
+	MISSING,
+	LOADED,
+	TEXT,		// Written before snapshots were binary, still read once so nothing is lost
+	CORRUPT		// Torn, failed its checksum or a version this server doesn't know
+};
+
+// Gathers the records, then writes the whole snapshot in one go
+class SnapshotWriter {
+private:
+	std::vector<SnapshotConnection> m_connections;
+	std::vector<SnapshotItem> m_items;
+	std::string m_strings;
+public:
+	void reserve(uint32 numConnections, uint32 numItems);
+
+	// Address and port in network byte order
+	void addConnection(uint32 address, uint16 port, const std::string& name);
+	// The description's place in the string table is filled in here
+	void addItem(SnapshotItem item, const std::string& description);
+
+	// Replaces the snapshot at path in a single step, a crash leaves the old one
+	bool write(const std::string& path, uint64 baseTime) const;
+};
+
+class Snapshot {
+private:
+	MappedFile m_file;
+	uint64 m_baseTime;
+	uint32 m_numConnections;
+	uint32 m_numItems;
+	const SnapshotConnection* m_connections;
+	const SnapshotItem* m_items;
+	const char* m_strings;
+	uint32 m_stringsSize;
+public:
+	Snapshot();
+
+	// Checks the whole file before anything is read from it
+	SnapshotStatus open(const std::string& path);
+	void close();
+
+	// When the snapshot was taken, in 100 nanosecond ticks
+	uint64 getBaseTime() const { return m_baseTime; }
+	uint32 getNumConnections() const { return m_numConnections; }
+	const SnapshotConnection& getConnection(uint32 index) const { return m_connections[index]; }
+	uint32 getNumItems() const { return m_numItems; }
+	const SnapshotItem& getItem(uint32 index) const { return m_items[index]; }
+	std::string getString(uint32 offset, uint32 size) const;
+
+	static IPV4Address toAddress(uint32 address, uint16 port);
+};
@@ -0,0 +1,151 @@
+#include "StateImage.h"
+
+#include "Snapshot.h"
+#include "Journal.h"
+#include "IPV4Address.h"
+
+void StateImage::load(const Snapshot& snapshot) {
+	const uint32 numConnections = snapshot.getNumConnections();
+	m_connections.reserve(numConnections);
+	for (uint32 i = 0; i < numConnections; i++) {
+		const SnapshotConnection& record = snapshot.getConnection(i);
+		addConnection(record.address, record.port, snapshot.getString(record.nameOffset, record.nameSize));
+	}
+
+	const uint32 numItems = snapshot.getNumItems();
+	m_items.reserve(numItems);
+	for (uint32 i = 0; i < numItems; i++) {
+		const SnapshotItem& record = snapshot.getItem(i);
+
+		ImageItem item;
+		item.description = snapshot.getString(record.descriptionOffset, record.descriptionSize);
+		item.minimum = record.minimum;
+		item.currentHighest = record.currentHighest;
+		item.seller = record.seller;
+		item.highestBidder = record.highestBidder;
+		item.hasBidder = record.hasBidder != 0;
+		item.startTime = snapshot.getBaseTime() - record.elapsed;
+		m_items[record.itemID] = std::move(item);
+	}
+}
+
+void StateImage::addConnection(uint32 address, uint16 port, const std::string& name) {
+	ImageConnection& connection = m_connections[address];
+	connection.port = port;
+	connection.name = name;
+}
+
+void StateImage::addItem(uint32 itemID, const ImageItem& item) {
+	m_items[itemID] = item;
+}
+
+bool StateImage::apply(RecordType type, JournalReader& reader) {
+	switch (type) {
+	case RecordType::REGISTER: {
+		const std::string ip = reader.readString();
+		const std::string port = reader.readString();
+		const std::string name = reader.readString();
+		if (!reader.isValid()) {
+			return false;
+		}
+
+		const IPV4Address address(ip, port);
+		addConnection(address.getEndpointKey().address, reinterpret_cast<const sockaddr_in*>(address.getSocketAddress())->sin_port, name);
+		return true;
+	}
+	case RecordType::DEREGISTER: {
+		const std::string ip = reader.readString();
+		if (!reader.isValid()) {
+			return false;
+		}
+
+		m_connections.erase(parseAddress(ip));
+		return true;
+	}
+	case RecordType::START: {
+		const uint32 itemID = reader.readUInt32();
+		ImageItem item;
+		item.description = reader.readString();
+		item.minimum = reader.readFloat32();
+		item.currentHighest = reader.readFloat32();
+		item.seller = parseAddress(reader.readString());
+		const std::string highestBidder = reader.readString();
+		item.highestBidder = parseAddress(highestBidder);
+		item.hasBidder = !highestBidder.empty();
+		item.startTime = reader.readUInt64();
+		if (!reader.isValid()) {
+			return false;
+		}
+
+		m_items[itemID] = std::move(item);
+		return true;
+	}
+	case RecordType::BID: {
+		const uint32 itemID = reader.readUInt32();
+		const float32 amount = reader.readFloat32();
+		const std::string bidder = reader.readString();
+		if (!reader.isValid()) {
+			return false;
+		}
+
+		auto iter = m_items.find(itemID);
+		if (iter != m_items.end()) {
+			iter->second.currentHighest = amount;
+			iter->second.highestBidder = parseAddress(bidder);
+			iter->second.hasBidder = !bidder.empty();
+		}
+		return true;
+	}
+	case RecordType::END: {
+		const uint32 itemID = reader.readUInt32();
+		if (!reader.isValid()) {
+			return false;
+		}
+
+		m_items.erase(itemID);
+		return true;
+	}
+	case RecordType::CHECKPOINT:
+		// Only a marker, for whoever reads the journal back
+		reader.readUInt64();
+		return reader.isValid();
+	default:
+		return false;
+	}
+}
+
+void StateImage::clear() {
+	m_connections.clear();
+	m_items.clear();
+}
+
+bool StateImage::write(const std::string& path, uint64 time) const {
+	SnapshotWriter snapshot;
+	snapshot.reserve(static_cast<uint32>(m_connections.size()), static_cast<uint32>(m_items.size()));
+
+	for (const auto& pair : m_connections) {
+		snapshot.addConnection(pair.first, pair.second.port, pair.second.name);
+	}
+
+	for (const auto& pair : m_items) {
+		const ImageItem& item = pair.second;
+
+		SnapshotItem record = {};
+		record.itemID = pair.first;
+		record.minimum = item.minimum;
+		record.currentHighest = item.currentHighest;
+		record.seller = item.seller;
+		if (item.hasBidder) {
+			record.highestBidder = item.highestBidder;
+			record.hasBidder = 1;
+		}
+		record.elapsed = (time > item.startTime) ? time - item.startTime : 0;
+		snapshot.addItem(record, item.description);
+	}
+
+	return snapshot.write(path, time);
+}
+
+uint32 StateImage::parseAddress(const std::string& address) {
+	return !address.empty() ? IPV4Address(address, "0").getEndpointKey().address : 0;
+}
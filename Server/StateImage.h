@@ -0,0 +1,60 @@
+#pragma once
+
+#include "Types.h"
+
+#include <string>
+#include <unordered_map>
+
+class Snapshot;
+class JournalReader;
+
+// What a journal record holds, each one describes the state it leaves behind
+enum class RecordType : uint8 {
+	REGISTER,
+	DEREGISTER,
+	START,
+	BID,
+	END,
+	CHECKPOINT	// A snapshot taken at the time it holds has everything journaled before it
+};
+
+// Addresses and ports are in network byte order, clients are known by their address alone
+struct ImageConnection {
+	uint16 port;
+	std::string name;
+};
+
+struct ImageItem {
+	std::string description;
+	float32 minimum;
+	float32 currentHighest;
+	uint32 seller;
+	uint32 highestBidder;	// Only if hasBidder is set
+	bool hasBidder;
+	uint64 startTime;		// In 100 nanosecond ticks
+};
+
+// The saved state as the snapshot and the journal have it between them, kept apart from the live
+// one so it can be written out without taking any of the server's locks.
+class StateImage {
+private:
+	std::unordered_map<uint32, ImageConnection> m_connections;
+	std::unordered_map<uint32, ImageItem> m_items;
+public:
+	// Start times count back from when the snapshot was taken
+	void load(const Snapshot& snapshot);
+	void addConnection(uint32 address, uint16 port, const std::string& name);
+	void addItem(uint32 itemID, const ImageItem& item);
+	// Does what the record says, false if it is cut short or of a type this server doesn't know
+	bool apply(RecordType type, JournalReader& reader);
+	void clear();
+
+	const std::unordered_map<uint32, ImageConnection>& getConnections() const { return m_connections; }
+	std::unordered_map<uint32, ImageItem>& getItems() { return m_items; }
+
+	// Snapshot of everything as it is at time
+	bool write(const std::string& path, uint64 time) const;
+
+	// As the journal stores them, zero for an empty string
+	static uint32 parseAddress(const std::string& address);
+};